@@ -9,14 +9,27 @@
  * - A dedicated worker task is available for deferred actions.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <limits>
+#include <memory>
+#include <new>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "sdkconfig.h"
 
 extern "C"
@@ -28,14 +41,28 @@ extern "C"
 
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_heap_caps.h"
 #include "esp_http_server.h"
+#include "esp_random.h"
+#include "nvs.h"
+
+#include "mbedtls/base64.h"
+#include "mbedtls/sha256.h"
 
 #if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
 #include "esp_littlefs.h"
 #endif
+
+#if CONFIG_HTTP_SERVER_PM_BOOST && !CONFIG_IDF_TARGET_LINUX
+#include "esp_pm.h"
+#include "esp_wifi.h"
+#endif
 } // extern "C"
 
+#include "http_coro.hpp"
+#include "http_json.hpp"
 #include "http_pages.hpp"
+#include "http_routes.hpp"
 #include "http_server.hpp"
 
 static const char *TAG = "http_server";
@@ -44,6 +71,226 @@ static const char *TAG = "http_server";
 #define CONFIG_HTTP_SERVER_ENABLE_LITTLEFS 0
 #endif
 
+#ifndef CONFIG_HTTP_SERVER_TRANSFER_THRESHOLD
+#define CONFIG_HTTP_SERVER_TRANSFER_THRESHOLD 16384
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TRANSFER_CHUNK_SIZE
+#define CONFIG_HTTP_SERVER_TRANSFER_CHUNK_SIZE 4096
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_MAX_TRANSFERS
+#define CONFIG_HTTP_SERVER_MAX_TRANSFERS 4
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_IDLE_TIMEOUT_S
+#define CONFIG_HTTP_SERVER_IDLE_TIMEOUT_S 30
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_IDLE_MIN_S
+#define CONFIG_HTTP_SERVER_IDLE_MIN_S 3
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_MAX_STREAMS
+#define CONFIG_HTTP_SERVER_MAX_STREAMS 2
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_STREAM_MAX_READERS
+#define CONFIG_HTTP_SERVER_STREAM_MAX_READERS 4
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_STREAM_POLL_MS
+#define CONFIG_HTTP_SERVER_STREAM_POLL_MS 50
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_CORO_MAX_HANDLERS
+#define CONFIG_HTTP_SERVER_CORO_MAX_HANDLERS 4
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_CORO_FRAME_BYTES
+#define CONFIG_HTTP_SERVER_CORO_FRAME_BYTES 1024
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TIMERS
+#define CONFIG_HTTP_SERVER_TIMERS 16
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TIMER_TICK_MS
+#define CONFIG_HTTP_SERVER_TIMER_TICK_MS 100
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_WORKER_STACK_SIZE
+#define CONFIG_HTTP_SERVER_WORKER_STACK_SIZE 8192
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_INDEX_ENTRIES
+#define CONFIG_HTTP_SERVER_INDEX_ENTRIES 64
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_CACHE_BYTES
+#define CONFIG_HTTP_SERVER_CACHE_BYTES 32768
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_OPEN_FILES
+#define CONFIG_HTTP_SERVER_OPEN_FILES 4
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_CACHE_MAX_ENTRY_BYTES
+#define CONFIG_HTTP_SERVER_CACHE_MAX_ENTRY_BYTES 8192
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_CACHE_SHORT_MAX_AGE_S
+#define CONFIG_HTTP_SERVER_CACHE_SHORT_MAX_AGE_S 60
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_CACHE_LONG_MAX_AGE_S
+#define CONFIG_HTTP_SERVER_CACHE_LONG_MAX_AGE_S 31536000
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_SETTINGS_NAMESPACE
+#define CONFIG_HTTP_SERVER_SETTINGS_NAMESPACE "http_settings"
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_SETTINGS_DEBOUNCE_MS
+#define CONFIG_HTTP_SERVER_SETTINGS_DEBOUNCE_MS 500
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_SETTINGS_MAX_DELAY_MS
+#define CONFIG_HTTP_SERVER_SETTINGS_MAX_DELAY_MS 5000
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_SETTINGS_MAX_KEYS
+#define CONFIG_HTTP_SERVER_SETTINGS_MAX_KEYS 32
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_PM_BOOST
+#define CONFIG_HTTP_SERVER_PM_BOOST 0
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_PM_HOLD_MS
+#define CONFIG_HTTP_SERVER_PM_HOLD_MS 2000
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_PM_WIFI_PS
+#define CONFIG_HTTP_SERVER_PM_WIFI_PS 0
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_MEM_CHECK_MS
+#define CONFIG_HTTP_SERVER_MEM_CHECK_MS 500
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_MEM_LOW_INTERNAL
+#define CONFIG_HTTP_SERVER_MEM_LOW_INTERNAL 20480
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_MEM_LOW_INTERNAL_BLOCK
+#define CONFIG_HTTP_SERVER_MEM_LOW_INTERNAL_BLOCK 4096
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_MEM_LOW_PSRAM
+#define CONFIG_HTTP_SERVER_MEM_LOW_PSRAM 0
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_MEM_LOW_PSRAM_BLOCK
+#define CONFIG_HTTP_SERVER_MEM_LOW_PSRAM_BLOCK 0
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_MEM_RECOVER_PERCENT
+#define CONFIG_HTTP_SERVER_MEM_RECOVER_PERCENT 150
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_MEM_DEGRADED_UPLOAD_MAX
+#define CONFIG_HTTP_SERVER_MEM_DEGRADED_UPLOAD_MAX 16384
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_ENABLE_COMBO
+#define CONFIG_HTTP_SERVER_ENABLE_COMBO 0
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_COMBO_MAX_PARTS
+#define CONFIG_HTTP_SERVER_COMBO_MAX_PARTS 16
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_ENABLE_TAIL
+#define CONFIG_HTTP_SERVER_ENABLE_TAIL 0
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TAIL_URI
+#define CONFIG_HTTP_SERVER_TAIL_URI "/tail"
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TAIL_DIR
+#define CONFIG_HTTP_SERVER_TAIL_DIR "/logs"
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TAIL_MAX_BYTES
+#define CONFIG_HTTP_SERVER_TAIL_MAX_BYTES 16384
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TAIL_MAX_FOLLOWERS
+#define CONFIG_HTTP_SERVER_TAIL_MAX_FOLLOWERS 2
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TAIL_POLL_MS
+#define CONFIG_HTTP_SERVER_TAIL_POLL_MS 500
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_ENABLE_UPLOAD
+#define CONFIG_HTTP_SERVER_ENABLE_UPLOAD 0
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_UPLOAD_URI
+#define CONFIG_HTTP_SERVER_UPLOAD_URI "/upload"
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_UPLOAD_DIR
+#define CONFIG_HTTP_SERVER_UPLOAD_DIR ""
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_UPLOAD_MAX_BYTES
+#define CONFIG_HTTP_SERVER_UPLOAD_MAX_BYTES 4194304
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_UPLOAD_PARTIAL_TTL_S
+#define CONFIG_HTTP_SERVER_UPLOAD_PARTIAL_TTL_S 3600
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TUNE_ENDPOINT
+#define CONFIG_HTTP_SERVER_TUNE_ENDPOINT 0
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TUNE_URI
+#define CONFIG_HTTP_SERVER_TUNE_URI "/_http/tune"
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_TUNE_TOKEN
+#define CONFIG_HTTP_SERVER_TUNE_TOKEN ""
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_AUTH_SESSIONS
+#define CONFIG_HTTP_SERVER_AUTH_SESSIONS 8
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_AUTH_SESSION_TTL_S
+#define CONFIG_HTTP_SERVER_AUTH_SESSION_TTL_S 3600
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_AUTH_REALM
+#define CONFIG_HTTP_SERVER_AUTH_REALM "device"
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_AUTH_HEADER_MAX
+#define CONFIG_HTTP_SERVER_AUTH_HEADER_MAX 2048
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_HOT_LIST_SIZE
+#define CONFIG_HTTP_SERVER_HOT_LIST_SIZE 16
+#endif
+
+#ifndef CONFIG_HTTP_SERVER_HOT_LIST_INTERVAL_S
+#define CONFIG_HTTP_SERVER_HOT_LIST_INTERVAL_S 900
+#endif
+
 #if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
 #ifndef CONFIG_HTTP_SERVER_LITTLEFS_MOUNT
 #define CONFIG_HTTP_SERVER_LITTLEFS_MOUNT "/littlefs"
@@ -54,6 +301,42 @@ static const char *TAG = "http_server";
 #endif
 #endif
 
+namespace http_srv
+{
+    /**
+     * Sample ring shared by one producer and any number of HTTP readers.
+     * Created by create_stream() and never freed.
+     */
+    struct Stream
+    {
+        const char *uri;
+        SampleType type;
+        uint8_t fields;
+        uint16_t sample_size;
+        uint32_t capacity; // Samples; a power of two.
+        uint32_t guard;    // Largest batch published at once.
+        uint8_t *ring;
+        std::atomic<uint32_t> head{0}; // Sequence number of the next sample.
+    };
+}
+
+#if defined(__cpp_impl_coroutine)
+/** Server-side access to the private state of a coroutine Request. */
+struct http_srv::co::detail::Access
+{
+    static Request *construct(void *mem) { return new (mem) Request(); }
+
+    static void bind(Request &r, httpd_req_t *req, void *run)
+    {
+        r.req_ = req;
+        r.run_ = run;
+        r.received_ = 0U;
+    }
+
+    static void *run_of(Request &r) { return r.run_; }
+};
+#endif
+
 namespace
 {
     // -------------------------------------------------------------------------
@@ -64,6 +347,7 @@ namespace
     static httpd_handle_t s_server = nullptr;
 
     static size_t s_max_open_sockets = 0U;
+    static TickType_t s_send_wait_ticks = pdMS_TO_TICKS(5000); // httpd send_wait_timeout.
     static TaskHandle_t s_task = nullptr;
     static bool s_task_exit = false;
 
@@ -80,6 +364,116 @@ namespace
     static EventGroupHandle_t s_evt = nullptr;
     static constexpr EventBits_t READY_BIT = (1U << 0);
 
+    // -------------------------------------------------------------------------
+    // Counters reported by http_srv::get_stats(). Updated without s_mutex.
+    // -------------------------------------------------------------------------
+
+    struct Counters
+    {
+        std::atomic<uint32_t> transfers_started{0};
+        std::atomic<uint32_t> transfers_completed{0};
+        std::atomic<uint32_t> transfers_aborted{0};
+        std::atomic<uint32_t> transfers_inline{0};
+        std::atomic<uint32_t> transfers_active{0};
+        std::atomic<uint32_t> index_hits{0};
+        std::atomic<uint32_t> index_misses{0};
+        std::atomic<uint32_t> cache_hits{0};
+        std::atomic<uint32_t> cache_misses{0};
+        std::atomic<uint32_t> cache_bytes{0};
+        std::atomic<uint32_t> prewarmed{0};
+        std::atomic<uint32_t> open_file_hits{0};
+        std::atomic<uint32_t> open_file_misses{0};
+        std::atomic<uint32_t> auth_verifications{0};
+        std::atomic<uint32_t> auth_session_hits{0};
+        std::atomic<uint32_t> auth_failures{0};
+        std::atomic<uint32_t> sessions_reaped{0};
+        std::atomic<uint32_t> sessions_open{0};
+        std::atomic<uint32_t> uploads_completed{0};
+        std::atomic<uint32_t> uploads_expired{0};
+        std::atomic<uint32_t> settings_commits{0};
+        std::atomic<uint32_t> settings_keys_written{0};
+        std::atomic<uint32_t> pm_boosts{0};
+        std::atomic<uint32_t> mem_degraded_entries{0};
+        std::atomic<uint32_t> mem_degraded_exits{0};
+    };
+
+    static Counters s_counters;
+
+    // -------------------------------------------------------------------------
+    // Tuning snapshots.
+    //
+    // tune() writes a complete Tuning into the next slot of a small ring and
+    // then publishes its address with one release store. Readers take no
+    // lock: they load the address and copy the slot under its sequence
+    // counter, which a writer makes odd while it rewrites the slot. If the
+    // counter changed during the copy (the reader was preempted across
+    // kTuningSlots - 1 further tune() calls and its slot was reused), the
+    // reader starts again from the newly published slot, which is never the
+    // one being written. Writers are serialized by s_mutex.
+    // -------------------------------------------------------------------------
+
+    static constexpr size_t kTuningSlots = 4U;
+
+    struct TuningSlot
+    {
+        std::atomic<uint32_t> seq; // Odd while the slot is rewritten.
+        http_srv::Tuning value;
+    };
+
+    static TuningSlot s_tuning_slots[kTuningSlots] = {
+        {0U,
+         {0U,
+          CONFIG_HTTP_SERVER_CACHE_BYTES,
+          CONFIG_HTTP_SERVER_CACHE_MAX_ENTRY_BYTES,
+          CONFIG_HTTP_SERVER_TRANSFER_THRESHOLD,
+          CONFIG_HTTP_SERVER_TRANSFER_CHUNK_SIZE,
+          CONFIG_HTTP_SERVER_MAX_TRANSFERS,
+          ESP_LOG_INFO}},
+    };
+
+    static std::atomic<const TuningSlot *> s_tuning{&s_tuning_slots[0]};
+
+    // Set by the memory monitor while free heap is below its thresholds.
+    static std::atomic<bool> s_mem_degraded{false};
+    static constexpr uint32_t kDegradedChunkSize = 1024U;
+
+    // Set while the power-management boost is held.
+    static std::atomic<bool> s_pm_held{false};
+
+    /** Settings as configured by tune(). */
+    static http_srv::Tuning stored_tuning()
+    {
+        for (;;)
+        {
+            const TuningSlot *slot = s_tuning.load(std::memory_order_acquire);
+            const uint32_t seq = slot->seq.load(std::memory_order_acquire);
+            const http_srv::Tuning t = slot->value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((seq & 1U) == 0U && slot->seq.load(std::memory_order_relaxed) == seq)
+            {
+                return t;
+            }
+        }
+    }
+
+    /** Settings in effect: stored_tuning(), cut down under memory pressure. */
+    static http_srv::Tuning tuning()
+    {
+        http_srv::Tuning t = stored_tuning();
+        if (s_mem_degraded.load(std::memory_order_relaxed))
+        {
+            t.cache_bytes = 0U;
+            t.transfer_chunk_size = std::min<uint32_t>(t.transfer_chunk_size, kDegradedChunkSize);
+        }
+        return t;
+    }
+
+#if defined(__cpp_consteval)
+    // Installed compile-time route table (see http_routes.hpp), consulted by
+    // the catch-all handler. Read without the mutex on every miss.
+    static std::atomic<http_srv::RouteDispatchFn> s_route_dispatch{nullptr};
+#endif
+
 #if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
     // -------------------------------------------------------------------------
     // LittleFS mount configuration.
@@ -174,38 +568,170 @@ namespace
         {
         case 200:
             return "200 OK";
+        case 201:
+            return "201 Created";
         case 202:
             return "202 Accepted";
         case 204:
             return "204 No Content";
+        case 206:
+            return "206 Partial Content";
+        case 301:
+            return "301 Moved Permanently";
         case 302:
             return "302 Found";
+        case 304:
+            return "304 Not Modified";
+        case 307:
+            return "307 Temporary Redirect";
+        case 308:
+            return "308 Permanent Redirect";
         case 400:
             return "400 Bad Request";
+        case 401:
+            return "401 Unauthorized";
         case 403:
             return "403 Forbidden";
         case 404:
             return "404 Not Found";
         case 405:
             return "405 Method Not Allowed";
+        case 408:
+            return "408 Request Timeout";
         case 409:
             return "409 Conflict";
+        case 411:
+            return "411 Length Required";
         case 413:
             return "413 Payload Too Large";
+        case 414:
+            return "414 URI Too Long";
         case 415:
             return "415 Unsupported Media Type";
+        case 416:
+            return "416 Range Not Satisfiable";
+        case 429:
+            return "429 Too Many Requests";
+        case 431:
+            return "431 Request Header Fields Too Large";
+        case 501:
+            return "501 Not Implemented";
+        case 503:
+            return "503 Service Unavailable";
+        case 505:
+            return "505 HTTP Version Not Supported";
         default:
             return "500 Internal Server Error";
         }
     }
 
-    static void set_no_cache_headers(httpd_req_t *req)
+    // -------------------------------------------------------------------------
+    // Cache policies guarded by s_mutex.
+    //
+    // Each policy has a constant Cache-Control value assembled by the
+    // preprocessor, so emitting it is a pointer store (httpd keeps the
+    // pointer until the headers go out, possibly from the worker task).
+    // Static files pick their policy from s_cache_rules once per path; the
+    // metadata index remembers the result.
+    // -------------------------------------------------------------------------
+
+#define HTTP_SRV_STR_(x) #x
+#define HTTP_SRV_STR(x) HTTP_SRV_STR_(x)
+
+    static constexpr const char *kCacheControl[] = {
+        "no-store",
+        "no-cache",
+        "public, max-age=" HTTP_SRV_STR(CONFIG_HTTP_SERVER_CACHE_SHORT_MAX_AGE_S) ", must-revalidate",
+        "public, max-age=" HTTP_SRV_STR(CONFIG_HTTP_SERVER_CACHE_LONG_MAX_AGE_S),
+        "public, max-age=" HTTP_SRV_STR(CONFIG_HTTP_SERVER_CACHE_LONG_MAX_AGE_S) ", immutable",
+    };
+
+    // Files on the partition are replaced in place (uploads, OTA of the
+    // filesystem image), so nothing is cached for long by default; LONG and
+    // IMMUTABLE are left to path rules for fingerprinted names.
+    static const http_srv::CacheRule kDefaultCacheRules[] = {
+        {"font/*", http_srv::CachePolicy::SHORT},
+        {"image/*", http_srv::CachePolicy::SHORT},
+        {"text/html", http_srv::CachePolicy::SHORT},
+    };
+
+    struct CacheRuleEntry
+    {
+        std::string pattern;
+        http_srv::CachePolicy policy;
+    };
+
+    static std::vector<CacheRuleEntry> s_cache_rules = []
+    {
+        std::vector<CacheRuleEntry> rules;
+        for (const auto &r : kDefaultCacheRules)
+        {
+            rules.push_back(CacheRuleEntry{r.pattern, r.policy});
+        }
+        return rules;
+    }();
+
+    static bool cache_rule_matches(std::string_view pat,
+                                   std::string_view path,
+                                   std::string_view ctype)
+    {
+        const bool prefix = pat.back() == '*';
+
+        if (pat.front() == '/')
+        {
+            return prefix ? path.substr(0, pat.size() - 1U) == pat.substr(0, pat.size() - 1U)
+                          : path == pat;
+        }
+
+        if (pat.size() > 1U && pat[0] == '*' && pat[1] == '.')
+        {
+            pat.remove_prefix(1);
+            return path.size() >= pat.size() && path.substr(path.size() - pat.size()) == pat;
+        }
+
+        const std::string_view type = ctype.substr(0, ctype.find(';'));
+        return prefix ? type.substr(0, pat.size() - 1U) == pat.substr(0, pat.size() - 1U)
+                      : type == pat;
+    }
+
+    static http_srv::CachePolicy cache_policy_for(std::string_view path, std::string_view ctype)
+    {
+        http_srv::CachePolicy policy = http_srv::CachePolicy::REVALIDATE;
+        if (!lock_mutex())
+        {
+            return policy;
+        }
+
+        for (const auto &r : s_cache_rules)
+        {
+            if (cache_rule_matches(r.pattern, path, ctype))
+            {
+                policy = r.policy;
+                break;
+            }
+        }
+        unlock_mutex();
+        return policy;
+    }
+
+    static void set_cache_headers(httpd_req_t *req,
+                                  http_srv::CachePolicy policy,
+                                  bool vary_accept = false)
     {
         (void)httpd_resp_set_hdr(req, "Cache-Control",
-                                 "no-cache, no-store, must-revalidate");
-        (void)httpd_resp_set_hdr(req, "Pragma", "no-cache");
-        (void)httpd_resp_set_hdr(req, "Expires", "0");
-        (void)httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+                                 kCacheControl[static_cast<size_t>(policy)]);
+        if (policy == http_srv::CachePolicy::NO_STORE)
+        {
+            (void)httpd_resp_set_hdr(req, "Pragma", "no-cache");
+            (void)httpd_resp_set_hdr(req, "Expires", "0");
+        }
+        else
+        {
+            // Stored copies depend on which .gz (and, for negotiated images,
+            // which format) variant was picked.
+            (void)httpd_resp_set_hdr(req, "Vary",
+                                     vary_accept ? "Accept, Accept-Encoding" : "Accept-Encoding");
+        }
     }
 
     static void close_all_sessions_internal()
@@ -261,931 +787,8239 @@ namespace
     static esp_err_t send_template(httpd_req_t *req,
                                    const char *tmpl,
                                    const char *ctype,
-                                   bool no_cache = true)
+                                   http_srv::CachePolicy policy = http_srv::CachePolicy::REVALIDATE)
     {
         if (req == nullptr || tmpl == nullptr || ctype == nullptr)
         {
             return ESP_FAIL;
         }
 
-        if (no_cache)
-        {
-            set_no_cache_headers(req);
-        }
+        set_cache_headers(req, policy);
 
         return send_text(req, 200, ctype, tmpl);
     }
 
-#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
     // -------------------------------------------------------------------------
-    // LittleFS file serving.
+    // Error pages guarded by s_mutex.
+    //
+    // Every error code in status_for() has a slot holding the body to send.
+    // Slots start out with a canned plain-text body and can be replaced by
+    // application-owned pages (set_error_page()) or by /errors/<code>.html on
+    // LittleFS, which is read once and kept in RAM. Sending an error is a
+    // slot copy plus one httpd_resp_send().
     // -------------------------------------------------------------------------
 
-    static esp_err_t ensure_fs_mounted()
+    using CachedBody = std::shared_ptr<const std::vector<char>>;
+
+    struct ErrorPage
     {
-        if (!lock_mutex())
-        {
-            return ESP_FAIL;
-        }
+        const char *data;
+        size_t len;
+        const char *ctype;
+        CachedBody owned; // Keeps a filesystem-loaded body alive.
+        bool from_app;
+    };
 
-        if (s_fs_mounted)
+    static constexpr int kErrorCodes[] = {
+        400, 401, 403, 404, 405, 408, 409, 411, 413, 414,
+        415, 416, 429, 431, 500, 501, 503, 505};
+
+    static constexpr size_t kErrorSlots = sizeof(kErrorCodes) / sizeof(kErrorCodes[0]);
+
+    static constexpr const char *kErrorCtypeText = "text/plain; charset=utf-8";
+    static constexpr const char *kErrorCtypeHtml = "text/html; charset=utf-8";
+
+    static int error_slot(int code)
+    {
+        switch (code)
         {
-            unlock_mutex();
-            return ESP_OK;
+        case 400:
+            return 0;
+        case 401:
+            return 1;
+        case 403:
+            return 2;
+        case 404:
+            return 3;
+        case 405:
+            return 4;
+        case 408:
+            return 5;
+        case 409:
+            return 6;
+        case 411:
+            return 7;
+        case 413:
+            return 8;
+        case 414:
+            return 9;
+        case 415:
+            return 10;
+        case 416:
+            return 11;
+        case 429:
+            return 12;
+        case 431:
+            return 13;
+        case 500:
+            return 14;
+        case 501:
+            return 15;
+        case 503:
+            return 16;
+        case 505:
+            return 17;
+        default:
+            return 14;
         }
+    }
 
-        esp_vfs_littlefs_conf_t conf{};
-        conf.base_path = kFsBase;
-        conf.partition_label = kFsLabel;
-        conf.format_if_mount_failed = true;
-        conf.dont_mount = false;
+    static ErrorPage canned_error_page(int code)
+    {
+        const char *status = status_for(code);
+        return ErrorPage{status, std::strlen(status), kErrorCtypeText, nullptr, false};
+    }
 
-        ESP_LOGI(TAG, "LittleFS mounting: label='%s' base='%s'.", kFsLabel, kFsBase);
+    static ErrorPage s_error_pages[kErrorSlots] = {};
+    static bool s_error_pages_init = false;
 
-        const esp_err_t rc = esp_vfs_littlefs_register(&conf);
-        if (rc != ESP_OK)
+    static void init_error_pages_locked()
+    {
+        if (s_error_pages_init)
         {
-            unlock_mutex();
-            ESP_LOGE(TAG, "LittleFS mount failed: %s.", esp_err_to_name(rc));
-            return rc;
+            return;
         }
 
-        size_t total = 0U;
-        size_t used = 0U;
-        const esp_err_t info_rc = esp_littlefs_info(kFsLabel, &total, &used);
-        if (info_rc == ESP_OK)
+        for (size_t i = 0U; i < kErrorSlots; ++i)
         {
-            ESP_LOGI(TAG,
-                     "LittleFS total=%u used=%u.",
-                     static_cast<unsigned>(total),
-                     static_cast<unsigned>(used));
+            s_error_pages[i] = canned_error_page(kErrorCodes[i]);
         }
-        else
-        {
-            ESP_LOGW(TAG, "LittleFS info failed: %s.", esp_err_to_name(info_rc));
+        s_error_pages_init = true;
+    }
+
+    static esp_err_t send_error(httpd_req_t *req, int code)
+    {
+        ErrorPage page{};
+        if (lock_mutex())
+        {
+            init_error_pages_locked();
+            page = s_error_pages[error_slot(code)];
+            unlock_mutex();
+        }
+        else
+        {
+            page = canned_error_page(code);
         }
 
-        s_fs_mounted = true;
-        unlock_mutex();
-        return ESP_OK;
+        httpd_resp_set_status(req, status_for(code));
+        httpd_resp_set_type(req, page.ctype);
+
+        return httpd_resp_send(req, page.data, static_cast<ssize_t>(page.len));
     }
 
-    static bool has_dotdot(std::string_view uri)
+    static int error_code_for(httpd_err_code_t err)
     {
-        return uri.find("..") != std::string_view::npos;
+        switch (err)
+        {
+        case HTTPD_501_METHOD_NOT_IMPLEMENTED:
+            return 501;
+        case HTTPD_505_VERSION_NOT_SUPPORTED:
+            return 505;
+        case HTTPD_400_BAD_REQUEST:
+            return 400;
+        case HTTPD_401_UNAUTHORIZED:
+            return 401;
+        case HTTPD_403_FORBIDDEN:
+            return 403;
+        case HTTPD_404_NOT_FOUND:
+            return 404;
+        case HTTPD_405_METHOD_NOT_ALLOWED:
+            return 405;
+        case HTTPD_408_REQ_TIMEOUT:
+            return 408;
+        case HTTPD_411_LENGTH_REQUIRED:
+            return 411;
+        case HTTPD_414_URI_TOO_LONG:
+            return 414;
+        case HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE:
+            return 431;
+        default:
+            return 500;
+        }
     }
 
-    static bool ends_with(std::string_view s, std::string_view suffix)
+    /**
+     * Registered for every httpd error code except 404. Protocol-level errors
+     * close the connection since the request stream may be out of sync.
+     */
+    static esp_err_t handle_http_error(httpd_req_t *req, httpd_err_code_t err)
     {
-        return s.size() >= suffix.size() &&
-               s.substr(s.size() - suffix.size()) == suffix;
+        const int code = error_code_for(err);
+        const esp_err_t rc = send_error(req, code);
+
+        const bool keep_alive = (code == 401 || code == 403 || code == 405);
+        return (rc == ESP_OK && keep_alive) ? ESP_OK : ESP_FAIL;
     }
 
-    static std::string content_type_for_path(std::string_view path_no_gz)
+    static uint32_t query_u32(const char *query, const char *key, uint32_t def)
     {
-        if (ends_with(path_no_gz, ".htm") || ends_with(path_no_gz, ".html"))
-            return "text/html; charset=utf-8";
-        if (ends_with(path_no_gz, ".css"))
-            return "text/css; charset=utf-8";
-        if (ends_with(path_no_gz, ".js"))
-            return "application/javascript; charset=utf-8";
-        if (ends_with(path_no_gz, ".json"))
-            return "application/json; charset=utf-8";
-        if (ends_with(path_no_gz, ".svg"))
-            return "image/svg+xml";
-        if (ends_with(path_no_gz, ".png"))
-            return "image/png";
-        if (ends_with(path_no_gz, ".jpg") || ends_with(path_no_gz, ".jpeg"))
-            return "image/jpeg";
-        if (ends_with(path_no_gz, ".gif"))
-            return "image/gif";
-        if (ends_with(path_no_gz, ".ico"))
-            return "image/x-icon";
-        if (ends_with(path_no_gz, ".woff2"))
-            return "font/woff2";
-        if (ends_with(path_no_gz, ".woff"))
-            return "font/woff";
-        if (ends_with(path_no_gz, ".ttf"))
-            return "font/ttf";
-        if (ends_with(path_no_gz, ".map"))
-            return "application/json; charset=utf-8";
+        char val[16];
+        if (query == nullptr || httpd_query_key_value(query, key, val, sizeof(val)) != ESP_OK)
+        {
+            return def;
+        }
 
-        return "text/plain; charset=utf-8";
+        char *end = nullptr;
+        const unsigned long v = std::strtoul(val, &end, 10);
+        return (end != val && *end == '\0' && v <= UINT32_MAX) ? static_cast<uint32_t>(v) : def;
     }
 
-    static bool file_exists(const std::string &full_path)
+    static std::string_view uri_path(const char *uri)
     {
-        FILE *f = std::fopen(full_path.c_str(), "rb");
-        if (f == nullptr)
+        if (uri == nullptr)
         {
-            return false;
+            return {};
         }
-        std::fclose(f);
-        return true;
+
+        std::string_view u(uri);
+        const size_t end = u.find_first_of("?#");
+        return (end == std::string_view::npos) ? u : u.substr(0, end);
     }
 
-    static bool resolve_fs_path(const char *uri,
-                                std::string &out_full_path,
-                                std::string &out_ctype,
-                                bool &out_is_gz)
+    /** FNV-1a, for content tags and file names; not collision resistant. */
+    static uint64_t fnv1a64(const void *data, size_t len)
     {
-        out_full_path.clear();
-        out_ctype.clear();
-        out_is_gz = false;
-
-        if (uri == nullptr || uri[0] != '/')
+        const auto *p = static_cast<const uint8_t *>(data);
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0U; i < len; ++i)
         {
-            return false;
+            h = (h ^ p[i]) * 1099511628211ULL;
         }
+        return h;
+    }
 
-        std::string_view u(uri);
-        if (has_dotdot(u))
+    /** Quoted ETag for a 64-bit tag. */
+    static void format_etag(uint64_t tag, char (&out)[24])
+    {
+        std::snprintf(out, sizeof(out), "\"%016llx\"", static_cast<unsigned long long>(tag));
+    }
+
+    /**
+     * True if the request's If-None-Match lists etag (or is "*").
+     */
+    static bool etag_matches(httpd_req_t *req, std::string_view etag)
+    {
+        char inm[128];
+        if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) != ESP_OK)
         {
             return false;
         }
 
-        std::string logical(uri);
+        const std::string_view v(inm);
+        return v == "*" || v.find(etag) != std::string_view::npos;
+    }
 
-        if (!logical.empty() && logical.back() == '/')
+    /**
+     * Compare without an early exit so timing does not reveal how much of a
+     * secret matched.
+     */
+    static bool equal_const_time(std::string_view a, std::string_view b)
+    {
+        unsigned diff = static_cast<unsigned>(a.size() ^ b.size());
+        for (size_t i = 0U; i < a.size(); ++i)
         {
-            logical += "index.html";
+            diff |= static_cast<unsigned char>(a[i]) ^
+                    static_cast<unsigned char>(b.empty() ? 0 : b[i % b.size()]);
         }
-        if (logical == "/")
+        return diff == 0U;
+    }
+
+    static bool equal_const_time(const uint8_t *a, const uint8_t *b, size_t n)
+    {
+        unsigned diff = 0U;
+        for (size_t i = 0U; i < n; ++i)
         {
-            logical = "/index.html";
+            diff |= static_cast<unsigned>(a[i] ^ b[i]);
         }
+        return diff == 0U;
+    }
 
-        const bool requested_gz = ends_with(logical, ".gz");
-        if (requested_gz && logical.size() > 3U)
+    // -------------------------------------------------------------------------
+    // Redirect and rewrite table, published as an immutable snapshot.
+    //
+    // Rules are consulted only for URIs without a registered handler. Exact
+    // rules are kept sorted for binary search. Prefix rules are kept sorted by
+    // length, longest first, so the first hit is the most specific one.
+    //
+    // Writers copy the current table under s_mutex, edit the copy and swap
+    // the pointer. Readers take no lock and copy nothing: they announce
+    // themselves in s_redirect_readers, then load the pointer, and may use
+    // the rules (Location values included) until they leave. A replaced
+    // table is freed once no reader is left, which only writers wait for.
+    // -------------------------------------------------------------------------
+
+    struct RedirectRule
+    {
+        std::string from;
+        std::string target;
+        int code; // 0 for an internal rewrite.
+        bool prefix;
+    };
+
+    struct RedirectTable
+    {
+        std::vector<RedirectRule> exact;
+        std::vector<RedirectRule> prefix;
+    };
+
+    static std::atomic<const RedirectTable *> s_redirects{nullptr};
+    static std::atomic<uint32_t> s_redirect_readers{0};
+
+    /** Holds the current redirect table for the lifetime of the object. */
+    class RedirectSnapshot
+    {
+    public:
+        RedirectSnapshot()
         {
-            logical.resize(logical.size() - 3U);
+            // seq_cst on both sides: a reader that loads the old pointer has
+            // already been counted when the writer checks for readers.
+            s_redirect_readers.fetch_add(1U);
+            table_ = s_redirects.load();
         }
 
-        auto full = [&](const std::string &p) -> std::string
+        ~RedirectSnapshot()
         {
-            std::string fp;
-            fp.reserve(std::strlen(kFsBase) + p.size() + 1U);
-            fp += kFsBase;
-            fp += p;
-            return fp;
-        };
+            s_redirect_readers.fetch_sub(1U, std::memory_order_release);
+        }
 
-        std::vector<std::string> candidates;
-        candidates.reserve(2);
-        candidates.push_back(logical);
+        RedirectSnapshot(const RedirectSnapshot &) = delete;
+        RedirectSnapshot &operator=(const RedirectSnapshot &) = delete;
 
-        if (ends_with(logical, ".html"))
+        const RedirectTable *table() const { return table_; }
+
+    private:
+        const RedirectTable *table_;
+    };
+
+    static constexpr const char *kCaptiveProbes[] = {
+        "/generate_204",              // Android
+        "/gen_204",                   // Android
+        "/hotspot-detect.html",       // Apple
+        "/library/test/success.html", // Apple
+        "/connecttest.txt",           // Windows
+        "/ncsi.txt",                  // Windows
+        "/redirect",                  // Windows
+        "/canonical.html",            // Firefox
+        "/success.txt",               // Firefox
+    };
+
+    static bool is_redirect_code(int code)
+    {
+        return code == 301 || code == 302 || code == 307 || code == 308;
+    }
+
+    /**
+     * Apply edit to a copy of the redirect table and publish the copy. The
+     * copy is dropped if edit fails. Must not be called by a thread holding
+     * a RedirectSnapshot.
+     */
+    template <typename Edit>
+    static esp_err_t update_redirects(Edit &&edit)
+    {
+        if (!lock_mutex())
         {
-            std::string alt = logical;
-            alt.resize(alt.size() - 5U);
-            alt += ".htm";
-            if (alt != logical)
-            {
-                candidates.push_back(std::move(alt));
-            }
+            return ESP_FAIL;
         }
-        else if (ends_with(logical, ".htm"))
+
+        const RedirectTable *cur = s_redirects.load(std::memory_order_relaxed);
+        std::unique_ptr<RedirectTable> next = (cur != nullptr)
+                                                  ? std::make_unique<RedirectTable>(*cur)
+                                                  : std::make_unique<RedirectTable>();
+
+        const esp_err_t rc = edit(*next);
+        if (rc == ESP_OK)
         {
-            std::string alt = logical;
-            alt.resize(alt.size() - 4U);
-            alt += ".html";
-            if (alt != logical)
-            {
-                candidates.push_back(std::move(alt));
-            }
+            s_redirects.store(next.release());
         }
+        unlock_mutex();
 
-        for (const auto &cand : candidates)
+        if (rc != ESP_OK || cur == nullptr)
         {
-            const std::string gz = cand + ".gz";
-            const std::string gz_full = full(gz);
-
-            if (file_exists(gz_full))
-            {
-                out_full_path = gz_full;
-                out_is_gz = true;
-                out_ctype = content_type_for_path(cand);
-                return true;
-            }
-
-            const std::string plain_full = full(cand);
-            if (file_exists(plain_full))
-            {
-                out_full_path = plain_full;
-                out_is_gz = false;
-                out_ctype = content_type_for_path(cand);
-                return true;
-            }
+            return rc;
         }
 
-        return false;
+        // Requests hold a snapshot only while answering, so this is short.
+        while (s_redirect_readers.load() != 0U)
+        {
+            vTaskDelay(1);
+        }
+        delete cur;
+        return ESP_OK;
     }
 
-    static esp_err_t send_file_stream(httpd_req_t *req,
-                                      const std::string &full_path,
-                                      const std::string &ctype,
-                                      bool is_gz)
+    static esp_err_t add_redirect_rule(const char *from,
+                                       const char *target,
+                                       int code,
+                                       bool prefix)
     {
-        FILE *f = std::fopen(full_path.c_str(), "rb");
-        if (f == nullptr)
+        if (from == nullptr || from[0] != '/' ||
+            target == nullptr || target[0] == '\0')
         {
-            ESP_LOGW(TAG,
-                     "File open failed: %s (errno=%d).",
-                     full_path.c_str(),
-                     errno);
-
-            return send_text(req,
-                             500,
-                             "text/plain; charset=utf-8",
-                             "File open failed\n");
+            return ESP_ERR_INVALID_ARG;
         }
 
-        httpd_resp_set_type(req, ctype.c_str());
-        if (is_gz)
+        if (code != 0 && !is_redirect_code(code))
         {
-            (void)httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+            return ESP_ERR_INVALID_ARG;
         }
 
-        set_no_cache_headers(req);
+        if (code == 0 && target[0] != '/')
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
 
-        char buf[1024];
-        while (true)
+        const auto edit = [&](RedirectTable &t) -> esp_err_t
         {
-            const size_t n = std::fread(buf, 1, sizeof(buf), f);
-            if (n > 0U)
-            {
-                const ssize_t send_len =
-                    (n > static_cast<size_t>(std::numeric_limits<ssize_t>::max()))
-                        ? std::numeric_limits<ssize_t>::max()
-                        : static_cast<ssize_t>(n);
+            auto &rules = prefix ? t.prefix : t.exact;
+            const std::string_view key(from);
 
-                const esp_err_t rc = httpd_resp_send_chunk(req, buf, send_len);
-                if (rc != ESP_OK)
-                {
-                    std::fclose(f);
-                    return rc;
-                }
+            auto it = std::find_if(rules.begin(), rules.end(),
+                                   [&](const RedirectRule &r)
+                                   { return r.from == key; });
+            if (it != rules.end())
+            {
+                it->target = target;
+                it->code = code;
+                return ESP_OK;
             }
 
-            if (n < sizeof(buf))
+            rules.push_back(RedirectRule{std::string(from), std::string(target), code, prefix});
+
+            if (prefix)
             {
-                break;
+                std::stable_sort(rules.begin(), rules.end(),
+                                 [](const RedirectRule &a, const RedirectRule &b)
+                                 { return a.from.size() > b.from.size(); });
             }
-        }
+            else
+            {
+                std::sort(rules.begin(), rules.end(),
+                          [](const RedirectRule &a, const RedirectRule &b)
+                          { return a.from < b.from; });
+            }
+            return ESP_OK;
+        };
 
-        std::fclose(f);
-        return httpd_resp_send_chunk(req, nullptr, 0);
+        return update_redirects(edit);
     }
-#endif
 
-    static esp_err_t try_serve_from_fs(httpd_req_t *req)
+    /**
+     * Find the rule for path in a snapshot. For a prefix rule the part of
+     * path after the prefix is returned in out_rest; it is empty otherwise.
+     */
+    static const RedirectRule *lookup_redirect(const RedirectTable *t,
+                                               std::string_view path,
+                                               std::string_view &out_rest)
     {
-#if !CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
-        (void)req;
-        return ESP_ERR_NOT_SUPPORTED;
-#else
-        if (req == nullptr || req->uri[0] == '\0')
+        out_rest = {};
+
+        if (t == nullptr)
         {
-            return ESP_ERR_HTTPD_INVALID_REQ;
+            return nullptr;
         }
 
-        if (ensure_fs_mounted() != ESP_OK)
+        auto it = std::lower_bound(t->exact.begin(), t->exact.end(), path,
+                                   [](const RedirectRule &r, std::string_view p)
+                                   { return r.from < p; });
+        if (it != t->exact.end() && it->from == path)
         {
-            return ESP_ERR_NOT_SUPPORTED;
+            return &*it;
         }
 
-        std::string full_path;
-        std::string ctype;
-        bool is_gz = false;
-
-        if (!resolve_fs_path(req->uri, full_path, ctype, is_gz))
+        for (const auto &r : t->prefix)
         {
-            return ESP_ERR_NOT_FOUND;
+            if (path.substr(0, r.from.size()) == r.from)
+            {
+                out_rest = path.substr(r.from.size());
+                return &r;
+            }
         }
 
-        return send_file_stream(req, full_path, ctype, is_gz);
-#endif
+        return nullptr;
+    }
+
+    static esp_err_t send_redirect(httpd_req_t *req, int code, const char *location)
+    {
+        httpd_resp_set_status(req, status_for(code));
+        (void)httpd_resp_set_hdr(req, "Location", location);
+        set_cache_headers(req, http_srv::CachePolicy::NO_STORE);
+
+        return httpd_resp_send(req, nullptr, 0);
     }
 
     // -------------------------------------------------------------------------
-    // HTTP handlers.
+    // Session activity and idle reaping.
+    //
+    // open_fn installs recv/send overrides on every session that stamp the
+    // socket's last activity in s_sessions before doing the plain socket I/O.
+    // The table is lock-free: each slot is claimed by compare-exchange on fd,
+    // and the stamps are plain atomics written from the httpd task.
+    //
+    // The worker task scans the table once per kReapIntervalMs and closes
+    // sessions idle beyond a threshold that shrinks linearly from
+    // kIdleTimeoutS with all slots free to kIdleMinS with none free, so
+    // parked keep-alive connections give way once real clients need slots.
+    // Sessions handed to long-lived async work (background transfers) are
+    // pinned and never reaped.
     // -------------------------------------------------------------------------
 
-    static esp_err_t handle_root(httpd_req_t *req)
+    struct SessionSlot
     {
-        const esp_err_t rc = try_serve_from_fs(req);
-        if (rc == ESP_OK)
+        std::atomic<int> fd{-1};
+        std::atomic<TickType_t> last_active{0};
+        std::atomic<uint32_t> pins{0};
+    };
+
+#ifdef CONFIG_LWIP_MAX_SOCKETS
+    static constexpr size_t kSessionSlots = CONFIG_LWIP_MAX_SOCKETS;
+#else
+    static constexpr size_t kSessionSlots = 16U;
+#endif
+    static constexpr uint32_t kIdleTimeoutS = CONFIG_HTTP_SERVER_IDLE_TIMEOUT_S;
+    static constexpr uint32_t kIdleMinS = CONFIG_HTTP_SERVER_IDLE_MIN_S;
+    static constexpr uint32_t kReapIntervalMs = 1000U;
+
+    static SessionSlot s_sessions[kSessionSlots];
+
+    static SessionSlot *find_session_slot(int fd)
+    {
+        for (auto &slot : s_sessions)
         {
-            return ESP_OK;
+            if (slot.fd.load(std::memory_order_relaxed) == fd)
+            {
+                return &slot;
+            }
         }
+        return nullptr;
+    }
 
-        if (rc != ESP_ERR_NOT_FOUND && rc != ESP_ERR_NOT_SUPPORTED)
+#if CONFIG_HTTP_SERVER_PM_BOOST
+    static void pm_activity();
+#endif
+
+    static void touch_session(int fd)
+    {
+#if CONFIG_HTTP_SERVER_PM_BOOST
+        pm_activity();
+#endif
+
+        SessionSlot *slot = find_session_slot(fd);
+        if (slot != nullptr)
         {
-            return send_text(req,
-                             500,
-                             "text/plain; charset=utf-8",
-                             "Internal file server error\n");
+            slot->last_active.store(xTaskGetTickCount(), std::memory_order_relaxed);
         }
-
-        return send_template(req,
-                             http_pages::kRoot,
-                             "text/html; charset=utf-8");
     }
 
-    static esp_err_t handle_favicon_ico(httpd_req_t *req)
+    static void pin_session(int fd)
     {
-        const esp_err_t rc = try_serve_from_fs(req);
-        if (rc == ESP_OK)
+        SessionSlot *slot = find_session_slot(fd);
+        if (slot != nullptr)
         {
-            return ESP_OK;
+            slot->pins.fetch_add(1U, std::memory_order_relaxed);
         }
+    }
 
-        if (rc != ESP_ERR_NOT_FOUND && rc != ESP_ERR_NOT_SUPPORTED)
+    static void unpin_session(int fd)
+    {
+        SessionSlot *slot = find_session_slot(fd);
+        if (slot != nullptr)
         {
-            return send_text(req,
-                             500,
-                             "text/plain; charset=utf-8",
-                             "Internal file server error\n");
+            slot->pins.fetch_sub(1U, std::memory_order_relaxed);
+            slot->last_active.store(xTaskGetTickCount(), std::memory_order_relaxed);
         }
+    }
 
-        set_no_cache_headers(req);
-        httpd_resp_set_type(req, "image/x-icon");
-
-        return httpd_resp_send(
-            req,
-            reinterpret_cast<const char *>(http_pages::kFaviconIco),
-            http_pages::kFaviconIcoSize);
+    /**
+     * True while the peer has not closed the connection. Does not consume
+     * any pending input.
+     */
+    static bool client_connected(int fd)
+    {
+        char c = 0;
+        const ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
     }
 
-    // -------------------------------------------------------------------------
-    // Server start/stop + URI registration.
-    // -------------------------------------------------------------------------
+#if defined(__cpp_impl_coroutine)
+    // Set by the worker around co::detail::try_recv(): reads on this socket
+    // return HTTPD_SOCK_ERR_TIMEOUT instead of waiting for data.
+    static std::atomic<int> s_nb_recv_fd{-1};
+#endif
 
-    static esp_err_t register_uri_internal(const char *uri,
-                                           httpd_method_t method,
-                                           esp_err_t (*handler)(httpd_req_t *))
+    static int session_recv(httpd_handle_t, int sockfd, char *buf, size_t buf_len, int flags)
     {
-        if (uri == nullptr || handler == nullptr)
+        touch_session(sockfd);
+
+#if defined(__cpp_impl_coroutine)
+        if (sockfd == s_nb_recv_fd.load(std::memory_order_relaxed))
         {
-            return ESP_ERR_INVALID_ARG;
+            flags |= MSG_DONTWAIT;
         }
+#endif
 
-        if (!lock_mutex())
+        const int n = static_cast<int>(recv(sockfd, buf, buf_len, flags));
+        if (n < 0)
         {
-            return ESP_FAIL;
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                       ? HTTPD_SOCK_ERR_TIMEOUT
+                       : HTTPD_SOCK_ERR_FAIL;
         }
+        return n;
+    }
 
-        if ((s_state != State::STARTING && s_state != State::RUNNING) ||
-            s_server == nullptr)
-        {
-            unlock_mutex();
-            return ESP_ERR_INVALID_STATE;
-        }
+    // While the worker sends on a detached request (transfer, follower,
+    // stream reader, coroutine) it sets s_nb_fd to that socket between
+    // begin_nb_send() and end_nb_send(). Sends on that socket then never
+    // block: what the socket cannot take right now is appended to
+    // *s_nb_backlog and reported as sent. The owner drains the backlog with
+    // flush_send_backlog() on later turns and sends nothing new until it is
+    // empty, so a backlog holds at most about one chunk. Only the worker sets
+    // these, and httpd does not send on a socket whose request is detached,
+    // so no other task sees a match.
+    struct SendBacklog
+    {
+        std::string data;  // Empty when the socket has taken everything.
+        size_t pos;        // Bytes of data already sent.
+        TickType_t since;  // Last time the socket took any of data.
+    };
 
-        httpd_uri_t h{};
-        h.uri = uri;
-        h.method = method;
-        h.handler = handler;
-        h.user_ctx = nullptr;
+    static std::atomic<int> s_nb_fd{-1};
+    static SendBacklog *s_nb_backlog = nullptr;
 
-        const esp_err_t rc = httpd_register_uri_handler(s_server, &h);
-        unlock_mutex();
-        return rc;
+    static void begin_nb_send(int sockfd, SendBacklog &backlog)
+    {
+        s_nb_backlog = &backlog;
+        s_nb_fd.store(sockfd, std::memory_order_relaxed);
     }
 
-    static void stop_server()
+    static void end_nb_send()
     {
-        httpd_handle_t to_stop = nullptr;
+        s_nb_fd.store(-1, std::memory_order_relaxed);
+        s_nb_backlog = nullptr;
+    }
 
-        if (!lock_mutex())
+    static int session_send_nb(int sockfd, const char *buf, size_t buf_len, int flags)
+    {
+        SendBacklog &backlog = *s_nb_backlog;
+        size_t sent = 0U;
+        if (backlog.data.empty())
         {
-            return;
+            const ssize_t n = send(sockfd, buf, buf_len, flags | MSG_DONTWAIT);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                return HTTPD_SOCK_ERR_FAIL;
+            }
+            sent = (n > 0) ? static_cast<size_t>(n) : 0U;
+            backlog.since = xTaskGetTickCount();
         }
+        backlog.data.append(buf + sent, buf_len - sent);
+        return static_cast<int>(buf_len);
+    }
 
-        if (s_server == nullptr)
+    /**
+     * Send as much of a backlog as the socket takes without blocking.
+     * Returns false on a socket error, or once the socket has taken nothing
+     * for as long as httpd would have waited in a blocking send.
+     */
+    static bool flush_send_backlog(int sockfd, SendBacklog &backlog)
+    {
+        while (backlog.pos < backlog.data.size())
         {
-            unlock_mutex();
-            return;
+            const ssize_t n = send(sockfd,
+                                   backlog.data.data() + backlog.pos,
+                                   backlog.data.size() - backlog.pos,
+                                   MSG_DONTWAIT);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                return false;
+            }
+            if (n <= 0)
+            {
+                return xTaskGetTickCount() - backlog.since < s_send_wait_ticks;
+            }
+            backlog.pos += static_cast<size_t>(n);
+            backlog.since = xTaskGetTickCount();
+            touch_session(sockfd);
         }
 
-        to_stop = s_server;
-        s_server = nullptr;
-        unlock_mutex();
+        backlog.data.clear();
+        backlog.pos = 0U;
+        return true;
+    }
 
-        const esp_err_t rc = httpd_stop(to_stop);
-        if (rc != ESP_OK)
+    static int session_send(httpd_handle_t, int sockfd, const char *buf, size_t buf_len, int flags)
+    {
+        touch_session(sockfd);
+
+        if (sockfd == s_nb_fd.load(std::memory_order_relaxed))
         {
-            ESP_LOGW(TAG, "httpd_stop failed: %s.", esp_err_to_name(rc));
+            return session_send_nb(sockfd, buf, buf_len, flags);
         }
-    }
 
-    static esp_err_t start_server()
-    {
-        if (!lock_mutex())
+        const int n = static_cast<int>(send(sockfd, buf, buf_len, flags));
+        if (n < 0)
         {
-            return ESP_FAIL;
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                       ? HTTPD_SOCK_ERR_TIMEOUT
+                       : HTTPD_SOCK_ERR_FAIL;
         }
+        return n;
+    }
 
-        if (s_server != nullptr)
+    static esp_err_t handle_session_open(httpd_handle_t hd, int sockfd)
+    {
+        for (auto &slot : s_sessions)
         {
-            unlock_mutex();
-            return ESP_OK;
+            int expected = -1;
+            if (slot.fd.compare_exchange_strong(expected, sockfd, std::memory_order_relaxed))
+            {
+                slot.pins.store(0U, std::memory_order_relaxed);
+                slot.last_active.store(xTaskGetTickCount(), std::memory_order_relaxed);
+                break;
+            }
         }
 
-        httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
-        cfg.server_port = 80;
-        cfg.uri_match_fn = httpd_uri_match_wildcard;
-        cfg.max_uri_handlers = 40;
+#if CONFIG_HTTP_SERVER_PM_BOOST
+        pm_activity();
+#endif
 
-        s_max_open_sockets = static_cast<size_t>(cfg.max_open_sockets);
+        (void)httpd_sess_set_recv_override(hd, sockfd, session_recv);
+        (void)httpd_sess_set_send_override(hd, sockfd, session_send);
+        s_counters.sessions_open.fetch_add(1U, std::memory_order_relaxed);
+        return ESP_OK;
+    }
 
-        const esp_err_t rc = httpd_start(&s_server, &cfg);
-        if (rc != ESP_OK)
+    static void handle_session_close(httpd_handle_t, int sockfd)
+    {
+        SessionSlot *slot = find_session_slot(sockfd);
+        if (slot != nullptr)
         {
-            ESP_LOGE(TAG, "httpd_start failed: %s.", esp_err_to_name(rc));
-            s_server = nullptr;
-            unlock_mutex();
-            return rc;
+            slot->fd.store(-1, std::memory_order_relaxed);
         }
 
-        unlock_mutex();
-
-#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
-        (void)ensure_fs_mounted();
-#endif
+        s_counters.sessions_open.fetch_sub(1U, std::memory_order_relaxed);
 
-        esp_err_t reg_rc = ESP_OK;
+        // With close_fn set, httpd leaves closing the socket to us.
+        (void)close(sockfd);
+    }
 
-        reg_rc = register_uri_internal("/", HTTP_GET, handle_root);
-        if (reg_rc != ESP_OK)
+    /**
+     * Idle threshold in ticks for the given number of free session slots.
+     */
+    static TickType_t idle_threshold(size_t free_slots, size_t max_slots)
+    {
+        uint32_t seconds = kIdleMinS;
+        if (max_slots > 0U && kIdleTimeoutS > kIdleMinS &&
+            !s_mem_degraded.load(std::memory_order_relaxed))
         {
-            goto fail;
+            seconds += static_cast<uint32_t>(
+                (static_cast<uint64_t>(kIdleTimeoutS - kIdleMinS) * free_slots) / max_slots);
         }
+        return pdMS_TO_TICKS(seconds * 1000U);
+    }
 
-        reg_rc = register_uri_internal("/index.html", HTTP_GET, handle_root);
-        if (reg_rc != ESP_OK)
+    /**
+     * Close sessions idle beyond the current threshold. Timer callback on the
+     * worker task.
+     */
+    static void reap_idle_sessions(void *)
+    {
+        if (!lock_mutex())
         {
-            goto fail;
+            return;
         }
 
-        reg_rc = register_uri_internal("/index.htm", HTTP_GET, handle_root);
-        if (reg_rc != ESP_OK)
+        httpd_handle_t srv = s_server;
+        const size_t max_socks = s_max_open_sockets;
+        unlock_mutex();
+
+        if (srv == nullptr || max_socks == 0U)
         {
-            goto fail;
+            return;
         }
 
-        reg_rc = register_uri_internal("/favicon.ico", HTTP_GET, handle_favicon_ico);
-        if (reg_rc != ESP_OK)
+        const size_t open = s_counters.sessions_open.load(std::memory_order_relaxed);
+        const size_t free_slots = (open < max_socks) ? (max_socks - open) : 0U;
+        const TickType_t threshold = idle_threshold(free_slots, max_socks);
+        const TickType_t now = xTaskGetTickCount();
+
+        for (auto &slot : s_sessions)
         {
-            goto fail;
-        }
+            const int fd = slot.fd.load(std::memory_order_relaxed);
+            if (fd < 0 || slot.pins.load(std::memory_order_relaxed) > 0U)
+            {
+                continue;
+            }
 
-        return ESP_OK;
+            if (now - slot.last_active.load(std::memory_order_relaxed) < threshold)
+            {
+                continue;
+            }
 
-    fail:
-        ESP_LOGE(TAG, "URI registration failed: %s.", esp_err_to_name(reg_rc));
-        stop_server();
-        return reg_rc;
+            // Restamp so a close still queued on the httpd task is not
+            // counted again on the next scan.
+            slot.last_active.store(now, std::memory_order_relaxed);
+            if (httpd_sess_trigger_close(srv, fd) == ESP_OK)
+            {
+                s_counters.sessions_reaped.fetch_add(1U, std::memory_order_relaxed);
+                ESP_LOGD(TAG, "Reaped idle session %d.", fd);
+            }
+        }
     }
 
     // -------------------------------------------------------------------------
-    // Worker task.
+    // Background transfers.
+    //
+    // Large responses are detached from the httpd task with
+    // httpd_req_async_handler_begin() and handed to the worker task. The worker
+    // waits for any of its sockets to become writable and then sends one chunk
+    // to each writable socket per turn, so concurrent downloads interleave
+    // round-robin and a slow client never holds the httpd task. Small
+    // requests keep being served by the httpd task in parallel.
+    //
+    // Writable only means the socket has some room, so chunks are sent
+    // without blocking (see s_nb_fd). What does not fit waits in the
+    // transfer's backlog, and the transfer gets no new chunk until the
+    // backlog has drained. A stalled client therefore costs the worker
+    // nothing, and timers, stream readers and coroutines keep running.
+    //
+    // A transfer reads either from a file or from an application producer
+    // (see register_producer()). A producer that has nothing yet is left out
+    // of the select() set until its retry time.
+    //
+    // New transfers are queued in s_transfers_pending (guarded by s_mutex).
+    // The worker moves them into s_transfers_active, which only it touches.
     // -------------------------------------------------------------------------
 
-    static void http_srv_task(void *arg)
+    /**
+     * A read-only file descriptor shared by every reader of one file. Readers
+     * use pread() with their own offset, so none of them moves a shared file
+     * position. Closed when the last reference goes.
+     */
+    struct OpenFile
     {
-        (void)arg;
+        int fd;
+        size_t size;
 
-        if (lock_mutex())
+        OpenFile(int fd_, size_t size_) : fd(fd_), size(size_) {}
+        OpenFile(const OpenFile &) = delete;
+        OpenFile &operator=(const OpenFile &) = delete;
+
+        ~OpenFile()
         {
-            if (s_state == State::STARTING && s_evt != nullptr)
-            {
-                s_state = State::RUNNING;
-                xEventGroupSetBits(s_evt, READY_BIT);
-            }
-            unlock_mutex();
+            close(fd);
         }
+    };
 
-        while (true)
-        {
-            (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    using FileRef = std::shared_ptr<const OpenFile>;
 
-            if (lock_mutex())
-            {
-                const bool exit_now = s_task_exit;
-                unlock_mutex();
-                if (exit_now)
-                {
-                    break;
-                }
-            }
+    struct Transfer
+    {
+        httpd_req_t *req; // Async copy; owned until completion.
+        FileRef file;     // File source; null for producers.
+        size_t offset;    // Next byte of file to send.
+        std::vector<FileRef> more; // Files sent after file, in order (combo).
+        int sockfd;
+        std::string ctype;
+        std::string link;            // Preload Link header value; may be empty.
+        std::string etag;            // ETag header value; may be empty.
+        http_srv::Producer producer; // Producer source when produce is set.
+        size_t remaining;            // Bytes owed under Content-Length, or kUnknownLength.
+        TickType_t retry_at;         // Valid while waiting.
+        bool waiting;                // Producer returned kProduceAgain.
+        bool done;                   // Response complete; finishes once the backlog drains.
+        SendBacklog backlog;         // Bytes the socket has not taken yet; see s_nb_fd.
+    };
 
-            // Deferred work would run here.
+    static constexpr size_t kMaxTransfers = CONFIG_HTTP_SERVER_MAX_TRANSFERS;
+    static constexpr size_t kTransferChunkSize = CONFIG_HTTP_SERVER_TRANSFER_CHUNK_SIZE;
+    static constexpr int kTransferPollMs = 20;
+
+    static std::vector<Transfer *> s_transfers_pending;
+    static std::vector<Transfer *> s_transfers_active;
+
+    static Transfer *new_transfer(httpd_req_t *req, FileRef f, std::string ctype, std::string link)
+    {
+        auto *t = new (std::nothrow) Transfer{};
+        if (t != nullptr)
+        {
+            t->file = std::move(f);
+            t->sockfd = httpd_req_to_sockfd(req);
+            t->ctype = std::move(ctype);
+            t->link = std::move(link);
+            t->remaining = http_srv::kUnknownLength;
         }
+        return t;
+    }
 
-        if (lock_mutex())
+    static void finish_transfer(Transfer *t, bool ok)
+    {
+        if (t->producer.finish != nullptr)
         {
-            if (s_evt != nullptr)
-            {
-                xEventGroupClearBits(s_evt, READY_BIT);
-            }
+            t->producer.finish(t->producer.ctx, ok);
+        }
 
-            s_task = nullptr;
-            unlock_mutex();
+        httpd_handle_t hd = t->req->handle;
+        (void)httpd_req_async_handler_complete(t->req);
+        unpin_session(t->sockfd);
+
+        if (ok)
+        {
+            s_counters.transfers_completed.fetch_add(1U, std::memory_order_relaxed);
         }
         else
         {
-            if (s_evt != nullptr)
-            {
-                xEventGroupClearBits(s_evt, READY_BIT);
-            }
+            // The client holds a truncated response; drop the connection.
+            (void)httpd_sess_trigger_close(hd, t->sockfd);
+            s_counters.transfers_aborted.fetch_add(1U, std::memory_order_relaxed);
         }
 
-        vTaskDelete(nullptr);
+        s_counters.transfers_active.fetch_sub(1U, std::memory_order_relaxed);
+        delete t;
     }
 
-    static bool ensure_mutex()
+    /**
+     * Finish a transfer whose response is complete, or leave it to finish
+     * once its backlog has drained. Returns false once it has been finished.
+     */
+    static bool complete_transfer(Transfer *t)
     {
-        if (s_mutex == nullptr)
+        if (t->backlog.data.empty())
         {
-            s_mutex = xSemaphoreCreateMutex();
-            if (s_mutex == nullptr)
-            {
-                ESP_LOGE(TAG, "Failed to create mutex.");
-                return false;
-            }
+            finish_transfer(t, true);
+            return false;
         }
+        t->done = true;
+        return true;
+    }
 
-        if (s_evt == nullptr)
+    /**
+     * Write all of buf to the socket outside chunked framing.
+     */
+    static bool send_raw(httpd_req_t *req, const char *buf, size_t len)
+    {
+        while (len > 0U)
         {
-            s_evt = xEventGroupCreate();
-            if (s_evt == nullptr)
+            const int n = httpd_send(req, buf, len);
+            if (n <= 0)
             {
-                ESP_LOGE(TAG, "Failed to create event group.");
-                vSemaphoreDelete(s_mutex);
-                s_mutex = nullptr;
                 return false;
             }
+            buf += n;
+            len -= static_cast<size_t>(n);
         }
-
         return true;
     }
 
-    static bool start_worker_task()
+    /**
+     * Pull one chunk from a producer and send it. Returns false once the
+     * transfer has been finished.
+     */
+    static bool step_producer(Transfer *t, char *buf, size_t cap)
     {
-        if (!lock_mutex())
+        const bool sized = (t->remaining != http_srv::kUnknownLength);
+        const size_t want = sized ? std::min(cap, t->remaining) : cap;
+
+        const size_t n = (want > 0U)
+                             ? t->producer.produce(t->producer.ctx,
+                                                   reinterpret_cast<uint8_t *>(buf), want)
+                             : 0U;
+
+        if (n == http_srv::kProduceAgain)
         {
-            return false;
+            if (!client_connected(t->sockfd))
+            {
+                finish_transfer(t, false);
+                return false;
+            }
+            t->waiting = true;
+            t->retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(kTransferPollMs);
+            return true;
         }
 
-        if (s_task != nullptr)
+        if (n == http_srv::kProduceError || n > want)
         {
-            unlock_mutex();
-            return true;
+            finish_transfer(t, false);
+            return false;
         }
 
-        s_task_exit = false;
-        unlock_mutex();
+        if (n == 0U)
+        {
+            // A sized body that ends early cannot be repaired.
+            const bool ok = sized ? (t->remaining == 0U)
+                                  : (httpd_resp_send_chunk(t->req, nullptr, 0) == ESP_OK);
+            if (!ok)
+            {
+                finish_transfer(t, false);
+                return false;
+            }
+            return complete_transfer(t);
+        }
 
-        static constexpr uint32_t kStackWords = 4096U;
-        static constexpr UBaseType_t kPrio = 5;
+        const bool sent = sized ? send_raw(t->req, buf, n)
+                                : (httpd_resp_send_chunk(t->req, buf, static_cast<ssize_t>(n)) == ESP_OK);
+        if (!sent)
+        {
+            finish_transfer(t, false);
+            return false;
+        }
 
-        TaskHandle_t handle = nullptr;
-        const BaseType_t ok =
-            xTaskCreate(http_srv_task,
-                        "http_srv",
-                        kStackWords,
-                        nullptr,
-                        kPrio,
-                        &handle);
+        if (sized)
+        {
+            t->remaining -= n;
+            if (t->remaining == 0U)
+            {
+                return complete_transfer(t);
+            }
+        }
+        return true;
+    }
 
-        if (ok != pdPASS || handle == nullptr)
+    /**
+     * Send one chunk. Returns false once the transfer has been finished.
+     */
+    static bool step_transfer(Transfer *t, char *buf, size_t cap)
+    {
+        if (t->producer.produce != nullptr)
         {
-            ESP_LOGE(TAG, "Failed to create http_srv task.");
-            return false;
+            return step_producer(t, buf, cap);
         }
 
-        if (!lock_mutex())
+        const ssize_t n = pread(t->file->fd, buf, cap, static_cast<off_t>(t->offset));
+        if (n > 0)
         {
-            vTaskDelete(handle);
-            return false;
+            const esp_err_t rc = httpd_resp_send_chunk(t->req, buf, n);
+            if (rc != ESP_OK)
+            {
+                finish_transfer(t, false);
+                return false;
+            }
+            t->offset += static_cast<size_t>(n);
+
+            if (t->offset < t->file->size)
+            {
+                return true;
+            }
         }
 
-        if (s_task != nullptr)
+        if (n >= 0 && !t->more.empty())
         {
-            unlock_mutex();
-            vTaskDelete(handle);
+            t->file = std::move(t->more.front());
+            t->more.erase(t->more.begin());
+            t->offset = 0U;
             return true;
         }
 
-        s_task = handle;
-        unlock_mutex();
-        return true;
+        const bool ok = (n >= 0) &&
+                        (httpd_resp_send_chunk(t->req, nullptr, 0) == ESP_OK);
+        if (!ok)
+        {
+            finish_transfer(t, false);
+            return false;
+        }
+        return complete_transfer(t);
     }
 
-    static bool stop_worker_task()
+    /**
+     * Serve a transfer whose socket is writable: drain its backlog, then
+     * send the next chunk without blocking. Returns false once the transfer
+     * has been finished.
+     */
+    static bool service_transfer(Transfer *t, char *buf, size_t cap)
     {
-        TaskHandle_t t = nullptr;
-
-        if (!lock_mutex())
+        if (!flush_send_backlog(t->sockfd, t->backlog))
         {
+            finish_transfer(t, false);
             return false;
         }
 
-        t = s_task;
-        if (t == nullptr)
+        if (!t->backlog.data.empty())
         {
-            unlock_mutex();
             return true;
         }
 
-        s_task_exit = true;
-        unlock_mutex();
+        if (t->done)
+        {
+            finish_transfer(t, true);
+            return false;
+        }
 
-        notify_worker();
+        begin_nb_send(t->sockfd, t->backlog);
+        const bool active = step_transfer(t, buf, cap);
+        end_nb_send();
+        return active;
+    }
 
-        for (int i = 0; i < 50; ++i)
+    /**
+     * Ticks the worker may sleep before a transfer needs service: 0 if any
+     * is ready to send, portMAX_DELAY if there are none.
+     */
+    static TickType_t transfers_wait_ticks()
+    {
+        const TickType_t now = xTaskGetTickCount();
+        TickType_t wait = portMAX_DELAY;
+
+        for (const Transfer *t : s_transfers_active)
         {
-            if (lock_mutex(pdMS_TO_TICKS(50)))
+            if (!t->waiting)
             {
-                const bool done = (s_task == nullptr);
-                unlock_mutex();
-                if (done)
-                {
-                    return true;
-                }
+                return 0;
             }
-            vTaskDelay(pdMS_TO_TICKS(20));
-        }
 
-        ESP_LOGW(TAG, "Worker task did not stop within timeout.");
-        return false;
+            const TickType_t left = t->retry_at - now;
+            wait = std::min(wait, (static_cast<int32_t>(left) > 0) ? left : 0);
+        }
+        return wait;
     }
 
-    static void clear_deferred_state()
+    /**
+     * Queue a transfer whose async request has been started. Finishes it if
+     * the worker is shutting down.
+     */
+    static void queue_transfer(Transfer *t)
     {
         if (!lock_mutex())
         {
+            finish_transfer(t, false);
+            return;
+        }
+
+        if (s_task == nullptr || s_task_exit)
+        {
+            unlock_mutex();
+            finish_transfer(t, false);
             return;
         }
 
+        s_transfers_pending.push_back(t);
         unlock_mutex();
+
+        notify_worker();
     }
-} // namespace
 
-namespace http_srv
-{
-    void start()
+    /**
+     * True if the worker is running and a transfer slot is free.
+     */
+    static bool transfer_slot_free(uint32_t max_transfers)
     {
-        if (!ensure_mutex())
+        if (!lock_mutex())
         {
-            return;
+            return false;
         }
 
-        if (!lock_mutex())
+        const bool have_slot =
+            s_task != nullptr && !s_task_exit &&
+            s_counters.transfers_active.load(std::memory_order_relaxed) < max_transfers;
+        unlock_mutex();
+        return have_slot;
+    }
+
+    /**
+     * Run one scheduling turn on the worker task. Blocks for at most
+     * kTransferPollMs waiting for a writable socket.
+     */
+    static void run_transfers_turn(char *buf, size_t cap)
+    {
+        if (lock_mutex())
         {
-            return;
+            s_transfers_active.insert(s_transfers_active.end(),
+                                      s_transfers_pending.begin(),
+                                      s_transfers_pending.end());
+            s_transfers_pending.clear();
+            unlock_mutex();
         }
 
-        if (s_state == State::RUNNING ||
-            s_state == State::STARTING ||
-            s_state == State::STOPPING)
+        if (s_transfers_active.empty())
         {
-            unlock_mutex();
             return;
         }
 
-        s_state = State::STARTING;
-        s_task_exit = false;
-        xEventGroupClearBits(s_evt, READY_BIT);
-
-        unlock_mutex();
-
-        static constexpr int kMaxAttempts = 5;
-        static constexpr TickType_t kInitialBackoff = pdMS_TO_TICKS(50);
-        static constexpr TickType_t kWorkerReadyTimeout = pdMS_TO_TICKS(500);
-
-        TickType_t backoff = kInitialBackoff;
+        const TickType_t now = xTaskGetTickCount();
 
-        for (int attempt = 0; attempt < kMaxAttempts; ++attempt)
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        int max_fd = -1;
+        for (Transfer *t : s_transfers_active)
         {
-            const esp_err_t srv_ret = start_server();
-            if (srv_ret != ESP_OK)
-            {
-                vTaskDelay(backoff);
-                backoff = backoff + backoff;
-                continue;
-            }
-
-            const bool task_ok = start_worker_task();
-            if (!task_ok)
+            if (t->waiting && static_cast<int32_t>(t->retry_at - now) > 0)
             {
-                stop_server();
-                vTaskDelay(backoff);
-                backoff = backoff + backoff;
                 continue;
             }
+            t->waiting = false;
 
-            const EventBits_t bits =
-                xEventGroupWaitBits(s_evt,
-                                    READY_BIT,
-                                    pdFALSE,
-                                    pdTRUE,
-                                    kWorkerReadyTimeout);
-
-            if ((bits & READY_BIT) != 0)
-            {
-                return;
-            }
-
-            (void)stop_worker_task();
-            stop_server();
-
-            vTaskDelay(backoff);
-            backoff = backoff + backoff;
+            FD_SET(t->sockfd, &wfds);
+            max_fd = std::max(max_fd, t->sockfd);
         }
 
-        if (lock_mutex())
+        if (max_fd < 0)
         {
-            s_state = State::STOPPED;
-            xEventGroupClearBits(s_evt, READY_BIT);
-            unlock_mutex();
+            return;
         }
-    }
 
-    void stop()
-    {
-        if (!ensure_mutex())
+        timeval tv{};
+        tv.tv_usec = kTransferPollMs * 1000;
+
+        const int ready = select(max_fd + 1, nullptr, &wfds, nullptr, &tv);
+        if (ready == 0)
         {
             return;
         }
 
-        TaskHandle_t worker = nullptr;
+        // On a select() error, let the send path find the broken socket.
+        const bool all = (ready < 0);
 
-        if (!lock_mutex())
+        auto it = s_transfers_active.begin();
+        while (it != s_transfers_active.end())
         {
-            return;
+            Transfer *t = *it;
+            if (!t->waiting && (all || FD_ISSET(t->sockfd, &wfds)) && !service_transfer(t, buf, cap))
+            {
+                it = s_transfers_active.erase(it);
+                continue;
+            }
+            ++it;
         }
+    }
 
-        if (s_state == State::STOPPED)
+    static void abort_all_transfers()
+    {
+        if (lock_mutex())
         {
+            s_transfers_active.insert(s_transfers_active.end(),
+                                      s_transfers_pending.begin(),
+                                      s_transfers_pending.end());
+            s_transfers_pending.clear();
             unlock_mutex();
-            return;
         }
 
-        s_state = State::STOPPING;
-        xEventGroupClearBits(s_evt, READY_BIT);
+        for (Transfer *t : s_transfers_active)
+        {
+            finish_transfer(t, false);
+        }
+        s_transfers_active.clear();
+    }
 
-        s_task_exit = true;
-        worker = s_task;
+    // -------------------------------------------------------------------------
+    // Timer wheel guarded by s_mutex.
+    //
+    // Hashed wheel of kWheelSlots buckets of kWheelTick each, advanced by the
+    // worker task, which sleeps until the next occupied bucket. A timer due in
+    // more than one revolution carries a rounds count. Nodes come from a fixed
+    // pool and sit in intrusive doubly linked bucket lists; freed nodes are
+    // chained through next on a free list, and untouched ones are handed out
+    // in pool order, so schedule and cancel are O(1). Callbacks run on the
+    // worker task without s_mutex held.
+    //
+    // Timer ids pack the pool index with a per-node generation, so a stale id
+    // never cancels a reused node.
+    // -------------------------------------------------------------------------
 
-        unlock_mutex();
+    enum class TimerState : uint8_t
+    {
+        FREE,
+        ARMED,
+        RUNNING,
+        CANCELLED
+    };
 
-        if (worker != nullptr)
-        {
-            notify_worker();
-        }
+    struct TimerNode
+    {
+        TimerNode *prev;
+        TimerNode *next;
+        http_srv::TimerFn fn;
+        void *arg;
+        uint32_t period; // Wheel ticks; 0 for one-shot.
+        uint32_t rounds;
+        uint32_t gen;
+        uint8_t slot;
+        TimerState state;
+    };
 
-        (void)stop_worker_task();
-        clear_deferred_state();
-        stop_server();
+    static constexpr size_t kTimers = CONFIG_HTTP_SERVER_TIMERS;
+    static constexpr size_t kWheelSlots = 64U;
+    static constexpr uint32_t kWheelTickMs = CONFIG_HTTP_SERVER_TIMER_TICK_MS;
+    static constexpr TickType_t kWheelTick =
+        (pdMS_TO_TICKS(kWheelTickMs) > 0) ? pdMS_TO_TICKS(kWheelTickMs) : 1;
 
-        if (lock_mutex(portMAX_DELAY))
+    static_assert(kTimers > 0U && kTimers < 256U, "timer pool index must fit in 8 bits");
+
+    static TimerNode s_timers[kTimers] = {};
+    static TimerNode *s_wheel[kWheelSlots] = {};
+    static size_t s_wheel_pos = 0U;
+    static TickType_t s_wheel_last = 0;
+    static size_t s_timers_armed = 0U;
+    static TimerNode *s_timer_free = nullptr;
+    static size_t s_timers_fresh = 0U; // Nodes never handed out start here.
+
+    static http_srv::TimerId timer_id(const TimerNode *n)
+    {
+        const uint32_t index = static_cast<uint32_t>(n - s_timers);
+        return ((n->gen & 0x00FFFFFFU) << 8) | (index + 1U);
+    }
+
+    static TimerNode *timer_from_id(http_srv::TimerId id)
+    {
+        const uint32_t index = (id & 0xFFU);
+        if (index == 0U || index > kTimers)
         {
-            s_state = State::STOPPED;
-            xEventGroupClearBits(s_evt, READY_BIT);
-            unlock_mutex();
+            return nullptr;
         }
-        else
+
+        TimerNode *n = &s_timers[index - 1U];
+        return (timer_id(n) == id) ? n : nullptr;
+    }
+
+    static uint32_t ms_to_wheel_ticks(uint32_t ms)
+    {
+        const uint32_t ticks = (ms + kWheelTickMs - 1U) / kWheelTickMs;
+        return (ticks > 0U) ? ticks : 1U;
+    }
+
+    static void wheel_insert_locked(TimerNode *n, uint32_t ticks)
+    {
+        n->slot = static_cast<uint8_t>((s_wheel_pos + ticks) % kWheelSlots);
+        n->rounds = (ticks - 1U) / kWheelSlots;
+        n->prev = nullptr;
+        n->next = s_wheel[n->slot];
+        if (n->next != nullptr)
         {
-            ESP_LOGE(TAG, "Failed to finalize stop state.");
+            n->next->prev = n;
         }
+        s_wheel[n->slot] = n;
+        n->state = TimerState::ARMED;
     }
 
-    bool is_running()
+    static void wheel_unlink_locked(TimerNode *n)
     {
-        if (!ensure_mutex())
+        if (n->prev != nullptr)
         {
-            return false;
+            n->prev->next = n->next;
+        }
+        else
+        {
+            s_wheel[n->slot] = n->next;
         }
 
-        if (!lock_mutex())
+        if (n->next != nullptr)
         {
-            return false;
+            n->next->prev = n->prev;
         }
+        n->prev = nullptr;
+        n->next = nullptr;
+    }
 
-        const bool running = (s_state == State::RUNNING);
-        unlock_mutex();
-        return running;
+    static void timer_free_locked(TimerNode *n)
+    {
+        n->state = TimerState::FREE;
+        n->fn = nullptr;
+        ++n->gen;
+        --s_timers_armed;
+        n->prev = nullptr;
+        n->next = s_timer_free;
+        s_timer_free = n;
     }
 
-    esp_err_t wait_until_running(TickType_t timeout_ticks)
+    static http_srv::TimerId timer_schedule(uint32_t delay_ms,
+                                            uint32_t period_ms,
+                                            http_srv::TimerFn fn,
+                                            void *arg)
     {
-        if (!ensure_mutex())
+        if (fn == nullptr || !lock_mutex())
         {
-            return ESP_FAIL;
+            return 0U;
         }
 
-        if (!lock_mutex())
+        TimerNode *n = s_timer_free;
+        if (n != nullptr)
         {
-            return ESP_FAIL;
+            s_timer_free = n->next;
+        }
+        else if (s_timers_fresh < kTimers)
+        {
+            n = &s_timers[s_timers_fresh++];
         }
 
-        if (s_state == State::RUNNING)
+        if (n == nullptr)
         {
             unlock_mutex();
-            return ESP_OK;
+            ESP_LOGW(TAG, "Timer pool exhausted.");
+            return 0U;
         }
 
-        if (s_state == State::STOPPED || s_state == State::STOPPING)
+        if (s_timers_armed == 0U)
         {
-            unlock_mutex();
-            return ESP_ERR_INVALID_STATE;
+            s_wheel_last = xTaskGetTickCount();
         }
+        ++s_timers_armed;
 
-        unlock_mutex();
+        n->fn = fn;
+        n->arg = arg;
+        n->period = (period_ms > 0U) ? ms_to_wheel_ticks(period_ms) : 0U;
+        wheel_insert_locked(n, ms_to_wheel_ticks(delay_ms));
 
-        const EventBits_t bits =
-            xEventGroupWaitBits(s_evt,
-                                READY_BIT,
-                                pdFALSE,
-                                pdTRUE,
-                                timeout_ticks);
+        const http_srv::TimerId id = timer_id(n);
+        unlock_mutex();
 
-        return (bits & READY_BIT) ? ESP_OK : ESP_ERR_TIMEOUT;
+        notify_worker();
+        return id;
     }
 
-    esp_err_t register_uri(const char *uri,
-                           httpd_method_t method,
-                           esp_err_t (*handler)(httpd_req_t *))
+    static esp_err_t timer_cancel(http_srv::TimerId id)
     {
-        if (uri == nullptr || handler == nullptr)
+        if (!lock_mutex())
         {
-            return ESP_ERR_INVALID_ARG;
+            return ESP_FAIL;
         }
 
-        if (!ensure_mutex())
+        TimerNode *n = timer_from_id(id);
+        if (n == nullptr || n->state == TimerState::FREE || n->state == TimerState::CANCELLED)
         {
-            return ESP_FAIL;
+            unlock_mutex();
+            return ESP_ERR_NOT_FOUND;
         }
 
-        if (!lock_mutex())
+        if (n->state == TimerState::RUNNING)
         {
-            return ESP_FAIL;
+            // The worker frees it when the callback returns.
+            n->state = TimerState::CANCELLED;
         }
-
-        if (s_state != State::RUNNING || s_server == nullptr)
+        else
         {
-            unlock_mutex();
-            return ESP_ERR_INVALID_STATE;
+            wheel_unlink_locked(n);
+            timer_free_locked(n);
         }
 
-        httpd_uri_t h{};
-        h.uri = uri;
-        h.method = method;
-        h.handler = handler;
-        h.user_ctx = nullptr;
-
-        const esp_err_t rc = httpd_register_uri_handler(s_server, &h);
         unlock_mutex();
-        return rc;
+        return ESP_OK;
     }
 
-    esp_err_t unregister_uri(const char *uri, httpd_method_t method)
+    /**
+     * Ticks the worker may sleep before the wheel needs advancing.
+     */
+    static TickType_t timer_wait_ticks()
     {
-        if (uri == nullptr)
+        if (!lock_mutex())
         {
-            return ESP_ERR_INVALID_ARG;
+            return kWheelTick;
         }
 
-        if (!ensure_mutex())
+        TickType_t wait = portMAX_DELAY;
+        if (s_timers_armed > 0U)
         {
-            return ESP_FAIL;
+            // Sleep through empty buckets up to the next occupied one.
+            TickType_t due = kWheelSlots * kWheelTick;
+            for (size_t d = 1U; d <= kWheelSlots; ++d)
+            {
+                if (s_wheel[(s_wheel_pos + d) % kWheelSlots] != nullptr)
+                {
+                    due = d * kWheelTick;
+                    break;
+                }
+            }
+
+            const TickType_t elapsed = xTaskGetTickCount() - s_wheel_last;
+            wait = (elapsed >= due) ? 0 : (due - elapsed);
         }
 
+        unlock_mutex();
+        return wait;
+    }
+
+    /**
+     * Advance the wheel to the current time and run every expired callback.
+     * Runs on the worker task.
+     */
+    static void run_due_timers()
+    {
         if (!lock_mutex())
         {
-            return ESP_FAIL;
+            return;
         }
 
-        if (s_state != State::RUNNING || s_server == nullptr)
+        const TickType_t now = xTaskGetTickCount();
+        if (s_timers_armed == 0U)
         {
+            s_wheel_last = now;
             unlock_mutex();
-            return ESP_ERR_INVALID_STATE;
+            return;
         }
 
-        const esp_err_t rc = httpd_unregister_uri_handler(s_server, uri, method);
-        unlock_mutex();
-        return rc;
-    }
+        const uint32_t elapsed = (now - s_wheel_last) / kWheelTick;
+        s_wheel_last += elapsed * kWheelTick;
 
-    void close_all_sessions()
-    {
-        if (!ensure_mutex())
+        TimerNode *due = nullptr;
+        for (uint32_t i = 0U; i < elapsed; ++i)
         {
-            return;
+            s_wheel_pos = (s_wheel_pos + 1U) % kWheelSlots;
+
+            TimerNode *n = s_wheel[s_wheel_pos];
+            while (n != nullptr)
+            {
+                TimerNode *next = n->next;
+                if (n->rounds > 0U)
+                {
+                    --n->rounds;
+                }
+                else
+                {
+                    wheel_unlink_locked(n);
+                    n->state = TimerState::RUNNING;
+                    n->next = due;
+                    due = n;
+                }
+                n = next;
+            }
         }
+        unlock_mutex();
 
-        close_all_sessions_internal();
-    }
+        while (due != nullptr)
+        {
+            TimerNode *n = due;
+            due = n->next;
+            n->next = nullptr;
+
+            n->fn(n->arg);
+
+            if (!lock_mutex())
+            {
+                continue;
+            }
+
+            if (n->state == TimerState::CANCELLED || n->period == 0U)
+            {
+                timer_free_locked(n);
+            }
+            else
+            {
+                wheel_insert_locked(n, n->period);
+            }
+            unlock_mutex();
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    // Settings store guarded by s_mutex.
+    //
+    // settings_set_*() only update a RAM shadow and mark the key dirty, so a
+    // handler never waits for a flash erase. A debounced worker timer writes
+    // every dirty key and issues one nvs_commit() for the batch; a burst of
+    // sets is written no later than kSettingsMaxDelayMs after its first one.
+    // Values equal to the shadow are not marked dirty at all. When the worker
+    // is not running, sets are written through. A failed commit re-arms the
+    // timer with a backoff that starts at kSettingsMaxDelayMs and doubles up
+    // to kSettingsRetryMaxMs, so unwritten values are retried without a new
+    // set.
+    // -------------------------------------------------------------------------
+
+    enum class SettingType : uint8_t
+    {
+        U32,
+        I32,
+        STR,
+        BLOB
+    };
+
+    struct Setting
+    {
+        SettingType type;
+        bool dirty;
+        std::vector<uint8_t> data; // Raw value; STR includes the terminator.
+    };
+
+    static constexpr uint32_t kSettingsDebounceMs = CONFIG_HTTP_SERVER_SETTINGS_DEBOUNCE_MS;
+    static constexpr uint32_t kSettingsMaxDelayMs = CONFIG_HTTP_SERVER_SETTINGS_MAX_DELAY_MS;
+    static constexpr size_t kSettingsMaxKeys = CONFIG_HTTP_SERVER_SETTINGS_MAX_KEYS;
+    static constexpr const char *kSettingsNamespace = CONFIG_HTTP_SERVER_SETTINGS_NAMESPACE;
+    static constexpr uint32_t kSettingsRetryMaxMs = std::max<uint32_t>(60000U, kSettingsMaxDelayMs);
+
+    static std::unordered_map<std::string, Setting> s_settings;
+    static bool s_settings_armed = false;
+    static http_srv::TimerId s_settings_timer = 0U;
+    static TickType_t s_settings_first_dirty = 0;
+    static TickType_t s_settings_deadline = 0;
+    static uint32_t s_settings_retry_ms = 0U; // 0 until a commit fails.
+
+    static bool valid_setting_key(const char *key)
+    {
+        return key != nullptr && key[0] != '\0' && std::strlen(key) < NVS_KEY_NAME_MAX_SIZE;
+    }
+
+    static bool arm_settings_timer(uint32_t delay_ms);
+
+    /**
+     * Write all dirty keys with a single commit. Keys whose write fails are
+     * marked dirty again, and while the worker runs the flush timer is
+     * re-armed with backoff to retry them.
+     */
+    static esp_err_t flush_settings()
+    {
+        std::vector<std::pair<std::string, Setting>> batch;
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+        for (auto &kv : s_settings)
+        {
+            if (kv.second.dirty)
+            {
+                batch.emplace_back(kv.first, kv.second);
+                kv.second.dirty = false;
+            }
+        }
+        unlock_mutex();
+
+        if (batch.empty())
+        {
+            return ESP_OK;
+        }
+
+        nvs_handle_t h = 0;
+        esp_err_t rc = nvs_open(kSettingsNamespace, NVS_READWRITE, &h);
+        for (size_t i = 0; rc == ESP_OK && i < batch.size(); ++i)
+        {
+            const char *key = batch[i].first.c_str();
+            const Setting &s = batch[i].second;
+            switch (s.type)
+            {
+            case SettingType::U32:
+            {
+                uint32_t v = 0U;
+                std::memcpy(&v, s.data.data(), sizeof(v));
+                rc = nvs_set_u32(h, key, v);
+                break;
+            }
+            case SettingType::I32:
+            {
+                int32_t v = 0;
+                std::memcpy(&v, s.data.data(), sizeof(v));
+                rc = nvs_set_i32(h, key, v);
+                break;
+            }
+            case SettingType::STR:
+                rc = nvs_set_str(h, key, reinterpret_cast<const char *>(s.data.data()));
+                break;
+            case SettingType::BLOB:
+                rc = nvs_set_blob(h, key, s.data.data(), s.data.size());
+                break;
+            }
+        }
+        if (rc == ESP_OK)
+        {
+            rc = nvs_commit(h);
+        }
+        if (h != 0)
+        {
+            nvs_close(h);
+        }
+
+        if (rc != ESP_OK)
+        {
+            bool rearm = false;
+            uint32_t retry_ms = 0U;
+            if (lock_mutex())
+            {
+                for (const auto &kv : batch)
+                {
+                    auto it = s_settings.find(kv.first);
+                    if (it != s_settings.end())
+                    {
+                        it->second.dirty = true;
+                    }
+                }
+
+                retry_ms = (s_settings_retry_ms == 0U)
+                               ? kSettingsMaxDelayMs
+                               : std::min(s_settings_retry_ms * 2U, kSettingsRetryMaxMs);
+                s_settings_retry_ms = retry_ms;
+
+                rearm = s_task != nullptr && !s_task_exit && !s_settings_armed;
+                if (rearm)
+                {
+                    const TickType_t now = xTaskGetTickCount();
+                    s_settings_armed = true;
+                    s_settings_first_dirty = now;
+                    s_settings_deadline = now + pdMS_TO_TICKS(retry_ms);
+                }
+                unlock_mutex();
+            }
+
+            if (rearm)
+            {
+                ESP_LOGW(TAG, "Settings commit failed: %s; retrying in %u ms.",
+                         esp_err_to_name(rc), static_cast<unsigned>(retry_ms));
+                (void)arm_settings_timer(retry_ms);
+            }
+            else
+            {
+                ESP_LOGW(TAG, "Settings commit failed: %s.", esp_err_to_name(rc));
+            }
+            return rc;
+        }
+
+        if (lock_mutex())
+        {
+            s_settings_retry_ms = 0U;
+            unlock_mutex();
+        }
+
+        s_counters.settings_commits.fetch_add(1U, std::memory_order_relaxed);
+        s_counters.settings_keys_written.fetch_add(static_cast<uint32_t>(batch.size()),
+                                                   std::memory_order_relaxed);
+        return ESP_OK;
+    }
+
+    static void settings_timer_fired(void *arg);
+
+    /**
+     * Arm the flush timer if it is not armed. On failure (no worker, or the
+     * pool is exhausted) the caller must flush itself.
+     */
+    static bool arm_settings_timer(uint32_t delay_ms)
+    {
+        const http_srv::TimerId id = timer_schedule(delay_ms, 0U, settings_timer_fired, nullptr);
+        if (!lock_mutex())
+        {
+            return id != 0U;
+        }
+        s_settings_timer = id;
+        s_settings_armed = id != 0U;
+        unlock_mutex();
+        return id != 0U;
+    }
+
+    static void settings_timer_fired(void *arg)
+    {
+        (void)arg;
+
+        if (!lock_mutex())
+        {
+            return;
+        }
+        const TickType_t now = xTaskGetTickCount();
+        const TickType_t left = s_settings_deadline - now;
+        const bool due = static_cast<int32_t>(left) <= 0;
+        if (due)
+        {
+            s_settings_armed = false;
+            s_settings_timer = 0U;
+        }
+        unlock_mutex();
+
+        // Sets since the timer was armed pushed the deadline out.
+        if (due || !arm_settings_timer(static_cast<uint32_t>(pdTICKS_TO_MS(left))))
+        {
+            (void)flush_settings();
+        }
+    }
+
+    /**
+     * Store a value in the shadow and schedule its write.
+     */
+    static esp_err_t put_setting(const char *key, SettingType type, const void *data, size_t len)
+    {
+        if (!valid_setting_key(key) || (data == nullptr && len > 0U))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        const auto *bytes = static_cast<const uint8_t *>(data);
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        auto it = s_settings.find(key);
+        if (it == s_settings.end())
+        {
+            if (s_settings.size() >= kSettingsMaxKeys)
+            {
+                unlock_mutex();
+                return ESP_ERR_NO_MEM;
+            }
+            it = s_settings.emplace(key, Setting{type, false, {}}).first;
+        }
+        else if (it->second.type == type && it->second.data.size() == len &&
+                 (len == 0U || std::memcmp(it->second.data.data(), bytes, len) == 0))
+        {
+            unlock_mutex();
+            return ESP_OK;
+        }
+
+        it->second.type = type;
+        it->second.dirty = true;
+        it->second.data.assign(bytes, bytes + len);
+
+        const TickType_t now = xTaskGetTickCount();
+        const bool worker = s_task != nullptr && !s_task_exit;
+        const bool arm = worker && !s_settings_armed;
+        if (arm)
+        {
+            s_settings_first_dirty = now;
+            s_settings_armed = true;
+        }
+        s_settings_deadline = now + pdMS_TO_TICKS(kSettingsDebounceMs);
+        const TickType_t cap = s_settings_first_dirty + pdMS_TO_TICKS(kSettingsMaxDelayMs);
+        if (static_cast<int32_t>(s_settings_deadline - cap) > 0)
+        {
+            s_settings_deadline = cap;
+        }
+        unlock_mutex();
+
+        if (!worker || (arm && !arm_settings_timer(kSettingsDebounceMs)))
+        {
+            return flush_settings();
+        }
+        return ESP_OK;
+    }
+
+    /**
+     * Copy a value out of the shadow, loading it from NVS on first use.
+     * len is the buffer size on entry and the value size on return.
+     */
+    static esp_err_t get_setting(const char *key, SettingType type, void *out, size_t *len)
+    {
+        if (!valid_setting_key(key) || out == nullptr || len == nullptr)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        auto it = s_settings.find(key);
+        if (it == s_settings.end())
+        {
+            unlock_mutex();
+
+            nvs_handle_t h = 0;
+            esp_err_t rc = nvs_open(kSettingsNamespace, NVS_READONLY, &h);
+            if (rc != ESP_OK)
+            {
+                return (rc == ESP_ERR_NVS_NOT_FOUND) ? ESP_ERR_NOT_FOUND : rc;
+            }
+
+            Setting s{type, false, {}};
+            size_t size = 0U;
+            switch (type)
+            {
+            case SettingType::U32:
+                s.data.resize(sizeof(uint32_t));
+                rc = nvs_get_u32(h, key, reinterpret_cast<uint32_t *>(s.data.data()));
+                break;
+            case SettingType::I32:
+                s.data.resize(sizeof(int32_t));
+                rc = nvs_get_i32(h, key, reinterpret_cast<int32_t *>(s.data.data()));
+                break;
+            case SettingType::STR:
+                rc = nvs_get_str(h, key, nullptr, &size);
+                if (rc == ESP_OK)
+                {
+                    s.data.resize(size);
+                    rc = nvs_get_str(h, key, reinterpret_cast<char *>(s.data.data()), &size);
+                }
+                break;
+            case SettingType::BLOB:
+                rc = nvs_get_blob(h, key, nullptr, &size);
+                if (rc == ESP_OK)
+                {
+                    s.data.resize(size);
+                    rc = nvs_get_blob(h, key, s.data.data(), &size);
+                }
+                break;
+            }
+            nvs_close(h);
+
+            if (rc != ESP_OK)
+            {
+                return (rc == ESP_ERR_NVS_NOT_FOUND) ? ESP_ERR_NOT_FOUND : rc;
+            }
+
+            if (!lock_mutex())
+            {
+                return ESP_FAIL;
+            }
+
+            // A set that raced with the read wins.
+            it = s_settings.find(key);
+            if (it == s_settings.end())
+            {
+                if (s_settings.size() >= kSettingsMaxKeys)
+                {
+                    unlock_mutex();
+                    const size_t need = s.data.size();
+                    if (need > *len)
+                    {
+                        return ESP_ERR_INVALID_SIZE;
+                    }
+                    std::memcpy(out, s.data.data(), need);
+                    *len = need;
+                    return ESP_OK;
+                }
+                it = s_settings.emplace(key, std::move(s)).first;
+            }
+        }
+
+        esp_err_t rc = ESP_OK;
+        if (it->second.type != type)
+        {
+            rc = ESP_ERR_NVS_TYPE_MISMATCH;
+        }
+        else if (it->second.data.size() > *len)
+        {
+            rc = ESP_ERR_INVALID_SIZE;
+        }
+        else
+        {
+            std::memcpy(out, it->second.data.data(), it->second.data.size());
+        }
+        *len = it->second.data.size();
+        unlock_mutex();
+        return rc;
+    }
+
+    /**
+     * Called by the worker when it stops: drop the pending timer and write
+     * whatever is still dirty.
+     */
+    static void stop_settings_flush()
+    {
+        http_srv::TimerId id = 0U;
+        if (lock_mutex())
+        {
+            id = s_settings_timer;
+            s_settings_timer = 0U;
+            s_settings_armed = false;
+            unlock_mutex();
+        }
+        if (id != 0U)
+        {
+            (void)timer_cancel(id);
+        }
+        (void)flush_settings();
+    }
+
+#if CONFIG_HTTP_SERVER_PM_BOOST
+    // -------------------------------------------------------------------------
+    // Power-management boost.
+    //
+    // The first socket activity after an idle period takes a CPU_FREQ_MAX and
+    // a NO_LIGHT_SLEEP lock and turns Wi-Fi power save off, so responses are
+    // not produced at the idle clock and sent by a napping modem. A worker
+    // timer hands everything back once no session has sent or received for
+    // kPmHoldMs and no background transfer is in flight. Activity itself is
+    // one relaxed store; only the idle-to-busy edge does any work.
+    //
+    // pm_hw_acquire() and pm_hw_release() are the only code that calls
+    // esp_pm and esp_wifi. On the linux target they only flip s_pm_held,
+    // which the stats report as pm_held, so the hysteresis policy can be
+    // exercised on a host.
+    // -------------------------------------------------------------------------
+
+    static constexpr uint32_t kPmHoldMs = CONFIG_HTTP_SERVER_PM_HOLD_MS;
+
+    static std::atomic<bool> s_pm_boosted{false};
+    static std::atomic<TickType_t> s_pm_last_activity{0};
+    static std::atomic<http_srv::TimerId> s_pm_timer{0U};
+
+#if !CONFIG_IDF_TARGET_LINUX
+    static bool s_pm_locks_created = false;
+    static esp_pm_lock_handle_t s_pm_cpu_lock = nullptr;
+    static esp_pm_lock_handle_t s_pm_sleep_lock = nullptr;
+#if CONFIG_HTTP_SERVER_PM_WIFI_PS
+    static wifi_ps_type_t s_pm_saved_ps = WIFI_PS_NONE;
+    static bool s_pm_ps_changed = false;
+#endif
+#endif
+
+    static void pm_hw_acquire()
+    {
+#if !CONFIG_IDF_TARGET_LINUX
+        if (!s_pm_locks_created)
+        {
+            // Both fail with ESP_ERR_NOT_SUPPORTED without CONFIG_PM_ENABLE;
+            // only the Wi-Fi part applies then.
+            s_pm_locks_created = true;
+            (void)esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "http_cpu", &s_pm_cpu_lock);
+            (void)esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "http_sleep", &s_pm_sleep_lock);
+        }
+        if (s_pm_cpu_lock != nullptr)
+        {
+            (void)esp_pm_lock_acquire(s_pm_cpu_lock);
+        }
+        if (s_pm_sleep_lock != nullptr)
+        {
+            (void)esp_pm_lock_acquire(s_pm_sleep_lock);
+        }
+#if CONFIG_HTTP_SERVER_PM_WIFI_PS
+        // Fails harmlessly when Wi-Fi is not started.
+        wifi_ps_type_t ps = WIFI_PS_NONE;
+        s_pm_ps_changed = esp_wifi_get_ps(&ps) == ESP_OK && ps != WIFI_PS_NONE &&
+                          esp_wifi_set_ps(WIFI_PS_NONE) == ESP_OK;
+        s_pm_saved_ps = ps;
+#endif
+#endif
+        s_pm_held.store(true, std::memory_order_relaxed);
+    }
+
+    static void pm_hw_release()
+    {
+        s_pm_held.store(false, std::memory_order_relaxed);
+#if !CONFIG_IDF_TARGET_LINUX
+#if CONFIG_HTTP_SERVER_PM_WIFI_PS
+        if (s_pm_ps_changed)
+        {
+            (void)esp_wifi_set_ps(s_pm_saved_ps);
+            s_pm_ps_changed = false;
+        }
+#endif
+        if (s_pm_sleep_lock != nullptr)
+        {
+            (void)esp_pm_lock_release(s_pm_sleep_lock);
+        }
+        if (s_pm_cpu_lock != nullptr)
+        {
+            (void)esp_pm_lock_release(s_pm_cpu_lock);
+        }
+#endif
+    }
+
+    static void pm_release()
+    {
+        pm_hw_release();
+        s_pm_boosted.store(false, std::memory_order_release);
+    }
+
+    static void pm_check_idle(void *arg);
+
+    static void pm_arm_check(uint32_t delay_ms)
+    {
+        const http_srv::TimerId id = timer_schedule(delay_ms, 0U, pm_check_idle, nullptr);
+        s_pm_timer.store(id, std::memory_order_relaxed);
+        if (id == 0U)
+        {
+            pm_release(); // Never hold the boost without a way to drop it.
+        }
+    }
+
+    static void pm_check_idle(void *arg)
+    {
+        (void)arg;
+
+        const TickType_t idle =
+            xTaskGetTickCount() - s_pm_last_activity.load(std::memory_order_relaxed);
+        const TickType_t hold = pdMS_TO_TICKS(kPmHoldMs);
+        const bool busy = s_counters.transfers_active.load(std::memory_order_relaxed) > 0U;
+
+        if (busy || idle < hold)
+        {
+            pm_arm_check(busy ? kPmHoldMs : static_cast<uint32_t>(pdTICKS_TO_MS(hold - idle)) + 1U);
+            return;
+        }
+
+        s_pm_timer.store(0U, std::memory_order_relaxed);
+        pm_release();
+    }
+
+    static void pm_activity()
+    {
+        s_pm_last_activity.store(xTaskGetTickCount(), std::memory_order_relaxed);
+
+        bool expected = false;
+        if (s_pm_boosted.load(std::memory_order_relaxed) ||
+            !s_pm_boosted.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            return;
+        }
+
+        pm_hw_acquire();
+        s_counters.pm_boosts.fetch_add(1U, std::memory_order_relaxed);
+        pm_arm_check(kPmHoldMs);
+    }
+
+    /**
+     * Called by stop() once httpd is down and no activity can re-arm the
+     * boost, so a stopped server holds nothing.
+     */
+    static void pm_stop()
+    {
+        const http_srv::TimerId id = s_pm_timer.exchange(0U, std::memory_order_relaxed);
+        if (id != 0U && timer_cancel(id) == ESP_OK)
+        {
+            pm_release();
+        }
+    }
+#endif
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
+    // -------------------------------------------------------------------------
+    // LittleFS file serving.
+    // -------------------------------------------------------------------------
+
+    static esp_err_t ensure_fs_mounted()
+    {
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (s_fs_mounted)
+        {
+            unlock_mutex();
+            return ESP_OK;
+        }
+
+        esp_vfs_littlefs_conf_t conf{};
+        conf.base_path = kFsBase;
+        conf.partition_label = kFsLabel;
+        conf.format_if_mount_failed = true;
+        conf.dont_mount = false;
+
+        ESP_LOGI(TAG, "LittleFS mounting: label='%s' base='%s'.", kFsLabel, kFsBase);
+
+        const esp_err_t rc = esp_vfs_littlefs_register(&conf);
+        if (rc != ESP_OK)
+        {
+            unlock_mutex();
+            ESP_LOGE(TAG, "LittleFS mount failed: %s.", esp_err_to_name(rc));
+            return rc;
+        }
+
+        size_t total = 0U;
+        size_t used = 0U;
+        const esp_err_t info_rc = esp_littlefs_info(kFsLabel, &total, &used);
+        if (info_rc == ESP_OK)
+        {
+            ESP_LOGI(TAG,
+                     "LittleFS total=%u used=%u.",
+                     static_cast<unsigned>(total),
+                     static_cast<unsigned>(used));
+        }
+        else
+        {
+            ESP_LOGW(TAG, "LittleFS info failed: %s.", esp_err_to_name(info_rc));
+        }
+
+        s_fs_mounted = true;
+        unlock_mutex();
+        return ESP_OK;
+    }
+
+    static bool has_dotdot(std::string_view uri)
+    {
+        return uri.find("..") != std::string_view::npos;
+    }
+
+    // Files the module keeps on the partition for itself.
+    static constexpr const char *kHotListFile = "/.hot_assets";
+    static constexpr const char *kPreloadManifest = "/.preload";
+    static constexpr const char *kUploadPartDir = "/.uploads";
+    static constexpr const char *kErrorPageDir = "/errors";
+
+    /**
+     * Copy of path with empty and "." segments dropped, the way the
+     * filesystem resolves them, so "//logs/x" and "/./logs/x" compare equal
+     * to "/logs/x".
+     */
+    static std::string canonical_fs_path(std::string_view path)
+    {
+        std::string out;
+        out.reserve(path.size());
+        while (!path.empty())
+        {
+            const size_t slash = std::min(path.find('/'), path.size());
+            const std::string_view seg = path.substr(0, slash);
+            path.remove_prefix(std::min(slash + 1U, path.size()));
+            if (!seg.empty() && seg != ".")
+            {
+                out += '/';
+                out += seg;
+            }
+        }
+        return out.empty() ? std::string("/") : out;
+    }
+
+    /**
+     * True if canonical path p is name itself, or lies below it. With
+     * allow_suffix, "name.<anything>" matches too (temporary files).
+     */
+    static bool fs_path_under(std::string_view p, std::string_view name, bool allow_suffix = false)
+    {
+        if (name.empty() || name == "/" || p.substr(0, name.size()) != name)
+        {
+            return false;
+        }
+        return p.size() == name.size() || p[name.size()] == '/' ||
+               (allow_suffix && p[name.size()] == '.');
+    }
+
+    /**
+     * True for paths that must never be served as static files or replaced
+     * by an upload: the module's own files and error pages and, with the
+     * tail endpoint enabled, the tail directory, which is only reachable
+     * through that endpoint and its authentication.
+     */
+    static bool is_private_fs_path(std::string_view path)
+    {
+        const std::string p = canonical_fs_path(path);
+
+        if (fs_path_under(p, kHotListFile, true) ||
+            fs_path_under(p, kPreloadManifest, true) ||
+            fs_path_under(p, kUploadPartDir) ||
+            fs_path_under(p, kErrorPageDir))
+        {
+            return true;
+        }
+
+#if CONFIG_HTTP_SERVER_ENABLE_TAIL
+        if (fs_path_under(p, canonical_fs_path(CONFIG_HTTP_SERVER_TAIL_DIR)))
+        {
+            return true;
+        }
+#endif
+
+        return false;
+    }
+
+    static bool ends_with(std::string_view s, std::string_view suffix)
+    {
+        return s.size() >= suffix.size() &&
+               s.substr(s.size() - suffix.size()) == suffix;
+    }
+
+    static std::string content_type_for_path(std::string_view path_no_gz)
+    {
+        if (ends_with(path_no_gz, ".htm") || ends_with(path_no_gz, ".html"))
+            return "text/html; charset=utf-8";
+        if (ends_with(path_no_gz, ".css"))
+            return "text/css; charset=utf-8";
+        if (ends_with(path_no_gz, ".js"))
+            return "application/javascript; charset=utf-8";
+        if (ends_with(path_no_gz, ".json"))
+            return "application/json; charset=utf-8";
+        if (ends_with(path_no_gz, ".svg"))
+            return "image/svg+xml";
+        if (ends_with(path_no_gz, ".png"))
+            return "image/png";
+        if (ends_with(path_no_gz, ".jpg") || ends_with(path_no_gz, ".jpeg"))
+            return "image/jpeg";
+        if (ends_with(path_no_gz, ".gif"))
+            return "image/gif";
+        if (ends_with(path_no_gz, ".webp"))
+            return "image/webp";
+        if (ends_with(path_no_gz, ".avif"))
+            return "image/avif";
+        if (ends_with(path_no_gz, ".ico"))
+            return "image/x-icon";
+        if (ends_with(path_no_gz, ".woff2"))
+            return "font/woff2";
+        if (ends_with(path_no_gz, ".woff"))
+            return "font/woff";
+        if (ends_with(path_no_gz, ".ttf"))
+            return "font/ttf";
+        if (ends_with(path_no_gz, ".map"))
+            return "application/json; charset=utf-8";
+
+        return "text/plain; charset=utf-8";
+    }
+
+    static bool file_size(const std::string &full_path, size_t &out_size)
+    {
+        struct stat st{};
+        if (stat(full_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            return false;
+        }
+        out_size = static_cast<size_t>(st.st_size);
+        return true;
+    }
+
+    /**
+     * Validator for a file: path, size and mtime hashed together. LittleFS
+     * only keeps an mtime with CONFIG_LITTLEFS_USE_MTIME; without it the tag
+     * still changes whenever an upload changes the size.
+     */
+    static uint64_t file_tag(const std::string &full_path, size_t size)
+    {
+        struct stat st{};
+        const int64_t mtime = (stat(full_path.c_str(), &st) == 0) ? static_cast<int64_t>(st.st_mtime) : 0;
+
+        const uint64_t key[3] = {fnv1a64(full_path.data(), full_path.size()),
+                                 static_cast<uint64_t>(size),
+                                 static_cast<uint64_t>(mtime)};
+        return fnv1a64(key, sizeof(key));
+    }
+
+    // Formats that can stand in for a .png/.jpg with the same base name,
+    // best first. The files are produced offline and stored next to the
+    // original, e.g. photo.png, photo.avif and photo.webp.
+    struct ImageVariant
+    {
+        const char *ext;
+        const char *ctype;
+    };
+
+    static constexpr ImageVariant kImageVariants[] = {
+        {".avif", "image/avif"},
+        {".webp", "image/webp"},
+    };
+
+    static constexpr size_t kImageVariantCount = sizeof(kImageVariants) / sizeof(kImageVariants[0]);
+
+    static std::string image_variant_path(const std::string &full_path, size_t v)
+    {
+        const size_t dot = full_path.rfind('.');
+        return full_path.substr(0, dot) + kImageVariants[v].ext;
+    }
+
+    static bool resolve_fs_path(std::string_view uri,
+                                std::string &out_full_path,
+                                std::string &out_ctype,
+                                bool &out_is_gz,
+                                size_t &out_size)
+    {
+        out_full_path.clear();
+        out_ctype.clear();
+        out_is_gz = false;
+        out_size = 0U;
+
+        if (uri.empty() || uri.front() != '/')
+        {
+            return false;
+        }
+
+        if (has_dotdot(uri) || is_private_fs_path(uri))
+        {
+            return false;
+        }
+
+        std::string logical(uri);
+
+        if (!logical.empty() && logical.back() == '/')
+        {
+            logical += "index.html";
+        }
+        if (logical == "/")
+        {
+            logical = "/index.html";
+        }
+
+        const bool requested_gz = ends_with(logical, ".gz");
+        if (requested_gz && logical.size() > 3U)
+        {
+            logical.resize(logical.size() - 3U);
+        }
+
+        auto full = [&](const std::string &p) -> std::string
+        {
+            std::string fp;
+            fp.reserve(std::strlen(kFsBase) + p.size() + 1U);
+            fp += kFsBase;
+            fp += p;
+            return fp;
+        };
+
+        std::vector<std::string> candidates;
+        candidates.reserve(2);
+        candidates.push_back(logical);
+
+        if (ends_with(logical, ".html"))
+        {
+            std::string alt = logical;
+            alt.resize(alt.size() - 5U);
+            alt += ".htm";
+            if (alt != logical)
+            {
+                candidates.push_back(std::move(alt));
+            }
+        }
+        else if (ends_with(logical, ".htm"))
+        {
+            std::string alt = logical;
+            alt.resize(alt.size() - 4U);
+            alt += ".html";
+            if (alt != logical)
+            {
+                candidates.push_back(std::move(alt));
+            }
+        }
+
+        for (const auto &cand : candidates)
+        {
+            const std::string gz = cand + ".gz";
+            const std::string gz_full = full(gz);
+
+            if (file_size(gz_full, out_size))
+            {
+                out_full_path = gz_full;
+                out_is_gz = true;
+                out_ctype = content_type_for_path(cand);
+                return true;
+            }
+
+            const std::string plain_full = full(cand);
+            if (file_size(plain_full, out_size))
+            {
+                out_full_path = plain_full;
+                out_is_gz = false;
+                out_ctype = content_type_for_path(cand);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // -------------------------------------------------------------------------
+    // Metadata index and content cache guarded by s_mutex.
+    //
+    // The index maps a request path to its resolved file (or to "not found"),
+    // so repeat requests skip the variant probes in resolve_fs_path(). It also
+    // counts hits per path, which feeds the persisted hot-asset list.
+    //
+    // The content cache holds whole small files in RAM so they go out with a
+    // single httpd_resp_send(). Bodies are shared_ptr so a response can be sent
+    // outside the lock while the entry is evicted concurrently.
+    // -------------------------------------------------------------------------
+
+    struct IndexEntry
+    {
+        std::string full_path; // Empty for a negative entry.
+        std::string ctype;
+        size_t size;
+        bool is_gz;
+        http_srv::CachePolicy cache;
+        size_t variant_size[kImageVariantCount]; // Per kImageVariants; 0 if absent.
+        uint64_t tag;                            // ETag source; see file_tag().
+        uint64_t variant_tag[kImageVariantCount];
+        uint32_t hits;
+    };
+
+    struct CacheEntry
+    {
+        std::string key; // Full file path, or a synthetic key for combos.
+        CachedBody body;
+        TickType_t last_use;
+    };
+
+    static constexpr size_t kIndexEntries = CONFIG_HTTP_SERVER_INDEX_ENTRIES;
+    static constexpr size_t kHotListSize = CONFIG_HTTP_SERVER_HOT_LIST_SIZE;
+    static constexpr uint32_t kHotListIntervalS = CONFIG_HTTP_SERVER_HOT_LIST_INTERVAL_S;
+
+    static std::unordered_map<std::string, IndexEntry> s_index;
+    static std::vector<CacheEntry> s_cache;
+    static size_t s_cache_bytes = 0U;
+    static uint32_t s_fs_generation = 0U;
+    // Hit counts per request path for the hot list. Kept apart from s_index
+    // so that invalidate_fs_caches() does not reset them.
+    static std::unordered_map<std::string, uint32_t> s_hit_counts;
+    static bool s_hits_dirty = false;
+
+    static uint32_t fs_generation()
+    {
+        uint32_t generation = 0U;
+        if (lock_mutex())
+        {
+            generation = s_fs_generation;
+            unlock_mutex();
+        }
+        return generation;
+    }
+
+    static void index_make_room()
+    {
+        if (s_index.size() < kIndexEntries)
+        {
+            return;
+        }
+
+        // Prefer dropping a negative entry, then the least-hit entry.
+        auto victim = s_index.begin();
+        for (auto it = s_index.begin(); it != s_index.end(); ++it)
+        {
+            if (it->second.full_path.empty())
+            {
+                victim = it;
+                break;
+            }
+            if (it->second.hits < victim->second.hits)
+            {
+                victim = it;
+            }
+        }
+        s_index.erase(victim);
+    }
+
+    /**
+     * Count a hit on a request path and return its total. The table is
+     * capped at kIndexEntries; a new path displaces the least-hit one.
+     * Caller holds s_mutex.
+     */
+    static uint32_t count_path_hit(const std::string &key)
+    {
+        auto it = s_hit_counts.find(key);
+        if (it == s_hit_counts.end())
+        {
+            if (s_hit_counts.size() >= std::max<size_t>(kIndexEntries, kHotListSize))
+            {
+                auto victim = s_hit_counts.begin();
+                for (auto c = s_hit_counts.begin(); c != s_hit_counts.end(); ++c)
+                {
+                    if (c->second < victim->second)
+                    {
+                        victim = c;
+                    }
+                }
+                s_hit_counts.erase(victim);
+            }
+            it = s_hit_counts.emplace(key, 0U).first;
+        }
+        s_hits_dirty = true;
+        return ++it->second;
+    }
+
+    /**
+     * Record which image format variants exist next to a resolved PNG or
+     * JPEG, so negotiating them later needs no filesystem access.
+     */
+    static void probe_image_variants(IndexEntry &e)
+    {
+        if (e.is_gz || (e.ctype != "image/png" && e.ctype != "image/jpeg"))
+        {
+            return;
+        }
+
+        for (size_t v = 0; v < kImageVariantCount; ++v)
+        {
+            const std::string variant = image_variant_path(e.full_path, v);
+            size_t size = 0U;
+            e.variant_size[v] = file_size(variant, size) ? size : 0U;
+            e.variant_tag[v] = (e.variant_size[v] != 0U) ? file_tag(variant, size) : 0U;
+        }
+    }
+
+    static bool has_image_variants(const IndexEntry &e)
+    {
+        for (const size_t size : e.variant_size)
+        {
+            if (size != 0U)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * True if the Accept list names type without q=0. Wildcards are not
+     * honoured: browsers that decode AVIF or WebP list them explicitly.
+     */
+    static bool accepts_media_type(std::string_view accept, std::string_view type)
+    {
+        size_t pos = 0;
+        while ((pos = accept.find(type, pos)) != std::string_view::npos)
+        {
+            const size_t end = pos + type.size();
+            const bool starts = pos == 0 || accept[pos - 1] == ',' || accept[pos - 1] == ' ';
+            if (starts && (end == accept.size() || accept[end] == ',' || accept[end] == ';' ||
+                           accept[end] == ' '))
+            {
+                std::string_view params = accept.substr(end);
+                params = params.substr(0, params.find(','));
+                const size_t q = params.find("q=");
+                return q == std::string_view::npos ||
+                       std::strtod(std::string(params.substr(q + 2)).c_str(), nullptr) > 0.0;
+            }
+            pos = end;
+        }
+        return false;
+    }
+
+    /**
+     * Swap e for the best image format variant the client accepts. Entries
+     * without variants are left alone and cost no header lookup.
+     */
+    static void select_image_variant(httpd_req_t *req, IndexEntry &e)
+    {
+        if (!has_image_variants(e))
+        {
+            return;
+        }
+
+        char accept[256];
+        const esp_err_t rc = httpd_req_get_hdr_value_str(req, "Accept", accept, sizeof(accept));
+        if (rc != ESP_OK && rc != ESP_ERR_HTTPD_RESULT_TRUNC)
+        {
+            return;
+        }
+
+        for (size_t v = 0; v < kImageVariantCount; ++v)
+        {
+            if (e.variant_size[v] != 0U && accepts_media_type(accept, kImageVariants[v].ctype))
+            {
+                e.full_path = image_variant_path(e.full_path, v);
+                e.ctype = kImageVariants[v].ctype;
+                e.size = e.variant_size[v];
+                e.tag = e.variant_tag[v];
+                return;
+            }
+        }
+    }
+
+    /**
+     * Resolve a request path through the index. Counts a hit on success
+     * unless count_hit is false, as for lookups the server makes itself.
+     */
+    static bool lookup_fs_path(std::string_view path, IndexEntry &out, bool count_hit = true)
+    {
+        if (kIndexEntries == 0U)
+        {
+            out.hits = 0U;
+            const bool found = resolve_fs_path(path, out.full_path, out.ctype, out.is_gz, out.size);
+            out.cache = cache_policy_for(path, out.ctype);
+            if (found)
+            {
+                out.tag = file_tag(out.full_path, out.size);
+                probe_image_variants(out);
+            }
+            return found;
+        }
+
+        const std::string key(path);
+
+        if (lock_mutex())
+        {
+            auto it = s_index.find(key);
+            if (it != s_index.end())
+            {
+                if (count_hit && !it->second.full_path.empty())
+                {
+                    it->second.hits = count_path_hit(key);
+                }
+                out = it->second;
+                unlock_mutex();
+                s_counters.index_hits.fetch_add(1U, std::memory_order_relaxed);
+                return !out.full_path.empty();
+            }
+            unlock_mutex();
+        }
+
+        s_counters.index_misses.fetch_add(1U, std::memory_order_relaxed);
+
+        const uint32_t generation = fs_generation();
+
+        IndexEntry e{};
+        const bool found = resolve_fs_path(path, e.full_path, e.ctype, e.is_gz, e.size);
+        e.cache = found ? cache_policy_for(path, e.ctype) : http_srv::CachePolicy::REVALIDATE;
+        if (found)
+        {
+            e.tag = file_tag(e.full_path, e.size);
+            probe_image_variants(e);
+        }
+
+        if (lock_mutex())
+        {
+            if (found && count_hit)
+            {
+                e.hits = count_path_hit(key);
+            }
+            // Drop the result if the filesystem changed while probing.
+            if (generation == s_fs_generation)
+            {
+                index_make_room();
+                s_index[key] = e;
+            }
+            unlock_mutex();
+        }
+
+        out = std::move(e);
+        return found;
+    }
+
+    static CachedBody cache_get(const std::string &key)
+    {
+        if (tuning().cache_bytes == 0U || !lock_mutex())
+        {
+            return nullptr;
+        }
+
+        for (auto &c : s_cache)
+        {
+            if (c.key == key)
+            {
+                c.last_use = xTaskGetTickCount();
+                CachedBody body = c.body;
+                unlock_mutex();
+                s_counters.cache_hits.fetch_add(1U, std::memory_order_relaxed);
+                return body;
+            }
+        }
+
+        unlock_mutex();
+        s_counters.cache_misses.fetch_add(1U, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    static bool read_file_exact(const std::string &full_path, size_t size, char *out)
+    {
+        FILE *f = std::fopen(full_path.c_str(), "rb");
+        if (f == nullptr)
+        {
+            return false;
+        }
+
+        const size_t n = std::fread(out, 1, size, f);
+        // A size mismatch means the file changed since it was indexed.
+        const bool ok = (n == size) && (std::fgetc(f) == EOF);
+        std::fclose(f);
+        return ok;
+    }
+
+    /**
+     * Evict least recently used entries until at most @p budget bytes remain.
+     */
+    static void cache_trim_locked(size_t budget)
+    {
+        while (!s_cache.empty() && s_cache_bytes > budget)
+        {
+            auto lru = std::min_element(s_cache.begin(), s_cache.end(),
+                                        [](const CacheEntry &a, const CacheEntry &b)
+                                        { return a.last_use < b.last_use; });
+            s_cache_bytes -= lru->body->size();
+            s_cache.erase(lru);
+        }
+
+        s_counters.cache_bytes.store(static_cast<uint32_t>(s_cache_bytes),
+                                     std::memory_order_relaxed);
+    }
+
+    /**
+     * Insert a body into the cache, evicting the least recently used entries
+     * to stay within the tuned budget. Returns the cached body, which may be an
+     * existing entry for the same key. Nothing is inserted if the filesystem
+     * generation moved past @p generation while the body was being built.
+     */
+    static CachedBody cache_put(const std::string &key,
+                                CachedBody body,
+                                uint32_t generation)
+    {
+        const http_srv::Tuning cfg = tuning();
+        const size_t size = body->size();
+        if (size > cfg.cache_max_entry_bytes || size > cfg.cache_bytes || !lock_mutex())
+        {
+            return body;
+        }
+
+        if (generation != s_fs_generation)
+        {
+            unlock_mutex();
+            return body;
+        }
+
+        for (const auto &c : s_cache)
+        {
+            if (c.key == key)
+            {
+                CachedBody existing = c.body;
+                unlock_mutex();
+                return existing;
+            }
+        }
+
+        cache_trim_locked(cfg.cache_bytes - size);
+
+        s_cache.push_back(CacheEntry{key, body, xTaskGetTickCount()});
+        s_cache_bytes += size;
+        s_counters.cache_bytes.store(static_cast<uint32_t>(s_cache_bytes),
+                                     std::memory_order_relaxed);
+        unlock_mutex();
+        return body;
+    }
+
+    /**
+     * Read a small file into RAM and insert it into the cache.
+     */
+    static CachedBody cache_load(const std::string &full_path, size_t size)
+    {
+        const http_srv::Tuning cfg = tuning();
+        if (size > cfg.cache_max_entry_bytes || size > cfg.cache_bytes)
+        {
+            return nullptr;
+        }
+
+        const uint32_t generation = fs_generation();
+
+        auto body = std::make_shared<std::vector<char>>(size);
+        if (!read_file_exact(full_path, size, body->data()))
+        {
+            return nullptr;
+        }
+
+        return cache_put(full_path, std::move(body), generation);
+    }
+
+    // -------------------------------------------------------------------------
+    // Preload manifest guarded by s_mutex.
+    //
+    // The build pipeline writes /.preload to the LittleFS image, one rule per
+    // line: "<html path> <asset path> [as]". Comment lines start with '#'.
+    // When "as" is omitted it is derived from the asset extension. Rules are
+    // folded into one precomputed Link header value per HTML entry point.
+    // -------------------------------------------------------------------------
+
+    static std::unordered_map<std::string, std::string> s_preload;
+    static bool s_preload_loaded = false;
+
+    static std::string_view preload_as_for(std::string_view asset)
+    {
+        if (ends_with(asset, ".js") || ends_with(asset, ".mjs"))
+            return "script";
+        if (ends_with(asset, ".css"))
+            return "style";
+        if (ends_with(asset, ".woff2") || ends_with(asset, ".woff") ||
+            ends_with(asset, ".ttf"))
+            return "font";
+        if (ends_with(asset, ".json"))
+            return "fetch";
+        return "image";
+    }
+
+    static std::string_view next_token(std::string_view &line)
+    {
+        const size_t start = line.find_first_not_of(" \t\r\n");
+        if (start == std::string_view::npos)
+        {
+            line = {};
+            return {};
+        }
+        line.remove_prefix(start);
+
+        const size_t end = std::min(line.find_first_of(" \t\r\n"), line.size());
+        const std::string_view tok = line.substr(0, end);
+        line.remove_prefix(end);
+        return tok;
+    }
+
+    static void append_preload(std::string &hdr, std::string_view asset, std::string_view as)
+    {
+        if (!hdr.empty())
+        {
+            hdr += ", ";
+        }
+
+        hdr += '<';
+        hdr += asset;
+        hdr += ">; rel=preload; as=";
+        hdr += as;
+
+        if (as == "font")
+        {
+            // Fonts are always fetched in CORS mode; without this the
+            // browser discards the preload and fetches the font again.
+            hdr += "; type=\"";
+            hdr += content_type_for_path(asset);
+            hdr += "\"; crossorigin";
+        }
+        else if (as == "fetch")
+        {
+            hdr += "; crossorigin";
+        }
+    }
+
+    static void load_preload_manifest()
+    {
+        std::unordered_map<std::string, std::string> rules;
+
+        std::string manifest(kFsBase);
+        manifest += kPreloadManifest;
+
+        FILE *f = std::fopen(manifest.c_str(), "r");
+        if (f != nullptr)
+        {
+            char buf[2 * HTTPD_MAX_URI_LEN];
+            while (std::fgets(buf, sizeof(buf), f) != nullptr)
+            {
+                std::string_view line(buf);
+                const std::string_view entry = next_token(line);
+                const std::string_view asset = next_token(line);
+                std::string_view as = next_token(line);
+
+                if (entry.empty() || entry.front() != '/' || asset.empty())
+                {
+                    continue;
+                }
+
+                if (as.empty())
+                {
+                    as = preload_as_for(asset);
+                }
+
+                append_preload(rules[std::string(entry)], asset, as);
+            }
+            std::fclose(f);
+        }
+
+        if (lock_mutex())
+        {
+            s_preload = std::move(rules);
+            s_preload_loaded = true;
+            unlock_mutex();
+        }
+    }
+
+    /**
+     * Return the Link header value for a resolved HTML file, or an empty
+     * string if the manifest has no rules for it.
+     */
+    static std::string preload_links_for(const std::string &full_path, bool is_gz)
+    {
+        std::string_view logical(full_path);
+        logical.remove_prefix(std::min(logical.size(), std::strlen(kFsBase)));
+        if (is_gz && logical.size() > 3U)
+        {
+            logical.remove_suffix(3U);
+        }
+
+        if (!lock_mutex())
+        {
+            return {};
+        }
+
+        const bool loaded = s_preload_loaded;
+        unlock_mutex();
+
+        if (!loaded)
+        {
+            load_preload_manifest();
+        }
+
+        std::string hdr;
+        if (lock_mutex())
+        {
+            auto it = s_preload.find(std::string(logical));
+            if (it != s_preload.end())
+            {
+                hdr = it->second;
+            }
+            unlock_mutex();
+        }
+        return hdr;
+    }
+
+    /**
+     * Load /errors/<code>.html pages into RAM. Slots set by the application
+     * through set_error_page() take precedence and are left alone.
+     */
+    static void load_error_pages()
+    {
+        for (const int code : kErrorCodes)
+        {
+            char path[64];
+            std::snprintf(path, sizeof(path), "%s%s/%d.html", kFsBase, kErrorPageDir, code);
+
+            size_t size = 0U;
+            CachedBody body;
+            if (file_size(path, size))
+            {
+                auto buf = std::make_shared<std::vector<char>>(size);
+                if (read_file_exact(path, size, buf->data()))
+                {
+                    body = std::move(buf);
+                }
+            }
+
+            if (!lock_mutex())
+            {
+                return;
+            }
+
+            init_error_pages_locked();
+            ErrorPage &slot = s_error_pages[error_slot(code)];
+            if (!slot.from_app)
+            {
+                slot = (body != nullptr)
+                           ? ErrorPage{body->data(), body->size(), kErrorCtypeHtml, body, false}
+                           : canned_error_page(code);
+            }
+            unlock_mutex();
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    // Open-file handle cache guarded by s_mutex.
+    //
+    // Opening a LittleFS file walks its directory metadata. Files streamed
+    // from flash (too large for the content cache) keep their descriptor in
+    // a small LRU of kOpenFiles slots, so repeat and concurrent requests for
+    // the same media file share one handle. A slot holds one reference;
+    // every reader holds another, so evicting or invalidating a slot never
+    // closes a file under a transfer that is still reading it.
+    // -------------------------------------------------------------------------
+
+    struct OpenFileSlot
+    {
+        std::string path;
+        FileRef file;
+        TickType_t last_use;
+    };
+
+    static constexpr size_t kOpenFiles = CONFIG_HTTP_SERVER_OPEN_FILES;
+
+    static std::vector<OpenFileSlot> s_open_files;
+
+    /**
+     * Return a shared handle for full_path, opening it on a miss. The handle
+     * is cached unless the filesystem changed while it was being opened.
+     */
+    static FileRef open_shared_file(const std::string &full_path)
+    {
+        uint32_t generation = 0U;
+        if (kOpenFiles > 0U && lock_mutex())
+        {
+            generation = s_fs_generation;
+            for (OpenFileSlot &slot : s_open_files)
+            {
+                if (slot.path == full_path)
+                {
+                    slot.last_use = xTaskGetTickCount();
+                    FileRef f = slot.file;
+                    unlock_mutex();
+                    s_counters.open_file_hits.fetch_add(1U, std::memory_order_relaxed);
+                    return f;
+                }
+            }
+            unlock_mutex();
+        }
+        s_counters.open_file_misses.fetch_add(1U, std::memory_order_relaxed);
+
+        const int fd = open(full_path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+
+        struct stat st{};
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            return nullptr;
+        }
+
+        auto f = std::make_shared<const OpenFile>(fd, static_cast<size_t>(st.st_size));
+
+        // Dropped only after the lock is released, since it may close a file.
+        FileRef evicted;
+        if (kOpenFiles > 0U && !s_mem_degraded.load(std::memory_order_relaxed) && lock_mutex())
+        {
+            const bool present = std::any_of(s_open_files.begin(), s_open_files.end(),
+                                             [&](const OpenFileSlot &slot)
+                                             { return slot.path == full_path; });
+
+            if (generation == s_fs_generation && !present)
+            {
+                if (s_open_files.size() >= kOpenFiles)
+                {
+                    auto lru = std::min_element(s_open_files.begin(), s_open_files.end(),
+                                                [](const OpenFileSlot &a, const OpenFileSlot &b)
+                                                { return a.last_use < b.last_use; });
+                    evicted = std::move(lru->file);
+                    s_open_files.erase(lru);
+                }
+                s_open_files.push_back(OpenFileSlot{full_path, f, xTaskGetTickCount()});
+            }
+            unlock_mutex();
+        }
+
+        return f;
+    }
+
+    static void invalidate_fs_caches()
+    {
+        // Closed after the lock is released.
+        std::vector<OpenFileSlot> open_files;
+
+        if (!lock_mutex())
+        {
+            return;
+        }
+
+        open_files.swap(s_open_files);
+        s_index.clear();
+        s_cache.clear();
+        s_cache_bytes = 0U;
+        ++s_fs_generation;
+        s_counters.cache_bytes.store(0U, std::memory_order_relaxed);
+        s_preload.clear();
+        s_preload_loaded = false;
+        unlock_mutex();
+    }
+
+    /**
+     * Release the RAM held by file bodies and open handles. Unlike
+     * invalidate_fs_caches() the files are unchanged, so the index, the
+     * preload manifest and the hit counts stay valid and are kept.
+     */
+    static void shed_fs_caches()
+    {
+        // Closed after the lock is released.
+        std::vector<OpenFileSlot> open_files;
+
+        if (!lock_mutex())
+        {
+            return;
+        }
+
+        open_files.swap(s_open_files);
+        s_cache.clear();
+        s_cache_bytes = 0U;
+        s_counters.cache_bytes.store(0U, std::memory_order_relaxed);
+        unlock_mutex();
+    }
+
+    static std::string hot_list_path()
+    {
+        std::string p(kFsBase);
+        p += kHotListFile;
+        return p;
+    }
+
+    /**
+     * Write the top kHotListSize paths by hit count, one per line. Runs on
+     * the worker task. The file is replaced atomically via rename().
+     */
+    static void persist_hot_list()
+    {
+        if (kHotListSize == 0U || !s_fs_mounted)
+        {
+            return;
+        }
+
+        std::vector<std::pair<uint32_t, std::string>> ranked;
+
+        if (!lock_mutex())
+        {
+            return;
+        }
+
+        if (!s_hits_dirty)
+        {
+            unlock_mutex();
+            return;
+        }
+
+        ranked.reserve(s_hit_counts.size());
+        for (const auto &kv : s_hit_counts)
+        {
+            ranked.emplace_back(kv.second, kv.first);
+        }
+        s_hits_dirty = false;
+        unlock_mutex();
+
+        const size_t n = std::min(ranked.size(), kHotListSize);
+        std::partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(),
+                          [](const auto &a, const auto &b)
+                          { return a.first > b.first; });
+
+        const std::string final_path = hot_list_path();
+        const std::string tmp_path = final_path + ".tmp";
+
+        FILE *f = std::fopen(tmp_path.c_str(), "w");
+        if (f == nullptr)
+        {
+            ESP_LOGW(TAG, "Hot list write failed (errno=%d).", errno);
+            return;
+        }
+
+        bool ok = true;
+        for (size_t i = 0U; i < n && ok; ++i)
+        {
+            ok = std::fprintf(f, "%s\n", ranked[i].second.c_str()) > 0;
+        }
+        ok = (std::fclose(f) == 0) && ok;
+
+        if (!ok || std::rename(tmp_path.c_str(), final_path.c_str()) != 0)
+        {
+            ESP_LOGW(TAG, "Hot list write failed (errno=%d).", errno);
+            (void)std::remove(tmp_path.c_str());
+        }
+    }
+
+    /**
+     * Load the persisted hot list into the index and content cache. Runs on
+     * the worker task once the server is RUNNING.
+     */
+    static void prewarm_from_hot_list()
+    {
+        if (!s_fs_mounted)
+        {
+            return;
+        }
+
+        load_preload_manifest();
+        load_error_pages();
+
+        if (kHotListSize == 0U)
+        {
+            return;
+        }
+
+        FILE *f = std::fopen(hot_list_path().c_str(), "r");
+        if (f == nullptr)
+        {
+            return;
+        }
+
+        char line[HTTPD_MAX_URI_LEN + 2];
+        size_t loaded = 0U;
+        while (loaded < kHotListSize && std::fgets(line, sizeof(line), f) != nullptr)
+        {
+            std::string_view path(line);
+            while (!path.empty() && (path.back() == '\n' || path.back() == '\r'))
+            {
+                path.remove_suffix(1);
+            }
+
+            // Not a client request: counting it would make every boot
+            // rewrite the hot list.
+            IndexEntry e{};
+            if (!lookup_fs_path(path, e, false))
+            {
+                continue;
+            }
+
+            (void)cache_load(e.full_path, e.size);
+            ++loaded;
+        }
+        std::fclose(f);
+
+        s_counters.prewarmed.store(static_cast<uint32_t>(loaded), std::memory_order_relaxed);
+        ESP_LOGI(TAG, "Prewarmed %u hot assets.", static_cast<unsigned>(loaded));
+    }
+
+    /**
+     * Send a shared file as chunks, without the terminating chunk.
+     */
+    static esp_err_t send_file_chunks(httpd_req_t *req, const OpenFile &f)
+    {
+        char buf[1024];
+        size_t offset = 0U;
+        while (offset < f.size)
+        {
+            const ssize_t n = pread(f.fd, buf, sizeof(buf), static_cast<off_t>(offset));
+            if (n <= 0)
+            {
+                return (n == 0) ? ESP_OK : ESP_FAIL;
+            }
+
+            const esp_err_t rc = httpd_resp_send_chunk(req, buf, n);
+            if (rc != ESP_OK)
+            {
+                return rc;
+            }
+            offset += static_cast<size_t>(n);
+        }
+        return ESP_OK;
+    }
+
+    /**
+     * ETag for e, or an empty string for NO_STORE entries, which are never
+     * revalidated.
+     */
+    static void file_etag(const IndexEntry &e, char (&out)[24])
+    {
+        out[0] = '\0';
+        if (e.cache != http_srv::CachePolicy::NO_STORE)
+        {
+            format_etag(e.tag, out);
+        }
+    }
+
+    /**
+     * Answer with 304 if the request's If-None-Match names etag. Returns
+     * ESP_ERR_NOT_FOUND, having sent nothing, if the client needs the body.
+     */
+    static esp_err_t send_not_modified(httpd_req_t *req,
+                                       const char *etag,
+                                       http_srv::CachePolicy cache,
+                                       bool vary_accept)
+    {
+        if (etag[0] == '\0' || !etag_matches(req, etag))
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+
+        set_cache_headers(req, cache, vary_accept);
+        (void)httpd_resp_set_hdr(req, "ETag", etag);
+        httpd_resp_set_status(req, status_for(304));
+        return httpd_resp_send(req, nullptr, 0);
+    }
+
+    /**
+     * Hand a shared file, followed by any files in more, over to the worker
+     * task. On success the request has been detached and the transfer holds
+     * its own references to the files. On failure nothing has been changed
+     * and the caller should send the files inline.
+     */
+    static esp_err_t start_transfer(httpd_req_t *req,
+                                    const FileRef &f,
+                                    const IndexEntry &e,
+                                    const std::string &link,
+                                    const std::vector<FileRef> &more = {})
+    {
+        const uint32_t max_transfers = tuning().max_transfers;
+        if (max_transfers == 0U)
+        {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+
+        if (!transfer_slot_free(max_transfers))
+        {
+            return ESP_ERR_NO_MEM;
+        }
+
+        Transfer *t = new_transfer(req, f, e.ctype, link);
+        if (t == nullptr)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        t->more = more;
+
+        char etag[24];
+        file_etag(e, etag);
+        t->etag = etag;
+
+        httpd_req_t *copy = nullptr;
+        const esp_err_t rc = httpd_req_async_handler_begin(req, &copy);
+        if (rc != ESP_OK)
+        {
+            delete t;
+            return rc;
+        }
+
+        t->req = copy;
+        pin_session(t->sockfd);
+        s_counters.transfers_active.fetch_add(1U, std::memory_order_relaxed);
+        s_counters.transfers_started.fetch_add(1U, std::memory_order_relaxed);
+
+        httpd_resp_set_type(copy, t->ctype.c_str());
+        if (e.is_gz)
+        {
+            (void)httpd_resp_set_hdr(copy, "Content-Encoding", "gzip");
+        }
+        if (!t->link.empty())
+        {
+            (void)httpd_resp_set_hdr(copy, "Link", t->link.c_str());
+        }
+        if (!t->etag.empty())
+        {
+            (void)httpd_resp_set_hdr(copy, "ETag", t->etag.c_str());
+        }
+        set_cache_headers(copy, e.cache, has_image_variants(e));
+
+        queue_transfer(t);
+        return ESP_OK;
+    }
+
+    static esp_err_t send_file_stream(httpd_req_t *req,
+                                      const IndexEntry &e,
+                                      const std::string &link)
+    {
+        const FileRef f = open_shared_file(e.full_path);
+        if (f == nullptr)
+        {
+            ESP_LOGW(TAG,
+                     "File open failed: %s (errno=%d).",
+                     e.full_path.c_str(),
+                     errno);
+
+            return send_error(req, 500);
+        }
+
+        if (f->size > tuning().transfer_threshold)
+        {
+            if (start_transfer(req, f, e, link) == ESP_OK)
+            {
+                return ESP_OK;
+            }
+            s_counters.transfers_inline.fetch_add(1U, std::memory_order_relaxed);
+        }
+
+        httpd_resp_set_type(req, e.ctype.c_str());
+        if (e.is_gz)
+        {
+            (void)httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        }
+        if (!link.empty())
+        {
+            (void)httpd_resp_set_hdr(req, "Link", link.c_str());
+        }
+
+        char etag[24];
+        file_etag(e, etag);
+        if (etag[0] != '\0')
+        {
+            (void)httpd_resp_set_hdr(req, "ETag", etag);
+        }
+        set_cache_headers(req, e.cache, has_image_variants(e));
+
+        const esp_err_t rc = send_file_chunks(req, *f);
+        if (rc != ESP_OK)
+        {
+            return rc;
+        }
+
+        return httpd_resp_send_chunk(req, nullptr, 0);
+    }
+
+#if CONFIG_HTTP_SERVER_ENABLE_COMBO
+    // -------------------------------------------------------------------------
+    // Combo endpoint: GET /combo?css/a.css&css/b.css
+    //
+    // Concatenates several static assets into one response so an unbundled UI
+    // needs one connection slot instead of one per file. All parts must share
+    // a content type and encoding. Concatenated .gz files form a valid
+    // multi-member gzip stream. Results small enough for the content cache are
+    // cached under the query string.
+    // -------------------------------------------------------------------------
+
+    static constexpr size_t kComboMaxParts = CONFIG_HTTP_SERVER_COMBO_MAX_PARTS;
+
+    static esp_err_t handle_combo(httpd_req_t *req)
+    {
+        if (ensure_fs_mounted() != ESP_OK)
+        {
+            return send_error(req, 404);
+        }
+
+        const size_t qlen = httpd_req_get_url_query_len(req);
+        if (qlen == 0U || qlen > HTTPD_MAX_URI_LEN)
+        {
+            return send_error(req, 400);
+        }
+
+        std::string query(qlen + 1U, '\0');
+        if (httpd_req_get_url_query_str(req, query.data(), query.size()) != ESP_OK)
+        {
+            return send_error(req, 400);
+        }
+        query.resize(qlen);
+
+        std::vector<IndexEntry> parts;
+        std::string_view rest(query);
+        size_t total = 0U;
+
+        while (!rest.empty())
+        {
+            const size_t amp = std::min(rest.find('&'), rest.size());
+            std::string_view item = rest.substr(0, amp);
+            rest.remove_prefix(std::min(amp + 1U, rest.size()));
+
+            if (item.empty())
+            {
+                continue;
+            }
+
+            if (parts.size() == kComboMaxParts)
+            {
+                return send_error(req, 400);
+            }
+
+            std::string path;
+            if (item.front() != '/')
+            {
+                path += '/';
+            }
+            path += item;
+
+            IndexEntry e{};
+            if (!lookup_fs_path(path, e))
+            {
+                return send_error(req, 404);
+            }
+
+            if (!parts.empty() &&
+                (e.ctype != parts.front().ctype || e.is_gz != parts.front().is_gz))
+            {
+                return send_error(req, 415);
+            }
+
+            total += e.size;
+            parts.push_back(std::move(e));
+        }
+
+        if (parts.empty())
+        {
+            return send_error(req, 400);
+        }
+
+        const IndexEntry &first = parts.front();
+
+        // A combined body is only as cacheable as its least cacheable part,
+        // and changes whenever any part does.
+        http_srv::CachePolicy cache = first.cache;
+        std::vector<uint64_t> tags;
+        tags.reserve(parts.size());
+        for (const IndexEntry &e : parts)
+        {
+            cache = std::min(cache, e.cache);
+            tags.push_back(e.tag);
+        }
+
+        IndexEntry head = first;
+        head.cache = cache;
+        head.tag = fnv1a64(tags.data(), tags.size() * sizeof(uint64_t));
+        std::fill(std::begin(head.variant_size), std::end(head.variant_size), 0U);
+
+        char etag[24];
+        file_etag(head, etag);
+        const esp_err_t nm = send_not_modified(req, etag, cache, false);
+        if (nm != ESP_ERR_NOT_FOUND)
+        {
+            return nm;
+        }
+
+        httpd_resp_set_type(req, first.ctype.c_str());
+        if (first.is_gz)
+        {
+            (void)httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        }
+        if (etag[0] != '\0')
+        {
+            (void)httpd_resp_set_hdr(req, "ETag", etag);
+        }
+        set_cache_headers(req, cache);
+
+        const std::string key = "combo:" + query;
+        CachedBody body = cache_get(key);
+
+        const http_srv::Tuning cfg = tuning();
+        if (body == nullptr && total <= cfg.cache_bytes && total <= cfg.cache_max_entry_bytes)
+        {
+            const uint32_t generation = fs_generation();
+
+            auto built = std::make_shared<std::vector<char>>(total);
+            size_t off = 0U;
+            bool ok = true;
+            for (const auto &p : parts)
+            {
+                ok = read_file_exact(p.full_path, p.size, built->data() + off);
+                if (!ok)
+                {
+                    break;
+                }
+                off += p.size;
+            }
+
+            if (ok)
+            {
+                body = cache_put(key, std::move(built), generation);
+            }
+        }
+
+        if (body != nullptr)
+        {
+            return httpd_resp_send(req, body->data(), static_cast<ssize_t>(body->size()));
+        }
+
+        // Open every part before anything is sent, so a missing part still
+        // gets a proper error response.
+        std::vector<FileRef> files;
+        files.reserve(parts.size());
+        for (const auto &p : parts)
+        {
+            FileRef f = open_shared_file(p.full_path);
+            if (f == nullptr)
+            {
+                ESP_LOGW(TAG, "File open failed: %s (errno=%d).", p.full_path.c_str(), errno);
+                return send_error(req, 500);
+            }
+            files.push_back(std::move(f));
+        }
+
+        if (total > cfg.transfer_threshold)
+        {
+            // Headers as set above, for the detached copy.
+            const std::vector<FileRef> more(files.begin() + 1, files.end());
+            if (start_transfer(req, files.front(), head, std::string(), more) == ESP_OK)
+            {
+                return ESP_OK;
+            }
+            s_counters.transfers_inline.fetch_add(1U, std::memory_order_relaxed);
+        }
+
+        for (const FileRef &f : files)
+        {
+            const esp_err_t rc = send_file_chunks(req, *f);
+            if (rc != ESP_OK)
+            {
+                return rc;
+            }
+        }
+
+        return httpd_resp_send_chunk(req, nullptr, 0);
+    }
+#endif
+
+#if CONFIG_HTTP_SERVER_ENABLE_TAIL
+    // -------------------------------------------------------------------------
+    // Log tail: GET <TAIL_URI>/<file>?lines=50 | ?bytes=4096 [&follow=1]
+    //
+    // The tail is found by reading backwards from the end of the file in
+    // kTailBlock steps, so the cost depends on the size of the tail, not of
+    // the file. With follow=1 the session is detached like a background
+    // transfer and a one-shot worker timer, re-armed while anyone follows,
+    // sends only the bytes appended since the last poll. Clients that accept
+    // text/event-stream get complete lines framed as SSE events; others get a
+    // raw chunked stream. A file that shrinks is taken as rotated and followed
+    // from its start. Followers are sent to without blocking, like transfers,
+    // so one that stops reading does not stall the worker.
+    //
+    // New followers are queued in s_followers_pending (guarded by s_mutex).
+    // The worker moves them into s_followers, which only it touches.
+    // -------------------------------------------------------------------------
+
+    struct Follower
+    {
+        httpd_req_t *req; // Async copy; owned until finish_follower().
+        std::string path;
+        long offset;
+        int sockfd;
+        bool sse;
+        TickType_t last_send;
+        SendBacklog backlog; // Bytes the socket has not taken yet; see s_nb_fd.
+    };
+
+    static constexpr size_t kTailMaxBytes = CONFIG_HTTP_SERVER_TAIL_MAX_BYTES;
+    static constexpr uint32_t kTailMaxFollowers = CONFIG_HTTP_SERVER_TAIL_MAX_FOLLOWERS;
+    static constexpr uint32_t kTailPollMs = CONFIG_HTTP_SERVER_TAIL_POLL_MS;
+    static constexpr size_t kTailBlock = 512U;
+    static constexpr uint32_t kTailDefaultLines = 50U;
+    static constexpr TickType_t kSseKeepAlive = pdMS_TO_TICKS(15000);
+
+    static std::vector<Follower *> s_followers_pending;
+    static std::vector<Follower *> s_followers;
+    static std::atomic<uint32_t> s_followers_count{0};
+    static std::atomic<bool> s_follow_armed{false};
+
+    static void poll_followers(void *);
+
+    /**
+     * Offset of the first of the last `lines` lines, reading backwards from
+     * `size` and never further back than kTailMaxBytes. Returns -1 on error.
+     */
+    static long tail_start_for_lines(FILE *f, long size, uint32_t lines)
+    {
+        const long limit = (size > static_cast<long>(kTailMaxBytes))
+                               ? size - static_cast<long>(kTailMaxBytes)
+                               : 0;
+        char buf[kTailBlock];
+        uint32_t seen = 0U;
+        long pos = size;
+
+        if (lines == 0U)
+        {
+            return size;
+        }
+
+        while (pos > limit)
+        {
+            const size_t n = std::min(kTailBlock, static_cast<size_t>(pos - limit));
+            pos -= static_cast<long>(n);
+
+            if (std::fseek(f, pos, SEEK_SET) != 0 || std::fread(buf, 1, n, f) != n)
+            {
+                return -1;
+            }
+
+            for (size_t i = n; i-- > 0U;)
+            {
+                // The newline ending the last line does not start a new one.
+                if (buf[i] != '\n' || pos + static_cast<long>(i) == size - 1)
+                {
+                    continue;
+                }
+
+                if (++seen == lines)
+                {
+                    return pos + static_cast<long>(i) + 1;
+                }
+            }
+        }
+
+        return limit;
+    }
+
+    static bool read_range(FILE *f, long start, size_t len, std::string &out)
+    {
+        out.resize(len);
+        if (len == 0U)
+        {
+            return true;
+        }
+
+        return std::fseek(f, start, SEEK_SET) == 0 &&
+               std::fread(out.data(), 1, len, f) == len;
+    }
+
+    /**
+     * Frame the complete lines of `data` as one SSE event. Returns the number
+     * of bytes consumed; a trailing partial line is left for the next poll
+     * unless `flush` is set.
+     */
+    static size_t frame_sse(std::string_view data, bool flush, std::string &out)
+    {
+        size_t consumed = flush ? data.size() : data.rfind('\n');
+        if (consumed == std::string_view::npos)
+        {
+            return 0U;
+        }
+        if (!flush)
+        {
+            ++consumed;
+        }
+
+        std::string_view rest = data.substr(0, consumed);
+        out.clear();
+        while (!rest.empty())
+        {
+            const size_t nl = std::min(rest.find('\n'), rest.size());
+            std::string_view line = rest.substr(0, nl);
+            rest.remove_prefix(std::min(nl + 1U, rest.size()));
+
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.remove_suffix(1U);
+            }
+
+            out += "data: ";
+            out += line;
+            out += '\n';
+        }
+
+        if (!out.empty())
+        {
+            out += '\n';
+        }
+        return consumed;
+    }
+
+    /**
+     * Send data appended to a followed file. Returns false if the client is
+     * gone.
+     */
+    static bool send_follow_data(Follower *fw, std::string_view data, bool flush)
+    {
+        if (!fw->sse)
+        {
+            fw->offset += static_cast<long>(data.size());
+            return data.empty() ||
+                   httpd_resp_send_chunk(fw->req, data.data(),
+                                         static_cast<ssize_t>(data.size())) == ESP_OK;
+        }
+
+        std::string framed;
+        const size_t consumed = frame_sse(data, flush, framed);
+        fw->offset += static_cast<long>(consumed);
+        return framed.empty() ||
+               httpd_resp_send_chunk(fw->req, framed.data(),
+                                     static_cast<ssize_t>(framed.size())) == ESP_OK;
+    }
+
+    static void finish_follower(Follower *fw)
+    {
+        httpd_handle_t hd = fw->req->handle;
+        (void)httpd_req_async_handler_complete(fw->req);
+        unpin_session(fw->sockfd);
+
+        // A follow stream has no natural end; the connection goes with it.
+        (void)httpd_sess_trigger_close(hd, fw->sockfd);
+
+        s_followers_count.fetch_sub(1U, std::memory_order_relaxed);
+        delete fw;
+    }
+
+    static void arm_follow_timer()
+    {
+        if (!s_follow_armed.exchange(true) &&
+            timer_schedule(kTailPollMs, 0U, poll_followers, nullptr) == 0U)
+        {
+            s_follow_armed.store(false);
+        }
+    }
+
+    /**
+     * Send what was appended to fw's file since the last poll, or an SSE
+     * keep-alive. Returns false if the client is gone.
+     */
+    static bool step_follower(Follower *fw, TickType_t now, size_t cap, std::string &data)
+    {
+        struct stat st{};
+        if (stat(fw->path.c_str(), &st) != 0)
+        {
+            return true;
+        }
+
+        if (st.st_size < fw->offset)
+        {
+            fw->offset = 0;
+        }
+
+        bool ok = true;
+        const size_t avail = static_cast<size_t>(st.st_size - fw->offset);
+        if (avail > 0U)
+        {
+            // A file that cannot be read right now is retried on the next
+            // poll.
+            const size_t n = std::min(avail, cap);
+            FILE *f = std::fopen(fw->path.c_str(), "rb");
+            if (f != nullptr)
+            {
+                if (read_range(f, fw->offset, n, data))
+                {
+                    ok = send_follow_data(fw, data, n == cap);
+                }
+                std::fclose(f);
+            }
+            fw->last_send = now;
+        }
+        else if (fw->sse && now - fw->last_send >= kSseKeepAlive)
+        {
+            ok = httpd_resp_send_chunk(fw->req, ":\n\n", 3) == ESP_OK;
+            fw->last_send = now;
+        }
+        return ok;
+    }
+
+    /**
+     * Poll followed files. One-shot timer callback on the worker task.
+     * Sends never block (see s_nb_fd), so a follower that stops reading
+     * holds up nobody else.
+     */
+    static void poll_followers(void *)
+    {
+        s_follow_armed.store(false);
+
+        if (lock_mutex())
+        {
+            s_followers.insert(s_followers.end(),
+                               s_followers_pending.begin(),
+                               s_followers_pending.end());
+            s_followers_pending.clear();
+            unlock_mutex();
+        }
+
+        const TickType_t now = xTaskGetTickCount();
+        const size_t cap = std::min<size_t>(tuning().transfer_chunk_size, kTransferChunkSize);
+        std::string data;
+
+        for (size_t i = 0U; i < s_followers.size();)
+        {
+            Follower *fw = s_followers[i];
+            bool ok = client_connected(fw->sockfd) &&
+                      flush_send_backlog(fw->sockfd, fw->backlog);
+
+            // A client still holding back the last poll's data gets nothing
+            // new until it has taken it.
+            if (ok && fw->backlog.data.empty())
+            {
+                begin_nb_send(fw->sockfd, fw->backlog);
+                ok = step_follower(fw, now, cap, data);
+                end_nb_send();
+            }
+
+            if (!ok)
+            {
+                finish_follower(fw);
+                s_followers.erase(s_followers.begin() + static_cast<std::ptrdiff_t>(i));
+                continue;
+            }
+            ++i;
+        }
+
+        if (!s_followers.empty())
+        {
+            arm_follow_timer();
+        }
+    }
+
+    static void abort_all_followers()
+    {
+        if (lock_mutex())
+        {
+            s_followers.insert(s_followers.end(),
+                               s_followers_pending.begin(),
+                               s_followers_pending.end());
+            s_followers_pending.clear();
+            unlock_mutex();
+        }
+
+        for (Follower *fw : s_followers)
+        {
+            finish_follower(fw);
+        }
+        s_followers.clear();
+    }
+    static bool accepts_event_stream(httpd_req_t *req)
+    {
+        char accept[128];
+        return httpd_req_get_hdr_value_str(req, "Accept", accept, sizeof(accept)) == ESP_OK &&
+               std::strstr(accept, "text/event-stream") != nullptr;
+    }
+
+    static esp_err_t handle_tail(httpd_req_t *req)
+    {
+        if (ensure_fs_mounted() != ESP_OK)
+        {
+            return send_error(req, 404);
+        }
+
+        std::string_view rel = uri_path(req->uri);
+        rel.remove_prefix(std::min(rel.size(), std::strlen(CONFIG_HTTP_SERVER_TAIL_URI)));
+        if (rel.size() < 2U || rel.front() != '/' || has_dotdot(rel))
+        {
+            return send_error(req, 404);
+        }
+
+        std::string path(kFsBase);
+        path += CONFIG_HTTP_SERVER_TAIL_DIR;
+        path += rel;
+
+        std::string query;
+        const size_t qlen = httpd_req_get_url_query_len(req);
+        if (qlen > 0U && qlen <= HTTPD_MAX_URI_LEN)
+        {
+            query.assign(qlen + 1U, '\0');
+            if (httpd_req_get_url_query_str(req, query.data(), query.size()) != ESP_OK)
+            {
+                query.clear();
+            }
+        }
+        const char *q = query.empty() ? nullptr : query.c_str();
+
+        const bool follow = query_u32(q, "follow", 0U) != 0U;
+        const uint32_t bytes = query_u32(q, "bytes", 0U);
+        const uint32_t lines = query_u32(q, "lines", kTailDefaultLines);
+
+        FILE *f = std::fopen(path.c_str(), "rb");
+        if (f == nullptr)
+        {
+            return send_error(req, 404);
+        }
+
+        long size = -1;
+        if (std::fseek(f, 0, SEEK_END) == 0)
+        {
+            size = std::ftell(f);
+        }
+
+        long start = -1;
+        if (size >= 0)
+        {
+            start = (bytes > 0U)
+                        ? size - static_cast<long>(std::min<size_t>({bytes, kTailMaxBytes,
+                                                                     static_cast<size_t>(size)}))
+                        : tail_start_for_lines(f, size, lines);
+        }
+
+        std::string body;
+        const bool read_ok =
+            start >= 0 && read_range(f, start, static_cast<size_t>(size - start), body);
+        std::fclose(f);
+
+        if (!read_ok)
+        {
+            return send_error(req, 500);
+        }
+
+        if (!follow)
+        {
+            httpd_resp_set_type(req, "text/plain; charset=utf-8");
+            set_cache_headers(req, http_srv::CachePolicy::NO_STORE);
+            return httpd_resp_send(req, body.data(), static_cast<ssize_t>(body.size()));
+        }
+
+        if (!lock_mutex())
+        {
+            return send_error(req, 500);
+        }
+        const bool have_worker = s_task != nullptr && !s_task_exit;
+        unlock_mutex();
+
+        if (!have_worker ||
+            s_followers_count.fetch_add(1U, std::memory_order_relaxed) >= kTailMaxFollowers)
+        {
+            if (have_worker)
+            {
+                s_followers_count.fetch_sub(1U, std::memory_order_relaxed);
+            }
+            return send_error(req, 503);
+        }
+
+        auto *fw = new (std::nothrow)
+            Follower{nullptr, std::move(path), start, httpd_req_to_sockfd(req),
+                     accepts_event_stream(req), xTaskGetTickCount(), SendBacklog{}};
+        httpd_req_t *copy = nullptr;
+        if (fw == nullptr || httpd_req_async_handler_begin(req, &copy) != ESP_OK)
+        {
+            delete fw;
+            s_followers_count.fetch_sub(1U, std::memory_order_relaxed);
+            return send_error(req, 500);
+        }
+
+        fw->req = copy;
+        pin_session(fw->sockfd);
+
+        httpd_resp_set_type(copy, fw->sse ? "text/event-stream" : "text/plain; charset=utf-8");
+        set_cache_headers(copy, http_srv::CachePolicy::NO_STORE);
+
+        if (!send_follow_data(fw, body, false) ||
+            (fw->sse && httpd_resp_send_chunk(copy, ":\n\n", 3) != ESP_OK))
+        {
+            finish_follower(fw);
+            return ESP_OK;
+        }
+
+        if (!lock_mutex())
+        {
+            finish_follower(fw);
+            return ESP_OK;
+        }
+        s_followers_pending.push_back(fw);
+        unlock_mutex();
+
+        arm_follow_timer();
+        return ESP_OK;
+    }
+#endif
+
+#if CONFIG_HTTP_SERVER_ENABLE_UPLOAD
+    // -------------------------------------------------------------------------
+    // Resumable uploads: PUT <UPLOAD_URI>/<path>
+    //
+    // Bytes are appended to a partial file in kUploadPartDir, named after a
+    // hash of the target path and the announced total size, and the finished
+    // file is moved into place with a single rename(), so readers never see a
+    // half-written asset. An upload that announces a different total never
+    // continues an older partial: it finds nothing received and is answered
+    // with 409 until it starts again from byte 0. A PUT
+    // with "Content-Range: bytes <first>-<last>/<total>" continues a partial
+    // upload; one with "Content-Range: bytes */<total>" and no body asks how
+    // far it got. Incomplete uploads are answered with
+    // "308 Resume Incomplete" and "Range: bytes=0-<last received>", the
+    // convention used by common resumable-upload clients. A PUT without
+    // Content-Range uploads the whole file in one request.
+    //
+    // Partial files untouched for kUploadPartialTtlS are removed by a worker
+    // timer. All handlers run on the httpd task, so uploads need no locking.
+    // -------------------------------------------------------------------------
+
+    static constexpr size_t kUploadMaxBytes = CONFIG_HTTP_SERVER_UPLOAD_MAX_BYTES;
+    static constexpr size_t kMemDegradedUploadMax = CONFIG_HTTP_SERVER_MEM_DEGRADED_UPLOAD_MAX;
+    static constexpr uint32_t kUploadPartialTtlS = CONFIG_HTTP_SERVER_UPLOAD_PARTIAL_TTL_S;
+    static constexpr uint32_t kUploadSweepMs = 60U * 1000U;
+    static constexpr size_t kUploadBufSize = 2048U;
+    static constexpr int kUploadRecvRetries = 3;
+
+    struct ContentRange
+    {
+        bool query; // "bytes */<total>": status request.
+        size_t first;
+        size_t last;
+        size_t total;
+    };
+
+    static bool parse_content_range(const char *v, ContentRange &out)
+    {
+        out = ContentRange{};
+        if (std::strncmp(v, "bytes ", 6) != 0)
+        {
+            return false;
+        }
+
+        const char *p = v + 6;
+        char *end = nullptr;
+
+        if (*p == '*')
+        {
+            out.query = true;
+            ++p;
+        }
+        else
+        {
+            out.first = std::strtoul(p, &end, 10);
+            if (end == p || *end != '-')
+            {
+                return false;
+            }
+            p = end + 1;
+
+            out.last = std::strtoul(p, &end, 10);
+            if (end == p || out.last < out.first)
+            {
+                return false;
+            }
+            p = end;
+        }
+
+        if (*p != '/')
+        {
+            return false;
+        }
+        ++p;
+
+        out.total = std::strtoul(p, &end, 10);
+        if (end == p || *end != '\0')
+        {
+            return false;
+        }
+
+        return out.query || out.last < out.total;
+    }
+
+    static std::string upload_part_path(std::string_view logical, size_t total)
+    {
+        // Collisions only matter between concurrent uploads.
+        const uint64_t h = fnv1a64(logical.data(), logical.size());
+
+        char name[40];
+        std::snprintf(name, sizeof(name), "/%016llx-%u.part",
+                      static_cast<unsigned long long>(h), static_cast<unsigned>(total));
+
+        std::string path(kFsBase);
+        path += kUploadPartDir;
+        path += name;
+        return path;
+    }
+
+    /**
+     * Create the directories leading up to full_path. Existing ones are fine.
+     */
+    static void make_parent_dirs(const std::string &full_path)
+    {
+        for (size_t pos = std::strlen(kFsBase) + 1U;
+             (pos = full_path.find('/', pos)) != std::string::npos;
+             ++pos)
+        {
+            (void)mkdir(full_path.substr(0, pos).c_str(), 0775);
+        }
+    }
+
+    static esp_err_t send_upload_status(httpd_req_t *req, int code, size_t received)
+    {
+        char range[40];
+        char offset[24];
+
+        httpd_resp_set_status(req, (code == 308) ? "308 Resume Incomplete" : status_for(code));
+        if (received > 0U)
+        {
+            std::snprintf(range, sizeof(range), "bytes=0-%u", static_cast<unsigned>(received - 1U));
+            (void)httpd_resp_set_hdr(req, "Range", range);
+        }
+
+        std::snprintf(offset, sizeof(offset), "%u", static_cast<unsigned>(received));
+        (void)httpd_resp_set_hdr(req, "Upload-Offset", offset);
+        set_cache_headers(req, http_srv::CachePolicy::NO_STORE);
+
+        return httpd_resp_send(req, nullptr, 0);
+    }
+
+    /**
+     * Append the request body to f. Returns ESP_FAIL if the client went away
+     * (the partial file is kept for a retry) and ESP_ERR_NO_MEM if the data
+     * could not be stored.
+     */
+    static esp_err_t receive_body(httpd_req_t *req, FILE *f, size_t len)
+    {
+        std::vector<char> buf(std::min(kUploadBufSize, std::max<size_t>(len, 1U)));
+        int retries = kUploadRecvRetries;
+
+        while (len > 0U)
+        {
+            const int n = httpd_req_recv(req, buf.data(), std::min(buf.size(), len));
+            if (n == HTTPD_SOCK_ERR_TIMEOUT && retries-- > 0)
+            {
+                continue;
+            }
+
+            if (n <= 0)
+            {
+                return ESP_FAIL;
+            }
+
+            if (std::fwrite(buf.data(), 1, static_cast<size_t>(n), f) != static_cast<size_t>(n))
+            {
+                return ESP_ERR_NO_MEM;
+            }
+
+            len -= static_cast<size_t>(n);
+            retries = kUploadRecvRetries;
+        }
+
+        return ESP_OK;
+    }
+
+    static esp_err_t handle_upload(httpd_req_t *req)
+    {
+        if (ensure_fs_mounted() != ESP_OK)
+        {
+            return send_error(req, 503);
+        }
+
+        std::string_view rel = uri_path(req->uri);
+        rel.remove_prefix(std::min(rel.size(), std::strlen(CONFIG_HTTP_SERVER_UPLOAD_URI)));
+        if (rel.size() < 2U || rel.front() != '/' || rel.back() == '/' || has_dotdot(rel) ||
+            canonical_fs_path(rel) == "/")
+        {
+            return send_error(req, 400);
+        }
+
+        // Canonical, so a configured directory without a leading '/' still
+        // lands under the mount point and private paths cannot be dodged.
+        std::string logical(CONFIG_HTTP_SERVER_UPLOAD_DIR);
+        logical += rel;
+        logical = canonical_fs_path(logical);
+        if (is_private_fs_path(logical))
+        {
+            return send_error(req, 403);
+        }
+
+        std::string target(kFsBase);
+        target += logical;
+
+        ContentRange cr{};
+        char hdr[64];
+        if (httpd_req_get_hdr_value_str(req, "Content-Range", hdr, sizeof(hdr)) == ESP_OK)
+        {
+            if (!parse_content_range(hdr, cr))
+            {
+                return send_error(req, 400);
+            }
+        }
+        else
+        {
+            cr.total = req->content_len;
+            cr.last = (cr.total > 0U) ? cr.total - 1U : 0U;
+        }
+
+        if (cr.total > kUploadMaxBytes)
+        {
+            return send_error(req, 413);
+        }
+
+        // Under memory pressure only small bodies are taken; resumable
+        // clients continue once memory recovers.
+        if (s_mem_degraded.load(std::memory_order_relaxed) && req->content_len > kMemDegradedUploadMax)
+        {
+            (void)httpd_resp_set_hdr(req, "Retry-After", "5");
+            return send_error(req, 503);
+        }
+
+        // A partial for another total is not this upload's; the status
+        // query reports 0 and a resume gets 409 below.
+        const std::string part = upload_part_path(logical, cr.total);
+        size_t received = 0U;
+        (void)file_size(part, received);
+
+        if (cr.query)
+        {
+            return send_upload_status(req, 308, received);
+        }
+
+        const size_t len = (cr.total > 0U) ? (cr.last - cr.first + 1U) : 0U;
+        if (req->content_len != len)
+        {
+            return send_error(req, 400);
+        }
+
+        // Data may overlap what we already have (the client resends a
+        // chunk whose reply it lost) but must not leave a gap.
+        if (cr.first > received)
+        {
+            return send_upload_status(req, 409, received);
+        }
+
+        make_parent_dirs(part);
+        if (cr.first < received && truncate(part.c_str(), static_cast<off_t>(cr.first)) != 0)
+        {
+            return send_error(req, 500);
+        }
+
+        FILE *f = std::fopen(part.c_str(), (cr.first == 0U) ? "wb" : "ab");
+        if (f == nullptr)
+        {
+            return send_error(req, 500);
+        }
+
+        const esp_err_t rc = receive_body(req, f, len);
+        const bool closed = (std::fclose(f) == 0);
+
+        if (rc == ESP_FAIL)
+        {
+            // Client is gone; keep what arrived for the retry.
+            return ESP_FAIL;
+        }
+
+        if (rc != ESP_OK || !closed)
+        {
+            (void)std::remove(part.c_str());
+            return send_error(req, 500);
+        }
+
+        received = cr.first + len;
+        if (received < cr.total)
+        {
+            return send_upload_status(req, 308, received);
+        }
+
+        size_t old_size = 0U;
+        const bool replaced = file_size(target, old_size);
+
+        make_parent_dirs(target);
+        if (std::rename(part.c_str(), target.c_str()) != 0)
+        {
+            (void)std::remove(part.c_str());
+            return send_error(req, 500);
+        }
+
+        invalidate_fs_caches();
+        s_counters.uploads_completed.fetch_add(1U, std::memory_order_relaxed);
+        ESP_LOGI(TAG, "Upload complete: %s (%u bytes).", logical.c_str(), static_cast<unsigned>(received));
+
+        return send_upload_status(req, replaced ? 204 : 201, received);
+    }
+
+    /**
+     * Remove partial uploads untouched for kUploadPartialTtlS. Timer callback
+     * on the worker task. Relies on file modification times, so it needs
+     * LittleFS mtime support and a wall clock that moves forward.
+     */
+    static void sweep_partial_uploads(void *)
+    {
+        std::string dir_path(kFsBase);
+        dir_path += kUploadPartDir;
+
+        DIR *dir = opendir(dir_path.c_str());
+        if (dir == nullptr)
+        {
+            return;
+        }
+
+        const time_t now = time(nullptr);
+        std::string path;
+
+        while (const struct dirent *de = readdir(dir))
+        {
+            if (!ends_with(de->d_name, ".part"))
+            {
+                continue;
+            }
+
+            path = dir_path;
+            path += '/';
+            path += de->d_name;
+
+            struct stat st{};
+            if (stat(path.c_str(), &st) == 0 &&
+                now - st.st_mtime > static_cast<time_t>(kUploadPartialTtlS) &&
+                unlink(path.c_str()) == 0)
+            {
+                s_counters.uploads_expired.fetch_add(1U, std::memory_order_relaxed);
+                ESP_LOGI(TAG, "Removed stale partial upload %s.", de->d_name);
+            }
+        }
+
+        closedir(dir);
+    }
+#endif
+#endif
+
+    static esp_err_t try_serve_from_fs(httpd_req_t *req, std::string_view path)
+    {
+#if !CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
+        (void)req;
+        (void)path;
+        return ESP_ERR_NOT_SUPPORTED;
+#else
+        if (req == nullptr || path.empty())
+        {
+            return ESP_ERR_HTTPD_INVALID_REQ;
+        }
+
+        if (ensure_fs_mounted() != ESP_OK)
+        {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+
+        IndexEntry e{};
+        if (!lookup_fs_path(path, e))
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+
+        select_image_variant(req, e);
+
+        // Revalidation is answered from the index alone.
+        char etag[24];
+        file_etag(e, etag);
+        const esp_err_t nm = send_not_modified(req, etag, e.cache, has_image_variants(e));
+        if (nm != ESP_ERR_NOT_FOUND)
+        {
+            return nm;
+        }
+
+        std::string link;
+        if (e.ctype.compare(0, 9, "text/html") == 0)
+        {
+            link = preload_links_for(e.full_path, e.is_gz);
+        }
+
+        CachedBody body = cache_get(e.full_path);
+        if (body == nullptr)
+        {
+            body = cache_load(e.full_path, e.size);
+        }
+
+        if (body != nullptr)
+        {
+            httpd_resp_set_type(req, e.ctype.c_str());
+            if (e.is_gz)
+            {
+                (void)httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+            }
+            if (!link.empty())
+            {
+                (void)httpd_resp_set_hdr(req, "Link", link.c_str());
+            }
+            if (etag[0] != '\0')
+            {
+                (void)httpd_resp_set_hdr(req, "ETag", etag);
+            }
+            set_cache_headers(req, e.cache, has_image_variants(e));
+
+            return httpd_resp_send(req, body->data(), static_cast<ssize_t>(body->size()));
+        }
+
+        return send_file_stream(req, e, link);
+#endif
+    }
+
+    // -------------------------------------------------------------------------
+    // Memory blobs: application buffers served as-is.
+    //
+    // serve_blob() builds the ETag and header values once; each request is
+    // answered with 304 or with a single send straight from the buffer.
+    // Blobs outlive the server and are re-registered on every start. The list
+    // is guarded by s_mutex; a Blob never changes once published.
+    // -------------------------------------------------------------------------
+
+    struct Blob
+    {
+        std::string uri;
+        const uint8_t *data;
+        size_t len;
+        std::string ctype;
+        std::string encoding; // Empty for identity.
+        std::string etag;
+    };
+
+    static std::vector<std::unique_ptr<Blob>> s_blobs;
+
+    static void init_blob(Blob &b,
+                          const void *data,
+                          size_t len,
+                          const char *mime,
+                          const char *encoding)
+    {
+        char etag[24];
+        format_etag(fnv1a64(data, len), etag);
+
+        b.data = static_cast<const uint8_t *>(data);
+        b.len = len;
+        b.ctype = (mime != nullptr) ? mime : "application/octet-stream";
+        b.encoding = (encoding != nullptr) ? encoding : "";
+        b.etag = etag;
+    }
+
+    static esp_err_t send_blob(httpd_req_t *req, const Blob &b)
+    {
+        // Browsers may keep the body but must revalidate it; the ETag makes
+        // that a 304 without a body.
+        (void)httpd_resp_set_hdr(req, "Cache-Control",
+                                 kCacheControl[static_cast<size_t>(http_srv::CachePolicy::REVALIDATE)]);
+        (void)httpd_resp_set_hdr(req, "ETag", b.etag.c_str());
+
+        if (etag_matches(req, b.etag))
+        {
+            httpd_resp_set_status(req, status_for(304));
+            return httpd_resp_send(req, nullptr, 0);
+        }
+
+        httpd_resp_set_type(req, b.ctype.c_str());
+        if (!b.encoding.empty())
+        {
+            (void)httpd_resp_set_hdr(req, "Content-Encoding", b.encoding.c_str());
+            (void)httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+        }
+
+        return httpd_resp_send(req, reinterpret_cast<const char *>(b.data),
+                               static_cast<ssize_t>(b.len));
+    }
+
+    static esp_err_t handle_blob(httpd_req_t *req)
+    {
+        return send_blob(req, *static_cast<const Blob *>(req->user_ctx));
+    }
+
+    static const Blob &favicon_blob()
+    {
+        static const Blob blob = []
+        {
+            Blob b{};
+            init_blob(b, http_pages::kFaviconIco, http_pages::kFaviconIcoSize,
+                      "image/x-icon", nullptr);
+            return b;
+        }();
+        return blob;
+    }
+
+    // -------------------------------------------------------------------------
+    // HTTP handlers.
+    // -------------------------------------------------------------------------
+
+    static esp_err_t handle_root(httpd_req_t *req)
+    {
+        const esp_err_t rc = try_serve_from_fs(req, uri_path(req->uri));
+        if (rc == ESP_OK)
+        {
+            return ESP_OK;
+        }
+
+        if (rc != ESP_ERR_NOT_FOUND && rc != ESP_ERR_NOT_SUPPORTED)
+        {
+            return send_error(req, 500);
+        }
+
+        return send_template(req,
+                             http_pages::kRoot,
+                             "text/html; charset=utf-8");
+    }
+
+    static esp_err_t handle_favicon_ico(httpd_req_t *req)
+    {
+        const esp_err_t rc = try_serve_from_fs(req, uri_path(req->uri));
+        if (rc == ESP_OK)
+        {
+            return ESP_OK;
+        }
+
+        if (rc != ESP_ERR_NOT_FOUND && rc != ESP_ERR_NOT_SUPPORTED)
+        {
+            return send_error(req, 500);
+        }
+
+        return send_blob(req, favicon_blob());
+    }
+
+    static esp_err_t serve_static(httpd_req_t *req, std::string_view path)
+    {
+        if (path == "/" || path == "/index.html" || path == "/index.htm")
+        {
+            return handle_root(req);
+        }
+
+        if (path == "/favicon.ico")
+        {
+            return handle_favicon_ico(req);
+        }
+
+        const esp_err_t rc = try_serve_from_fs(req, path);
+        if (rc == ESP_OK || rc == ESP_ERR_NOT_FOUND || rc == ESP_ERR_NOT_SUPPORTED)
+        {
+            return rc;
+        }
+
+        return send_error(req, 500);
+    }
+
+    /**
+     * Registered as the HTTPD_404_NOT_FOUND handler, so it only runs for URIs
+     * without a matching URI handler. The redirect table is consulted first,
+     * then the filesystem, then the 404 error page is sent.
+     */
+    static esp_err_t handle_not_found(httpd_req_t *req, httpd_err_code_t err)
+    {
+        const std::string_view path = uri_path(req->uri);
+
+#if defined(__cpp_consteval)
+        const http_srv::RouteDispatchFn dispatch = s_route_dispatch.load(std::memory_order_acquire);
+        if (dispatch != nullptr)
+        {
+            http_srv::RouteMatch match = http_srv::RouteMatch::NONE;
+            const esp_err_t rc = dispatch(req, path, match);
+            if (match == http_srv::RouteMatch::WRONG_METHOD)
+            {
+                return send_error(req, 405);
+            }
+            if (match == http_srv::RouteMatch::MATCHED && rc != ESP_ERR_NOT_FOUND)
+            {
+                return rc;
+            }
+        }
+#endif
+
+        // Held until the response is sent: Location values point into it.
+        const RedirectSnapshot redirects;
+        std::string_view rest;
+        const RedirectRule *rule = lookup_redirect(redirects.table(), path, rest);
+        if (rule != nullptr && rule->code != 0)
+        {
+            if (rest.empty())
+            {
+                return send_redirect(req, rule->code, rule->target.c_str());
+            }
+
+            std::string location(rule->target);
+            location.append(rest);
+            return send_redirect(req, rule->code, location.c_str());
+        }
+
+        // Rewrites serve static content, which like static files is only
+        // offered to GET.
+        if (rule != nullptr && req->method == HTTP_GET)
+        {
+            esp_err_t rc;
+            if (rest.empty())
+            {
+                rc = serve_static(req, rule->target);
+            }
+            else
+            {
+                std::string target(rule->target);
+                target.append(rest);
+                rc = serve_static(req, target);
+            }
+            if (rc != ESP_ERR_NOT_FOUND && rc != ESP_ERR_NOT_SUPPORTED)
+            {
+                return rc;
+            }
+        }
+        else if (rule == nullptr && req->method == HTTP_GET)
+        {
+            const esp_err_t rc = serve_static(req, path);
+            if (rc != ESP_ERR_NOT_FOUND && rc != ESP_ERR_NOT_SUPPORTED)
+            {
+                return rc;
+            }
+        }
+
+        (void)err;
+        return send_error(req, 404);
+    }
+
+    // -------------------------------------------------------------------------
+    // Authentication with a verified-session cache guarded by s_mutex.
+    //
+    // Protected routes accept a session cookie, or Basic/Bearer credentials.
+    // Credentials are passed to the application's (expensive) verifier once;
+    // on success a session with a random 128-bit token is created in a fixed
+    // table and returned as a cookie. The session also remembers the SHA-256
+    // of the Authorization header, so clients that resend credentials
+    // instead of the cookie hit the cache too. Every lookup compares against
+    // all slots in constant time.
+    // -------------------------------------------------------------------------
+
+    struct AuthSession
+    {
+        uint8_t token[16];
+        uint8_t digest[32];
+        TickType_t expires;
+        bool in_use;
+    };
+
+    static constexpr size_t kAuthSessions = CONFIG_HTTP_SERVER_AUTH_SESSIONS;
+    static constexpr uint32_t kAuthSessionTtlS = CONFIG_HTTP_SERVER_AUTH_SESSION_TTL_S;
+    static constexpr size_t kAuthHeaderMax = CONFIG_HTTP_SERVER_AUTH_HEADER_MAX;
+    static constexpr size_t kAuthCookieLen = 96U;
+
+    static AuthSession s_auth_sessions[kAuthSessions] = {};
+    static http_srv::AuthVerifier s_auth_verifier = {};
+
+    // Set-Cookie values, one per connection (indexed like s_sessions).
+    // httpd keeps header values by pointer until the headers go out, which
+    // for a detached request can be after other logins have reused session
+    // slots. A connection's buffer is only rewritten by its next request,
+    // which httpd does not read before this response has completed.
+    static char s_auth_cookies[kSessionSlots][kAuthCookieLen];
+
+    static bool session_live(const AuthSession &s, TickType_t now)
+    {
+        return s.in_use && static_cast<int32_t>(s.expires - now) > 0;
+    }
+
+    static bool hex_to_bytes(std::string_view hex, uint8_t *out, size_t n)
+    {
+        if (hex.size() != 2U * n)
+        {
+            return false;
+        }
+
+        auto nibble = [](char c) -> int
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+            return -1;
+        };
+
+        for (size_t i = 0U; i < n; ++i)
+        {
+            const int hi = nibble(hex[2U * i]);
+            const int lo = nibble(hex[2U * i + 1U]);
+            if (hi < 0 || lo < 0)
+            {
+                return false;
+            }
+            out[i] = static_cast<uint8_t>((hi << 4) | lo);
+        }
+        return true;
+    }
+
+    /**
+     * Find a live session by cookie token or credential digest. Scans every
+     * slot regardless of where a match is found.
+     */
+    static bool find_session(const uint8_t *token, const uint8_t *digest)
+    {
+        if (!lock_mutex())
+        {
+            return false;
+        }
+
+        const TickType_t now = xTaskGetTickCount();
+        bool found = false;
+        for (const auto &s : s_auth_sessions)
+        {
+            const bool match = (token != nullptr)
+                                   ? equal_const_time(s.token, token, sizeof(s.token))
+                                   : equal_const_time(s.digest, digest, sizeof(s.digest));
+            found |= (match && session_live(s, now));
+        }
+
+        unlock_mutex();
+        return found;
+    }
+
+    /**
+     * Create a session for verified credentials and write its Set-Cookie
+     * value to cookie. Returns false if no session could be created.
+     */
+    static bool create_session(const uint8_t *digest, char (&cookie)[kAuthCookieLen])
+    {
+        if (kAuthSessions == 0U || !lock_mutex())
+        {
+            return false;
+        }
+
+        // Reuse a dead slot, else evict the session closest to expiry.
+        const TickType_t now = xTaskGetTickCount();
+        AuthSession *slot = &s_auth_sessions[0];
+        for (auto &s : s_auth_sessions)
+        {
+            if (!session_live(s, now))
+            {
+                slot = &s;
+                break;
+            }
+            if (static_cast<int32_t>(s.expires - slot->expires) < 0)
+            {
+                slot = &s;
+            }
+        }
+
+        esp_fill_random(slot->token, sizeof(slot->token));
+        std::memcpy(slot->digest, digest, sizeof(slot->digest));
+        slot->expires = now + pdMS_TO_TICKS(kAuthSessionTtlS * 1000U);
+        slot->in_use = true;
+
+        uint8_t token[sizeof(slot->token)];
+        std::memcpy(token, slot->token, sizeof(token));
+        unlock_mutex();
+
+        int len = std::snprintf(cookie, sizeof(cookie), "sid=");
+        for (const uint8_t b : token)
+        {
+            len += std::snprintf(cookie + len, sizeof(cookie) - len, "%02x", b);
+        }
+        std::snprintf(cookie + len, sizeof(cookie) - len,
+                      "; Path=/; HttpOnly; SameSite=Strict; Max-Age=%u",
+                      static_cast<unsigned>(kAuthSessionTtlS));
+        return true;
+    }
+
+    /**
+     * Run the application's verifier for a Basic or Bearer header value.
+     */
+    static bool verify_credentials(std::string_view auth)
+    {
+        http_srv::AuthVerifier v{};
+        if (lock_mutex())
+        {
+            v = s_auth_verifier;
+            unlock_mutex();
+        }
+
+        constexpr std::string_view kBasic{"Basic "};
+        constexpr std::string_view kBearer{"Bearer "};
+
+        if (auth.substr(0, kBasic.size()) == kBasic && v.basic != nullptr)
+        {
+            const std::string_view b64 = auth.substr(kBasic.size());
+
+            std::string decoded(b64.size() / 4U * 3U + 3U, '\0');
+            size_t olen = 0U;
+            if (mbedtls_base64_decode(reinterpret_cast<unsigned char *>(decoded.data()),
+                                      decoded.size() - 1U, &olen,
+                                      reinterpret_cast<const unsigned char *>(b64.data()),
+                                      b64.size()) != 0)
+            {
+                return false;
+            }
+            decoded[olen] = '\0';
+
+            char *colon = std::strchr(decoded.data(), ':');
+            if (colon == nullptr)
+            {
+                return false;
+            }
+            *colon = '\0';
+
+            s_counters.auth_verifications.fetch_add(1U, std::memory_order_relaxed);
+            const bool ok = v.basic(decoded.c_str(), colon + 1, v.ctx);
+            std::fill(decoded.begin(), decoded.end(), '\0');
+            return ok;
+        }
+
+        if (auth.substr(0, kBearer.size()) == kBearer && v.bearer != nullptr)
+        {
+            const std::string token(auth.substr(kBearer.size()));
+            s_counters.auth_verifications.fetch_add(1U, std::memory_order_relaxed);
+            return v.bearer(token.c_str(), v.ctx);
+        }
+
+        return false;
+    }
+
+    /**
+     * Authenticate a request. On success, *out_cookie is set when a new
+     * session was created and should be returned to the client; it stays
+     * valid until the connection's next request.
+     */
+    static bool authenticate(httpd_req_t *req, const char **out_cookie)
+    {
+        *out_cookie = nullptr;
+
+        char sid[40];
+        size_t sid_len = sizeof(sid);
+        uint8_t token[16];
+        if (httpd_req_get_cookie_val(req, "sid", sid, &sid_len) == ESP_OK &&
+            hex_to_bytes(std::string_view(sid), token, sizeof(token)) &&
+            find_session(token, nullptr))
+        {
+            s_counters.auth_session_hits.fetch_add(1U, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Bearer tokens (JWTs, HMAC-signed tokens) easily exceed a fixed
+        // stack buffer, so size it from the header.
+        const size_t auth_len = httpd_req_get_hdr_value_len(req, "Authorization");
+        if (auth_len == 0U || auth_len > kAuthHeaderMax)
+        {
+            return false;
+        }
+
+        std::string auth(auth_len + 1U, '\0');
+        if (httpd_req_get_hdr_value_str(req, "Authorization", auth.data(), auth.size()) != ESP_OK)
+        {
+            return false;
+        }
+        auth.resize(auth_len);
+
+        uint8_t digest[32];
+        (void)mbedtls_sha256(reinterpret_cast<const unsigned char *>(auth.data()),
+                             auth.size(), digest, 0);
+
+        if (find_session(nullptr, digest))
+        {
+            s_counters.auth_session_hits.fetch_add(1U, std::memory_order_relaxed);
+            return true;
+        }
+
+        if (!verify_credentials(auth))
+        {
+            return false;
+        }
+
+        // Without a connection slot the session still works for repeated
+        // credentials; only the cookie is skipped.
+        SessionSlot *conn = find_session_slot(httpd_req_to_sockfd(req));
+        if (conn != nullptr)
+        {
+            char(&cookie)[kAuthCookieLen] = s_auth_cookies[conn - s_sessions];
+            if (create_session(digest, cookie))
+            {
+                *out_cookie = cookie;
+            }
+        }
+        else
+        {
+            char unused[kAuthCookieLen];
+            (void)create_session(digest, unused);
+        }
+        return true;
+    }
+
+    /**
+     * URI handler installed by register_protected_uri(). The application
+     * handler is carried in user_ctx.
+     */
+    static esp_err_t handle_protected(httpd_req_t *req)
+    {
+        auto handler = reinterpret_cast<esp_err_t (*)(httpd_req_t *)>(req->user_ctx);
+
+        const char *cookie = nullptr;
+        if (!authenticate(req, &cookie))
+        {
+            s_counters.auth_failures.fetch_add(1U, std::memory_order_relaxed);
+            (void)httpd_resp_set_hdr(req, "WWW-Authenticate",
+                                     "Basic realm=\"" CONFIG_HTTP_SERVER_AUTH_REALM "\"");
+            return send_error(req, 401);
+        }
+
+        if (cookie != nullptr)
+        {
+            (void)httpd_resp_set_hdr(req, "Set-Cookie", cookie);
+        }
+
+        req->user_ctx = nullptr;
+        return handler(req);
+    }
+
+    // -------------------------------------------------------------------------
+    // Runtime tuning.
+    // -------------------------------------------------------------------------
+
+    static esp_err_t apply_tuning(const http_srv::Tuning &t)
+    {
+        if (t.transfer_chunk_size < 512U || t.transfer_chunk_size > kTransferChunkSize ||
+            t.max_transfers > kMaxTransfers ||
+            t.log_level < ESP_LOG_NONE || t.log_level > ESP_LOG_VERBOSE)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        const TuningSlot *cur = s_tuning.load(std::memory_order_relaxed);
+        const size_t cur_slot = static_cast<size_t>(cur - s_tuning_slots);
+        TuningSlot &next = s_tuning_slots[(cur_slot + 1U) % kTuningSlots];
+
+        const uint32_t seq = next.seq.load(std::memory_order_relaxed);
+        next.seq.store(seq + 1U, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        next.value = t;
+        next.value.version = cur->value.version + 1U;
+        next.seq.store(seq + 2U, std::memory_order_release);
+        s_tuning.store(&next, std::memory_order_release);
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
+        cache_trim_locked(t.cache_bytes);
+#endif
+        unlock_mutex();
+
+        esp_log_level_set(TAG, t.log_level);
+        return ESP_OK;
+    }
+
+#if CONFIG_HTTP_SERVER_TUNE_ENDPOINT
+    // -------------------------------------------------------------------------
+    // Tuning endpoint.
+    //
+    // GET returns the active snapshot as JSON. POST takes a flat JSON object
+    // with any subset of the same integer fields and applies it atomically.
+    // Both require "Authorization: Bearer <CONFIG_HTTP_SERVER_TUNE_TOKEN>".
+    // -------------------------------------------------------------------------
+
+    static bool tune_authorized(httpd_req_t *req)
+    {
+        constexpr std::string_view token{CONFIG_HTTP_SERVER_TUNE_TOKEN};
+        if (token.empty())
+        {
+            return false;
+        }
+
+        char hdr[96];
+        if (httpd_req_get_hdr_value_str(req, "Authorization", hdr, sizeof(hdr)) != ESP_OK)
+        {
+            return false;
+        }
+
+        std::string_view v(hdr);
+        constexpr std::string_view kBearer{"Bearer "};
+        if (v.substr(0, kBearer.size()) != kBearer)
+        {
+            return false;
+        }
+        v.remove_prefix(kBearer.size());
+
+        return equal_const_time(v, token);
+    }
+
+    static esp_err_t send_tuning_json(httpd_req_t *req)
+    {
+        const http_srv::Tuning t = stored_tuning();
+
+        char body[256];
+        std::snprintf(body, sizeof(body),
+                      "{\"version\":%u,\"cache_bytes\":%u,\"cache_max_entry_bytes\":%u,"
+                      "\"transfer_threshold\":%u,\"transfer_chunk_size\":%u,"
+                      "\"max_transfers\":%u,\"log_level\":%d}\n",
+                      static_cast<unsigned>(t.version),
+                      static_cast<unsigned>(t.cache_bytes),
+                      static_cast<unsigned>(t.cache_max_entry_bytes),
+                      static_cast<unsigned>(t.transfer_threshold),
+                      static_cast<unsigned>(t.transfer_chunk_size),
+                      static_cast<unsigned>(t.max_transfers),
+                      static_cast<int>(t.log_level));
+
+        set_cache_headers(req, http_srv::CachePolicy::NO_STORE);
+        return send_text(req, 200, "application/json; charset=utf-8", body);
+    }
+
+    static esp_err_t handle_tune_get(httpd_req_t *req)
+    {
+        if (!tune_authorized(req))
+        {
+            return send_error(req, 401);
+        }
+
+        return send_tuning_json(req);
+    }
+
+    static esp_err_t handle_tune_post(httpd_req_t *req)
+    {
+        if (!tune_authorized(req))
+        {
+            return send_error(req, 401);
+        }
+
+        if (req->content_len == 0U)
+        {
+            return send_error(req, 400);
+        }
+
+        // Parsed as it arrives, straight into a copy of the settings.
+        http_srv::Tuning t = stored_tuning();
+        uint32_t log_level = static_cast<uint32_t>(t.log_level);
+        const http_srv::json::Binding fields[] = {
+            http_srv::json::bind("cache_bytes", t.cache_bytes),
+            http_srv::json::bind("cache_max_entry_bytes", t.cache_max_entry_bytes),
+            http_srv::json::bind("transfer_threshold", t.transfer_threshold),
+            http_srv::json::bind("transfer_chunk_size", t.transfer_chunk_size),
+            http_srv::json::bind("max_transfers", t.max_transfers),
+            http_srv::json::bind("log_level", log_level),
+            http_srv::json::ignore("version"),
+        };
+
+        const esp_err_t rc = http_srv::json::recv_into(req, fields, sizeof(fields) / sizeof(fields[0]));
+        if (rc == ESP_ERR_TIMEOUT)
+        {
+            return send_error(req, 408);
+        }
+        if (rc == ESP_FAIL)
+        {
+            return ESP_FAIL;
+        }
+        t.log_level = static_cast<esp_log_level_t>(log_level);
+
+        if (rc != ESP_OK || apply_tuning(t) != ESP_OK)
+        {
+            return send_error(req, 400);
+        }
+
+        return send_tuning_json(req);
+    }
+#endif
+
+    // -------------------------------------------------------------------------
+    // Producer routes.
+    //
+    // register_producer() routes call an open function on the httpd task to
+    // get a Producer, then hand the response to the background transfer
+    // machinery: the worker pulls one buffer from the producer whenever the
+    // socket is writable, so slow clients throttle their producer and many
+    // responses interleave round-robin. Known lengths are sent with
+    // Content-Length and raw writes; unknown ones with chunked encoding.
+    // -------------------------------------------------------------------------
+
+    /**
+     * Write the status line and headers for a Content-Length response. The
+     * httpd_resp_* header helpers always select chunked encoding.
+     */
+    static bool send_sized_headers(httpd_req_t *req, const http_srv::Producer &p)
+    {
+        char hdr[256];
+        const int n = std::snprintf(hdr, sizeof(hdr),
+                                    "HTTP/1.1 200 OK\r\n"
+                                    "Content-Type: %s\r\n"
+                                    "Content-Length: %lu\r\n"
+                                    "Cache-Control: no-store\r\n"
+                                    "%s%s%s"
+                                    "\r\n",
+                                    p.ctype,
+                                    static_cast<unsigned long>(p.length),
+                                    (p.encoding != nullptr) ? "Content-Encoding: " : "",
+                                    (p.encoding != nullptr) ? p.encoding : "",
+                                    (p.encoding != nullptr) ? "\r\n" : "");
+
+        return n > 0 && static_cast<size_t>(n) < sizeof(hdr) &&
+               send_raw(req, hdr, static_cast<size_t>(n));
+    }
+
+    static esp_err_t start_producer(httpd_req_t *req, const http_srv::Producer &p)
+    {
+        if (!transfer_slot_free(std::max<uint32_t>(tuning().max_transfers, 1U)))
+        {
+            return ESP_ERR_NO_MEM;
+        }
+
+        Transfer *t = new_transfer(req, nullptr, p.ctype, std::string());
+        if (t == nullptr)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+
+        httpd_req_t *copy = nullptr;
+        const esp_err_t rc = httpd_req_async_handler_begin(req, &copy);
+        if (rc != ESP_OK)
+        {
+            delete t;
+            return rc;
+        }
+
+        // From here on finish_transfer() owns the producer.
+        t->req = copy;
+        t->producer = p;
+        t->remaining = p.length;
+        pin_session(t->sockfd);
+        s_counters.transfers_active.fetch_add(1U, std::memory_order_relaxed);
+        s_counters.transfers_started.fetch_add(1U, std::memory_order_relaxed);
+
+        if (p.length != http_srv::kUnknownLength)
+        {
+            if (!send_sized_headers(copy, p))
+            {
+                finish_transfer(t, false);
+                return ESP_OK;
+            }
+        }
+        else
+        {
+            httpd_resp_set_type(copy, t->ctype.c_str());
+            if (p.encoding != nullptr)
+            {
+                (void)httpd_resp_set_hdr(copy, "Content-Encoding", p.encoding);
+            }
+            set_cache_headers(copy, http_srv::CachePolicy::NO_STORE);
+        }
+
+        queue_transfer(t);
+        return ESP_OK;
+    }
+
+    static esp_err_t handle_producer(httpd_req_t *req)
+    {
+        auto open = reinterpret_cast<http_srv::ProducerOpenFn>(req->user_ctx);
+
+        http_srv::Producer p{};
+        p.ctype = "application/octet-stream";
+        p.length = http_srv::kUnknownLength;
+
+        const esp_err_t open_rc = open(req, &p);
+        if (open_rc != ESP_OK)
+        {
+            return send_error(req, (open_rc == ESP_ERR_NOT_FOUND) ? 404 : 500);
+        }
+
+        if (p.produce == nullptr || p.ctype == nullptr)
+        {
+            if (p.finish != nullptr)
+            {
+                p.finish(p.ctx, false);
+            }
+            return send_error(req, 500);
+        }
+
+        const esp_err_t rc = start_producer(req, p);
+        if (rc != ESP_OK)
+        {
+            if (p.finish != nullptr)
+            {
+                p.finish(p.ctx, false);
+            }
+            return send_error(req, (rc == ESP_ERR_NO_MEM) ? 503 : 500);
+        }
+        return ESP_OK;
+    }
+
+    // -------------------------------------------------------------------------
+    // Sample streams.
+    //
+    // Each stream is a power-of-two ring of fixed-size samples written by a
+    // single producer with stream_push() and read by any number of HTTP
+    // clients. The producer never waits: it copies samples in, then publishes
+    // the new head sequence with a release store. Readers are detached async
+    // requests polled by a worker timer; each keeps its own cursor and reads
+    // straight from the ring. Binary readers send ring memory as-is; CSV and
+    // NDJSON readers format into a per-poll buffer.
+    //
+    // Only the newest capacity - guard samples are handed out. stream_push()
+    // publishes at most guard samples at a time, so the slots being
+    // overwritten are always outside that window. A reader that falls further
+    // behind skips ahead and receives a gap marker. If the head moves past a
+    // region while it is being sent, the region is followed by a gap marker
+    // so the client discards it. Sends never block (see s_nb_fd); what a
+    // slow reader's socket has not taken is copied out of the ring and held
+    // until it has, and the reader gets nothing new meanwhile.
+    //
+    // New readers are queued in s_readers_pending (guarded by s_mutex). The
+    // worker moves them into s_readers, which only it touches.
+    // -------------------------------------------------------------------------
+
+    enum class StreamFormat : uint8_t
+    {
+        CSV,
+        NDJSON,
+        BIN
+    };
+
+    struct StreamReader
+    {
+        httpd_req_t *req; // Async copy; owned until finish_reader().
+        http_srv::Stream *stream;
+        uint32_t cursor;
+        int sockfd;
+        StreamFormat format;
+        SendBacklog backlog; // Bytes the socket has not taken yet; see s_nb_fd.
+    };
+
+    /** Little-endian frame header preceding every binary payload. */
+    struct StreamFrame
+    {
+        uint8_t type; // kFrameData or kFrameGap.
+        uint8_t sample_type;
+        uint16_t sample_size;
+        uint32_t seq;
+        uint32_t count;
+    };
+    static_assert(sizeof(StreamFrame) == 12U, "binary frame header layout");
+
+    static constexpr uint8_t kFrameData = 0U;
+    static constexpr uint8_t kFrameGap = 1U;
+
+    static constexpr size_t kMaxStreams = CONFIG_HTTP_SERVER_MAX_STREAMS;
+    static constexpr uint32_t kMaxStreamReaders = CONFIG_HTTP_SERVER_STREAM_MAX_READERS;
+    static constexpr uint32_t kStreamPollMs = CONFIG_HTTP_SERVER_STREAM_POLL_MS;
+    static constexpr uint8_t kStreamMaxFields = 16U;
+
+    static http_srv::Stream *s_streams[kMaxStreams] = {};
+    static size_t s_stream_count = 0U;
+
+    static std::vector<StreamReader *> s_readers_pending;
+    static std::vector<StreamReader *> s_readers;
+    static std::atomic<uint32_t> s_readers_count{0};
+    static std::atomic<bool> s_readers_armed{false};
+
+    static void poll_stream_readers(void *);
+
+    static size_t sample_type_size(http_srv::SampleType t)
+    {
+        switch (t)
+        {
+        case http_srv::SampleType::I16:
+        case http_srv::SampleType::U16:
+            return 2U;
+        case http_srv::SampleType::I32:
+        case http_srv::SampleType::U32:
+        case http_srv::SampleType::F32:
+            return 4U;
+        }
+        return 0U;
+    }
+
+    static void append_field(std::string &out, http_srv::SampleType t, const uint8_t *p)
+    {
+        char num[24];
+        int n = 0;
+
+        switch (t)
+        {
+        case http_srv::SampleType::I16:
+        {
+            int16_t v;
+            std::memcpy(&v, p, sizeof(v));
+            n = std::snprintf(num, sizeof(num), "%d", v);
+            break;
+        }
+        case http_srv::SampleType::U16:
+        {
+            uint16_t v;
+            std::memcpy(&v, p, sizeof(v));
+            n = std::snprintf(num, sizeof(num), "%u", v);
+            break;
+        }
+        case http_srv::SampleType::I32:
+        {
+            int32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            n = std::snprintf(num, sizeof(num), "%ld", static_cast<long>(v));
+            break;
+        }
+        case http_srv::SampleType::U32:
+        {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            n = std::snprintf(num, sizeof(num), "%lu", static_cast<unsigned long>(v));
+            break;
+        }
+        case http_srv::SampleType::F32:
+        {
+            float v;
+            std::memcpy(&v, p, sizeof(v));
+            n = std::snprintf(num, sizeof(num), "%g", static_cast<double>(v));
+            break;
+        }
+        }
+
+        out.append(num, (n > 0) ? static_cast<size_t>(n) : 0U);
+    }
+
+    static void format_samples(const http_srv::Stream *s,
+                               StreamFormat fmt,
+                               uint32_t seq,
+                               const uint8_t *data,
+                               uint32_t count,
+                               std::string &out)
+    {
+        const size_t field_size = sample_type_size(s->type);
+        char num[16];
+
+        for (uint32_t i = 0U; i < count; ++i, data += s->sample_size)
+        {
+            std::snprintf(num, sizeof(num), "%lu", static_cast<unsigned long>(seq + i));
+
+            if (fmt == StreamFormat::NDJSON)
+            {
+                out += "{\"seq\":";
+                out += num;
+                out += ",\"v\":[";
+            }
+            else
+            {
+                out += num;
+                out += ',';
+            }
+
+            for (uint8_t f = 0U; f < s->fields; ++f)
+            {
+                if (f > 0U)
+                {
+                    out += ',';
+                }
+                append_field(out, s->type, data + f * field_size);
+            }
+
+            out += (fmt == StreamFormat::NDJSON) ? "]}\n" : "\n";
+        }
+    }
+
+    static bool send_stream_gap(StreamReader *r, uint32_t seq, uint32_t count)
+    {
+        if (r->format == StreamFormat::BIN)
+        {
+            const StreamFrame hdr{kFrameGap,
+                                  static_cast<uint8_t>(r->stream->type),
+                                  r->stream->sample_size,
+                                  seq,
+                                  count};
+            return httpd_resp_send_chunk(r->req, reinterpret_cast<const char *>(&hdr),
+                                         sizeof(hdr)) == ESP_OK;
+        }
+
+        char line[64];
+        const int n = (r->format == StreamFormat::NDJSON)
+                          ? std::snprintf(line, sizeof(line), "{\"gap\":%lu,\"seq\":%lu}\n",
+                                          static_cast<unsigned long>(count),
+                                          static_cast<unsigned long>(seq))
+                          : std::snprintf(line, sizeof(line), "# gap seq=%lu lost=%lu\n",
+                                          static_cast<unsigned long>(seq),
+                                          static_cast<unsigned long>(count));
+        return httpd_resp_send_chunk(r->req, line, n) == ESP_OK;
+    }
+
+    static bool socket_writable(int fd)
+    {
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(fd, &wfds);
+
+        timeval tv{};
+        return select(fd + 1, nullptr, &wfds, nullptr, &tv) > 0;
+    }
+
+    /**
+     * Send what the reader has not seen yet, up to cap bytes. Returns false
+     * if the client is gone.
+     */
+    static bool send_reader_data(StreamReader *r, size_t cap, std::string &text)
+    {
+        http_srv::Stream *s = r->stream;
+        const uint32_t window = s->capacity - s->guard;
+
+        uint32_t avail = s->head.load(std::memory_order_acquire) - r->cursor;
+        if (avail > window)
+        {
+            const uint32_t lost = avail - window;
+            if (!send_stream_gap(r, r->cursor, lost))
+            {
+                return false;
+            }
+            r->cursor += lost;
+            avail = window;
+        }
+
+        if (avail == 0U || !socket_writable(r->sockfd))
+        {
+            return client_connected(r->sockfd);
+        }
+
+        const uint32_t idx = r->cursor & (s->capacity - 1U);
+        const size_t per_sample = (r->format == StreamFormat::BIN)
+                                      ? s->sample_size
+                                      : (16U + 12U * s->fields);
+        uint32_t count = std::min<uint32_t>(avail, s->capacity - idx);
+        count = std::min<uint32_t>(count, std::max<size_t>(cap / per_sample, 1U));
+
+        const uint8_t *data = s->ring + static_cast<size_t>(idx) * s->sample_size;
+        bool ok = true;
+
+        if (r->format == StreamFormat::BIN)
+        {
+            const StreamFrame hdr{kFrameData,
+                                  static_cast<uint8_t>(s->type),
+                                  s->sample_size,
+                                  r->cursor,
+                                  count};
+            ok = httpd_resp_send_chunk(r->req, reinterpret_cast<const char *>(&hdr),
+                                       sizeof(hdr)) == ESP_OK &&
+                 httpd_resp_send_chunk(r->req, reinterpret_cast<const char *>(data),
+                                       static_cast<ssize_t>(count) * s->sample_size) == ESP_OK;
+
+            if (ok && s->head.load(std::memory_order_acquire) - r->cursor > window)
+            {
+                ok = send_stream_gap(r, r->cursor, count);
+            }
+        }
+        else
+        {
+            text.clear();
+            format_samples(s, r->format, r->cursor, data, count, text);
+
+            if (s->head.load(std::memory_order_acquire) - r->cursor > window)
+            {
+                ok = send_stream_gap(r, r->cursor, count);
+            }
+            else
+            {
+                ok = httpd_resp_send_chunk(r->req, text.data(),
+                                           static_cast<ssize_t>(text.size())) == ESP_OK;
+            }
+        }
+
+        r->cursor += count;
+        return ok;
+    }
+
+    /**
+     * Serve a reader without blocking (see s_nb_fd). A reader whose socket
+     * has not taken the last batch gets nothing new; if it falls behind the
+     * ring meanwhile, the next batch starts with a gap marker. Returns false
+     * if the client is gone.
+     */
+    static bool serve_reader(StreamReader *r, size_t cap, std::string &text)
+    {
+        if (!flush_send_backlog(r->sockfd, r->backlog))
+        {
+            return false;
+        }
+
+        if (!r->backlog.data.empty())
+        {
+            return client_connected(r->sockfd);
+        }
+
+        begin_nb_send(r->sockfd, r->backlog);
+        const bool ok = send_reader_data(r, cap, text);
+        end_nb_send();
+        return ok;
+    }
+
+    static void finish_reader(StreamReader *r)
+    {
+        httpd_handle_t hd = r->req->handle;
+        (void)httpd_req_async_handler_complete(r->req);
+        unpin_session(r->sockfd);
+
+        // A live stream has no natural end; the connection goes with it.
+        (void)httpd_sess_trigger_close(hd, r->sockfd);
+
+        s_readers_count.fetch_sub(1U, std::memory_order_relaxed);
+        delete r;
+    }
+
+    static void arm_readers_timer()
+    {
+        if (!s_readers_armed.exchange(true) &&
+            timer_schedule(kStreamPollMs, 0U, poll_stream_readers, nullptr) == 0U)
+        {
+            s_readers_armed.store(false);
+        }
+    }
+
+    /**
+     * Serve every stream reader once. One-shot timer callback on the worker
+     * task, re-armed while any reader remains.
+     */
+    static void poll_stream_readers(void *)
+    {
+        s_readers_armed.store(false);
+
+        if (lock_mutex())
+        {
+            s_readers.insert(s_readers.end(), s_readers_pending.begin(), s_readers_pending.end());
+            s_readers_pending.clear();
+            unlock_mutex();
+        }
+
+        const size_t cap = std::min<size_t>(tuning().transfer_chunk_size, kTransferChunkSize);
+        std::string text;
+
+        for (size_t i = 0U; i < s_readers.size();)
+        {
+            if (!serve_reader(s_readers[i], cap, text))
+            {
+                finish_reader(s_readers[i]);
+                s_readers.erase(s_readers.begin() + static_cast<std::ptrdiff_t>(i));
+                continue;
+            }
+            ++i;
+        }
+
+        if (!s_readers.empty())
+        {
+            arm_readers_timer();
+        }
+    }
+
+    static void abort_all_stream_readers()
+    {
+        if (lock_mutex())
+        {
+            s_readers.insert(s_readers.end(), s_readers_pending.begin(), s_readers_pending.end());
+            s_readers_pending.clear();
+            unlock_mutex();
+        }
+
+        for (StreamReader *r : s_readers)
+        {
+            finish_reader(r);
+        }
+        s_readers.clear();
+    }
+
+    /**
+     * GET <stream uri>?format=csv|ndjson|bin[&from=<seq>]
+     */
+    static esp_err_t handle_stream(httpd_req_t *req)
+    {
+        auto *s = static_cast<http_srv::Stream *>(req->user_ctx);
+
+        std::string query;
+        const size_t qlen = httpd_req_get_url_query_len(req);
+        if (qlen > 0U && qlen <= HTTPD_MAX_URI_LEN)
+        {
+            query.assign(qlen + 1U, '\0');
+            if (httpd_req_get_url_query_str(req, query.data(), query.size()) != ESP_OK)
+            {
+                query.clear();
+            }
+        }
+        const char *q = query.empty() ? nullptr : query.c_str();
+
+        StreamFormat fmt = StreamFormat::CSV;
+        char fmt_name[8] = "csv";
+        if (q != nullptr)
+        {
+            (void)httpd_query_key_value(q, "format", fmt_name, sizeof(fmt_name));
+        }
+
+        if (std::strcmp(fmt_name, "ndjson") == 0)
+        {
+            fmt = StreamFormat::NDJSON;
+        }
+        else if (std::strcmp(fmt_name, "bin") == 0)
+        {
+            fmt = StreamFormat::BIN;
+        }
+        else if (std::strcmp(fmt_name, "csv") != 0)
+        {
+            return send_error(req, 400);
+        }
+
+        // Default to live data. A cursor ahead of the head is clamped to it;
+        // one that is too old turns into a gap on the first poll.
+        const uint32_t head = s->head.load(std::memory_order_acquire);
+        uint32_t cursor = query_u32(q, "from", head);
+        if (static_cast<int32_t>(cursor - head) > 0)
+        {
+            cursor = head;
+        }
+
+        if (!lock_mutex())
+        {
+            return send_error(req, 500);
+        }
+        const bool have_worker = s_task != nullptr && !s_task_exit;
+        unlock_mutex();
+
+        if (!have_worker ||
+            s_readers_count.fetch_add(1U, std::memory_order_relaxed) >= kMaxStreamReaders)
+        {
+            if (have_worker)
+            {
+                s_readers_count.fetch_sub(1U, std::memory_order_relaxed);
+            }
+            return send_error(req, 503);
+        }
+
+        auto *r = new (std::nothrow) StreamReader{nullptr, s, cursor, httpd_req_to_sockfd(req), fmt, SendBacklog{}};
+        httpd_req_t *copy = nullptr;
+        if (r == nullptr || httpd_req_async_handler_begin(req, &copy) != ESP_OK)
+        {
+            delete r;
+            s_readers_count.fetch_sub(1U, std::memory_order_relaxed);
+            return send_error(req, 500);
+        }
+
+        r->req = copy;
+        pin_session(r->sockfd);
+
+        char seq[16];
+        std::snprintf(seq, sizeof(seq), "%lu", static_cast<unsigned long>(cursor));
+
+        httpd_resp_set_type(copy, (fmt == StreamFormat::BIN)      ? "application/octet-stream"
+                                  : (fmt == StreamFormat::NDJSON) ? "application/x-ndjson"
+                                                                  : "text/csv");
+        set_cache_headers(copy, http_srv::CachePolicy::NO_STORE);
+        (void)httpd_resp_set_hdr(copy, "X-Stream-Seq", seq);
+
+        // CSV starts with the column names. Other formats send their headers
+        // with the first data; an empty chunk would end the response.
+        std::string first;
+        if (fmt == StreamFormat::CSV)
+        {
+            first = "seq";
+            for (uint8_t f = 0U; f < s->fields; ++f)
+            {
+                first += ",v" + std::to_string(f);
+            }
+            first += '\n';
+        }
+
+        const bool sent = first.empty() ||
+                          httpd_resp_send_chunk(copy, first.data(),
+                                                static_cast<ssize_t>(first.size())) == ESP_OK;
+        if (!sent || !lock_mutex())
+        {
+            finish_reader(r);
+            return ESP_OK;
+        }
+        s_readers_pending.push_back(r);
+        unlock_mutex();
+
+        arm_readers_timer();
+        return ESP_OK;
+    }
+
+#if defined(__cpp_impl_coroutine)
+    // -------------------------------------------------------------------------
+    // Coroutine handlers (see http_coro.hpp).
+    //
+    // A request for a coroutine route is detached on arrival and its
+    // coroutine is created suspended in a frame from s_coro_frames. Every
+    // resume happens on the worker task: runs parked on socket readiness are
+    // checked with a non-blocking select() each turn, timer waits use the
+    // timer wheel, and yields go to the back of the ready list. Chunks are
+    // sent without blocking (see s_nb_fd); a writer stays parked until its
+    // backlog has drained, and a finished handler waits in DRAINING until
+    // its response is out. Run slots and frames are guarded by s_mutex.
+    // -------------------------------------------------------------------------
+
+    enum class CoroState : uint8_t
+    {
+        FREE,
+        CLAIMED, // Being set up by the httpd task.
+        READY,
+        RUNNING,
+        WAIT_READ,
+        WAIT_WRITE,
+        WAIT_TIMER,
+        DRAINING // Handler done; sending the rest of the backlog.
+    };
+
+    struct CoroRun
+    {
+        CoroState state;
+        httpd_req_t *req; // Async copy; owned until finish_coro().
+        int sockfd;
+        http_srv::TimerId timer;
+        http_srv::co::Task::Handle task;
+        std::coroutine_handle<> resume;
+        http_srv::co::Request *request;
+        alignas(http_srv::co::Request) unsigned char request_mem[sizeof(http_srv::co::Request)];
+        SendBacklog backlog; // Bytes the socket has not taken yet; see s_nb_fd.
+    };
+
+    static constexpr size_t kCoroMax = CONFIG_HTTP_SERVER_CORO_MAX_HANDLERS;
+    static constexpr size_t kCoroFrameBytes = CONFIG_HTTP_SERVER_CORO_FRAME_BYTES;
+
+    struct alignas(std::max_align_t) CoroFrame
+    {
+        unsigned char bytes[kCoroFrameBytes];
+    };
+
+    static CoroRun s_coro_runs[kCoroMax] = {};
+    static CoroFrame s_coro_frames[kCoroMax];
+    static bool s_coro_frame_used[kCoroMax] = {};
+
+    static void coro_timer_fired(void *arg)
+    {
+        auto *run = static_cast<CoroRun *>(arg);
+        if (lock_mutex())
+        {
+            if (run->state == CoroState::WAIT_TIMER)
+            {
+                run->state = CoroState::READY;
+                run->timer = 0U;
+            }
+            unlock_mutex();
+        }
+    }
+
+    /**
+     * Ticks the worker may sleep before a coroutine needs service.
+     */
+    static TickType_t coro_wait_ticks()
+    {
+        if (!lock_mutex())
+        {
+            return pdMS_TO_TICKS(kTransferPollMs);
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        for (const CoroRun &run : s_coro_runs)
+        {
+            if (run.state == CoroState::READY)
+            {
+                wait = 0;
+                break;
+            }
+
+            if (run.state == CoroState::WAIT_READ || run.state == CoroState::WAIT_WRITE ||
+                run.state == CoroState::DRAINING)
+            {
+                wait = pdMS_TO_TICKS(kTransferPollMs);
+            }
+        }
+
+        unlock_mutex();
+        return wait;
+    }
+
+    static void finish_coro(CoroRun *run, esp_err_t rc)
+    {
+        if (run->timer != 0U)
+        {
+            (void)timer_cancel(run->timer);
+            run->timer = 0U;
+        }
+
+        // Destroying the frame returns it to the pool.
+        run->task.destroy();
+        run->request->~Request();
+        run->request = nullptr;
+        run->backlog = SendBacklog{};
+
+        httpd_handle_t hd = run->req->handle;
+        (void)httpd_req_async_handler_complete(run->req);
+        unpin_session(run->sockfd);
+
+        if (rc != ESP_OK)
+        {
+            (void)httpd_sess_trigger_close(hd, run->sockfd);
+        }
+
+        if (lock_mutex())
+        {
+            run->state = CoroState::FREE;
+            unlock_mutex();
+        }
+    }
+
+    static bool writes_pending(const CoroRun &run)
+    {
+        return run.state == CoroState::WAIT_WRITE || run.state == CoroState::DRAINING;
+    }
+
+    static void set_coro_state(CoroRun *run, CoroState state)
+    {
+        if (lock_mutex())
+        {
+            run->state = state;
+            unlock_mutex();
+        }
+    }
+
+    /**
+     * Resume every coroutine that can make progress. Runs on the worker task.
+     */
+    static void run_coro_turn()
+    {
+        fd_set rfds;
+        fd_set wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        int max_fd = -1;
+
+        if (!lock_mutex())
+        {
+            return;
+        }
+
+        for (const CoroRun &run : s_coro_runs)
+        {
+            if (run.state == CoroState::WAIT_READ || writes_pending(run))
+            {
+                FD_SET(run.sockfd, (run.state == CoroState::WAIT_READ) ? &rfds : &wfds);
+                max_fd = std::max(max_fd, run.sockfd);
+            }
+        }
+        unlock_mutex();
+
+        timeval tv{};
+        const int ready = (max_fd >= 0) ? select(max_fd + 1, &rfds, &wfds, nullptr, &tv) : 0;
+        const TickType_t now = xTaskGetTickCount();
+
+        CoroRun *runnable[kCoroMax];
+        CoroState waited[kCoroMax];
+        size_t count = 0U;
+
+        if (!lock_mutex())
+        {
+            return;
+        }
+
+        for (CoroRun &run : s_coro_runs)
+        {
+            // On a select() error, resume everyone and let the I/O fail. A
+            // backlog the socket has not touched for the send timeout is
+            // flushed anyway so the run fails.
+            const bool stalled = writes_pending(run) && !run.backlog.data.empty() &&
+                                 now - run.backlog.since >= s_send_wait_ticks;
+            const bool io_ready =
+                (run.state == CoroState::WAIT_READ && (ready < 0 || FD_ISSET(run.sockfd, &rfds))) ||
+                (writes_pending(run) && (ready < 0 || FD_ISSET(run.sockfd, &wfds) || stalled));
+
+            if (io_ready || run.state == CoroState::READY)
+            {
+                waited[count] = run.state;
+                run.state = CoroState::RUNNING;
+                runnable[count++] = &run;
+            }
+        }
+        unlock_mutex();
+
+        for (size_t i = 0U; i < count; ++i)
+        {
+            CoroRun *run = runnable[i];
+
+            if (!flush_send_backlog(run->sockfd, run->backlog))
+            {
+                finish_coro(run, ESP_FAIL);
+                continue;
+            }
+
+            // A writer resumes, and a finished handler completes, only once
+            // the socket has taken everything sent so far.
+            if (!run->backlog.data.empty() &&
+                (waited[i] == CoroState::WAIT_WRITE || waited[i] == CoroState::DRAINING))
+            {
+                set_coro_state(run, waited[i]);
+                continue;
+            }
+
+            if (waited[i] != CoroState::DRAINING)
+            {
+                run->resume.resume();
+            }
+
+            if (run->task.done())
+            {
+                if (run->backlog.data.empty())
+                {
+                    finish_coro(run, run->task.promise().result);
+                }
+                else
+                {
+                    set_coro_state(run, CoroState::DRAINING);
+                }
+            }
+        }
+    }
+
+    static void abort_all_coros()
+    {
+        for (CoroRun &run : s_coro_runs)
+        {
+            bool live = false;
+            if (lock_mutex())
+            {
+                live = (run.state != CoroState::FREE && run.state != CoroState::CLAIMED);
+                unlock_mutex();
+            }
+
+            if (live)
+            {
+                finish_coro(&run, ESP_FAIL);
+            }
+        }
+    }
+
+    static void release_coro_slot(CoroRun *run)
+    {
+        if (run->request != nullptr)
+        {
+            run->request->~Request();
+            run->request = nullptr;
+        }
+
+        if (lock_mutex())
+        {
+            run->state = CoroState::FREE;
+            unlock_mutex();
+        }
+    }
+
+    static esp_err_t handle_coro(httpd_req_t *req)
+    {
+        auto handler = reinterpret_cast<http_srv::co::Handler>(req->user_ctx);
+
+        if (!lock_mutex())
+        {
+            return send_error(req, 500);
+        }
+
+        CoroRun *run = nullptr;
+        if (s_task != nullptr && !s_task_exit)
+        {
+            for (CoroRun &r : s_coro_runs)
+            {
+                if (r.state == CoroState::FREE)
+                {
+                    r.state = CoroState::CLAIMED;
+                    run = &r;
+                    break;
+                }
+            }
+        }
+        unlock_mutex();
+
+        if (run == nullptr)
+        {
+            return send_error(req, 503);
+        }
+
+        // The coroutine starts suspended, so no handler code runs here.
+        run->request = http_srv::co::detail::Access::construct(run->request_mem);
+        http_srv::co::Task task = handler(*run->request);
+        if (!task)
+        {
+            release_coro_slot(run);
+            return send_error(req, 503);
+        }
+
+        httpd_req_t *copy = nullptr;
+        if (httpd_req_async_handler_begin(req, &copy) != ESP_OK)
+        {
+            release_coro_slot(run);
+            return send_error(req, 500);
+        }
+
+        http_srv::co::detail::Access::bind(*run->request, copy, run);
+        run->req = copy;
+        run->sockfd = httpd_req_to_sockfd(req);
+        run->timer = 0U;
+        run->task = task.release();
+        run->resume = run->task;
+        pin_session(run->sockfd);
+
+        // abort_all_coros() skips CLAIMED runs, so if the worker began
+        // exiting since the slot was claimed, nobody else will finish this
+        // one.
+        bool exiting = true;
+        if (lock_mutex())
+        {
+            exiting = (s_task == nullptr || s_task_exit);
+            if (!exiting)
+            {
+                run->state = CoroState::READY;
+            }
+            unlock_mutex();
+        }
+
+        if (exiting)
+        {
+            finish_coro(run, ESP_FAIL);
+            return ESP_OK;
+        }
+
+        notify_worker();
+        return ESP_OK;
+    }
+#endif
+
+    // -------------------------------------------------------------------------
+    // Server start/stop + URI registration.
+    // -------------------------------------------------------------------------
+
+    static esp_err_t register_uri_internal(const char *uri,
+                                           httpd_method_t method,
+                                           esp_err_t (*handler)(httpd_req_t *),
+                                           void *user_ctx = nullptr)
+    {
+        if (uri == nullptr || handler == nullptr)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if ((s_state != State::STARTING && s_state != State::RUNNING) ||
+            s_server == nullptr)
+        {
+            unlock_mutex();
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        httpd_uri_t h{};
+        h.uri = uri;
+        h.method = method;
+        h.handler = handler;
+        h.user_ctx = user_ctx;
+
+        const esp_err_t rc = httpd_register_uri_handler(s_server, &h);
+        unlock_mutex();
+        return rc;
+    }
+
+    /**
+     * Register the handlers of blobs added so far. Blobs outlive the server,
+     * so this runs on every start.
+     */
+    static esp_err_t register_blobs()
+    {
+        std::vector<const Blob *> blobs;
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+        for (const auto &b : s_blobs)
+        {
+            blobs.push_back(b.get());
+        }
+        unlock_mutex();
+
+        for (const Blob *b : blobs)
+        {
+            const esp_err_t rc = register_uri_internal(b->uri.c_str(), HTTP_GET, handle_blob,
+                                                       const_cast<Blob *>(b));
+            if (rc != ESP_OK)
+            {
+                return rc;
+            }
+        }
+        return ESP_OK;
+    }
+
+    /**
+     * Register the handlers of streams created so far. Streams outlive the
+     * server, so this runs on every start.
+     */
+    static esp_err_t register_streams()
+    {
+        http_srv::Stream *streams[kMaxStreams] = {};
+        size_t count = 0U;
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+        count = s_stream_count;
+        std::copy(s_streams, s_streams + count, streams);
+        unlock_mutex();
+
+        for (size_t i = 0U; i < count; ++i)
+        {
+            const esp_err_t rc =
+                register_uri_internal(streams[i]->uri, HTTP_GET, handle_stream, streams[i]);
+            if (rc != ESP_OK)
+            {
+                return rc;
+            }
+        }
+        return ESP_OK;
+    }
+
+    static void stop_server()
+    {
+        httpd_handle_t to_stop = nullptr;
+
+        if (!lock_mutex())
+        {
+            return;
+        }
+
+        if (s_server == nullptr)
+        {
+            unlock_mutex();
+            return;
+        }
+
+        to_stop = s_server;
+        s_server = nullptr;
+        unlock_mutex();
+
+        const esp_err_t rc = httpd_stop(to_stop);
+        if (rc != ESP_OK)
+        {
+            ESP_LOGW(TAG, "httpd_stop failed: %s.", esp_err_to_name(rc));
+        }
+    }
+
+    static esp_err_t start_server()
+    {
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (s_server != nullptr)
+        {
+            unlock_mutex();
+            return ESP_OK;
+        }
+
+        httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
+        cfg.server_port = 80;
+        cfg.uri_match_fn = httpd_uri_match_wildcard;
+        cfg.max_uri_handlers = 40;
+        cfg.open_fn = handle_session_open;
+        cfg.close_fn = handle_session_close;
+
+        s_max_open_sockets = static_cast<size_t>(cfg.max_open_sockets);
+        s_send_wait_ticks = pdMS_TO_TICKS(cfg.send_wait_timeout * 1000U);
+
+        const esp_err_t rc = httpd_start(&s_server, &cfg);
+        if (rc != ESP_OK)
+        {
+            ESP_LOGE(TAG, "httpd_start failed: %s.", esp_err_to_name(rc));
+            s_server = nullptr;
+            unlock_mutex();
+            return rc;
+        }
+
+        unlock_mutex();
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
+        (void)ensure_fs_mounted();
+#endif
+
+        esp_err_t reg_rc = ESP_OK;
+
+        reg_rc = register_uri_internal("/", HTTP_GET, handle_root);
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+
+        reg_rc = register_uri_internal("/index.html", HTTP_GET, handle_root);
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+
+        reg_rc = register_uri_internal("/index.htm", HTTP_GET, handle_root);
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+
+        reg_rc = register_uri_internal("/favicon.ico", HTTP_GET, handle_favicon_ico);
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+
+#if CONFIG_HTTP_SERVER_TUNE_ENDPOINT
+        reg_rc = register_uri_internal(CONFIG_HTTP_SERVER_TUNE_URI, HTTP_GET, handle_tune_get);
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+
+        reg_rc = register_uri_internal(CONFIG_HTTP_SERVER_TUNE_URI, HTTP_POST, handle_tune_post);
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+#endif
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS && CONFIG_HTTP_SERVER_ENABLE_COMBO
+        reg_rc = register_uri_internal("/combo", HTTP_GET, handle_combo);
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+#endif
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS && CONFIG_HTTP_SERVER_ENABLE_UPLOAD
+#if CONFIG_HTTP_SERVER_UPLOAD_REQUIRE_AUTH
+        reg_rc = register_uri_internal(CONFIG_HTTP_SERVER_UPLOAD_URI "/*", HTTP_PUT,
+                                       handle_protected, reinterpret_cast<void *>(handle_upload));
+#else
+        reg_rc = register_uri_internal(CONFIG_HTTP_SERVER_UPLOAD_URI "/*", HTTP_PUT, handle_upload);
+#endif
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+#endif
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS && CONFIG_HTTP_SERVER_ENABLE_TAIL
+#if CONFIG_HTTP_SERVER_TAIL_REQUIRE_AUTH
+        reg_rc = register_uri_internal(CONFIG_HTTP_SERVER_TAIL_URI "/*", HTTP_GET,
+                                       handle_protected, reinterpret_cast<void *>(handle_tail));
+#else
+        reg_rc = register_uri_internal(CONFIG_HTTP_SERVER_TAIL_URI "/*", HTTP_GET, handle_tail);
+#endif
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+#endif
+
+        reg_rc = register_streams();
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+
+        reg_rc = register_blobs();
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+
+        if (lock_mutex())
+        {
+            reg_rc = (s_server != nullptr) ? ESP_OK : ESP_ERR_INVALID_STATE;
+
+            for (int i = 0; i < HTTPD_ERR_CODE_MAX && reg_rc == ESP_OK; ++i)
+            {
+                const auto err = static_cast<httpd_err_code_t>(i);
+                reg_rc = httpd_register_err_handler(s_server,
+                                                    err,
+                                                    (err == HTTPD_404_NOT_FOUND)
+                                                        ? handle_not_found
+                                                        : handle_http_error);
+            }
+            unlock_mutex();
+        }
+        else
+        {
+            reg_rc = ESP_FAIL;
+        }
+
+        if (reg_rc != ESP_OK)
+        {
+            goto fail;
+        }
+
+        return ESP_OK;
+
+    fail:
+        ESP_LOGE(TAG, "URI registration failed: %s.", esp_err_to_name(reg_rc));
+        stop_server();
+        return reg_rc;
+    }
+
+    // -------------------------------------------------------------------------
+    // Memory pressure monitor.
+    //
+    // A worker timer samples free heap and the largest free block, internal
+    // and (when present) PSRAM. Below any configured threshold the server
+    // enters degraded mode: cached file bodies and open handles are dropped
+    // and not refilled (the metadata index is kept), transfers send
+    // kDegradedChunkSize chunks, large upload bodies get 503 and idle
+    // sessions are reaped at the minimum idle time. It leaves degraded mode
+    // only once every value is kMemRecoverPercent of its threshold, so the
+    // mode does not flap around a threshold.
+    // -------------------------------------------------------------------------
+
+    static constexpr uint32_t kMemCheckMs = CONFIG_HTTP_SERVER_MEM_CHECK_MS;
+    static constexpr size_t kMemLowInternal = CONFIG_HTTP_SERVER_MEM_LOW_INTERNAL;
+    static constexpr size_t kMemLowInternalBlock = CONFIG_HTTP_SERVER_MEM_LOW_INTERNAL_BLOCK;
+    static constexpr size_t kMemLowPsram = CONFIG_HTTP_SERVER_MEM_LOW_PSRAM;
+    static constexpr size_t kMemLowPsramBlock = CONFIG_HTTP_SERVER_MEM_LOW_PSRAM_BLOCK;
+    static constexpr uint32_t kMemRecoverPercent = CONFIG_HTTP_SERVER_MEM_RECOVER_PERCENT;
+
+    static void check_memory(void *)
+    {
+        constexpr uint32_t kInternal = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+        const bool psram = heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0U;
+        const bool degraded = s_mem_degraded.load(std::memory_order_relaxed);
+        const uint64_t pct = degraded ? kMemRecoverPercent : 100U;
+
+        auto below = [&](size_t value, size_t limit)
+        { return limit > 0U && static_cast<uint64_t>(value) * 100U < limit * pct; };
+
+        const bool low =
+            below(heap_caps_get_free_size(kInternal), kMemLowInternal) ||
+            below(heap_caps_get_largest_free_block(kInternal), kMemLowInternalBlock) ||
+            (psram && below(heap_caps_get_free_size(MALLOC_CAP_SPIRAM), kMemLowPsram)) ||
+            (psram && below(heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM), kMemLowPsramBlock));
+
+        if (low == degraded)
+        {
+            return;
+        }
+
+        s_mem_degraded.store(low, std::memory_order_relaxed);
+        if (!low)
+        {
+            s_counters.mem_degraded_exits.fetch_add(1U, std::memory_order_relaxed);
+            ESP_LOGI(TAG, "Memory recovered; leaving degraded mode.");
+            return;
+        }
+
+        s_counters.mem_degraded_entries.fetch_add(1U, std::memory_order_relaxed);
+        ESP_LOGW(TAG,
+                 "Low memory (internal free %u, largest %u); entering degraded mode.",
+                 static_cast<unsigned>(heap_caps_get_free_size(kInternal)),
+                 static_cast<unsigned>(heap_caps_get_largest_free_block(kInternal)));
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
+        shed_fs_caches();
+#endif
+        reap_idle_sessions(nullptr);
+    }
+
+    // -------------------------------------------------------------------------
+    // Worker task.
+    // -------------------------------------------------------------------------
+
+    static void http_srv_task(void *arg)
+    {
+        (void)arg;
+
+        if (lock_mutex())
+        {
+            if (s_state == State::STARTING && s_evt != nullptr)
+            {
+                s_state = State::RUNNING;
+                xEventGroupSetBits(s_evt, READY_BIT);
+            }
+            unlock_mutex();
+        }
+
+        std::unique_ptr<char[]> xfer_buf(new (std::nothrow) char[kTransferChunkSize]);
+        if (xfer_buf == nullptr)
+        {
+            ESP_LOGE(TAG, "Failed to allocate transfer buffer.");
+        }
+
+        http_srv::TimerId reap_timer = 0U;
+        if (kIdleTimeoutS > 0U)
+        {
+            reap_timer = timer_schedule(kReapIntervalMs, kReapIntervalMs, reap_idle_sessions, nullptr);
+        }
+
+        http_srv::TimerId mem_timer = 0U;
+        if (kMemCheckMs > 0U)
+        {
+            mem_timer = timer_schedule(kMemCheckMs, kMemCheckMs, check_memory, nullptr);
+        }
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
+        prewarm_from_hot_list();
+
+#if CONFIG_HTTP_SERVER_ENABLE_UPLOAD
+        const http_srv::TimerId upload_timer =
+            timer_schedule(kUploadSweepMs, kUploadSweepMs, sweep_partial_uploads, nullptr);
+#endif
+
+        http_srv::TimerId hot_timer = 0U;
+        if (kHotListSize > 0U && kHotListIntervalS > 0U)
+        {
+            hot_timer = timer_schedule(kHotListIntervalS * 1000U,
+                                       kHotListIntervalS * 1000U,
+                                       [](void *)
+                                       { persist_hot_list(); },
+                                       nullptr);
+        }
+#endif
+
+        while (true)
+        {
+            // Poll while transfers are in flight; otherwise sleep until notified
+            // or until the timer wheel needs advancing.
+            TickType_t wait = std::min(transfers_wait_ticks(), timer_wait_ticks());
+#if defined(__cpp_impl_coroutine)
+            wait = std::min(wait, coro_wait_ticks());
+#endif
+
+            (void)ulTaskNotifyTake(pdTRUE, wait);
+
+            if (lock_mutex())
+            {
+                const bool exit_now = s_task_exit;
+                unlock_mutex();
+                if (exit_now)
+                {
+                    break;
+                }
+            }
+
+            if (xfer_buf != nullptr)
+            {
+                run_transfers_turn(xfer_buf.get(),
+                                   std::min<size_t>(tuning().transfer_chunk_size,
+                                                    kTransferChunkSize));
+            }
+            else
+            {
+                abort_all_transfers();
+            }
+
+            run_due_timers();
+
+#if defined(__cpp_impl_coroutine)
+            run_coro_turn();
+#endif
+        }
+
+        abort_all_transfers();
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS && CONFIG_HTTP_SERVER_ENABLE_TAIL
+        abort_all_followers();
+#endif
+
+        abort_all_stream_readers();
+
+#if defined(__cpp_impl_coroutine)
+        abort_all_coros();
+#endif
+
+        if (reap_timer != 0U)
+        {
+            (void)timer_cancel(reap_timer);
+        }
+
+        if (mem_timer != 0U)
+        {
+            (void)timer_cancel(mem_timer);
+        }
+
+        stop_settings_flush();
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
+        if (hot_timer != 0U)
+        {
+            (void)timer_cancel(hot_timer);
+        }
+#if CONFIG_HTTP_SERVER_ENABLE_UPLOAD
+        if (upload_timer != 0U)
+        {
+            (void)timer_cancel(upload_timer);
+        }
+#endif
+        persist_hot_list();
+#endif
+
+        if (lock_mutex())
+        {
+            if (s_evt != nullptr)
+            {
+                xEventGroupClearBits(s_evt, READY_BIT);
+            }
+
+            s_task = nullptr;
+            unlock_mutex();
+        }
+        else
+        {
+            if (s_evt != nullptr)
+            {
+                xEventGroupClearBits(s_evt, READY_BIT);
+            }
+        }
+
+        vTaskDelete(nullptr);
+    }
+
+    static bool ensure_mutex()
+    {
+        if (s_mutex == nullptr)
+        {
+            s_mutex = xSemaphoreCreateMutex();
+            if (s_mutex == nullptr)
+            {
+                ESP_LOGE(TAG, "Failed to create mutex.");
+                return false;
+            }
+        }
+
+        if (s_evt == nullptr)
+        {
+            s_evt = xEventGroupCreate();
+            if (s_evt == nullptr)
+            {
+                ESP_LOGE(TAG, "Failed to create event group.");
+                vSemaphoreDelete(s_mutex);
+                s_mutex = nullptr;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static bool start_worker_task()
+    {
+        if (!lock_mutex())
+        {
+            return false;
+        }
+
+        if (s_task != nullptr)
+        {
+            unlock_mutex();
+            return true;
+        }
+
+        s_task_exit = false;
+        unlock_mutex();
+
+        // ESP-IDF takes the stack depth in bytes.
+        static constexpr uint32_t kStackBytes = CONFIG_HTTP_SERVER_WORKER_STACK_SIZE;
+        static constexpr UBaseType_t kPrio = 5;
+
+        TaskHandle_t handle = nullptr;
+        const BaseType_t ok =
+            xTaskCreate(http_srv_task,
+                        "http_srv",
+                        kStackBytes,
+                        nullptr,
+                        kPrio,
+                        &handle);
+
+        if (ok != pdPASS || handle == nullptr)
+        {
+            ESP_LOGE(TAG, "Failed to create http_srv task.");
+            return false;
+        }
+
+        if (!lock_mutex())
+        {
+            vTaskDelete(handle);
+            return false;
+        }
+
+        if (s_task != nullptr)
+        {
+            unlock_mutex();
+            vTaskDelete(handle);
+            return true;
+        }
+
+        s_task = handle;
+        unlock_mutex();
+        return true;
+    }
+
+    static bool stop_worker_task()
+    {
+        TaskHandle_t t = nullptr;
+
+        if (!lock_mutex())
+        {
+            return false;
+        }
+
+        t = s_task;
+        if (t == nullptr)
+        {
+            unlock_mutex();
+            return true;
+        }
+
+        s_task_exit = true;
+        unlock_mutex();
+
+        notify_worker();
+
+        for (int i = 0; i < 50; ++i)
+        {
+            if (lock_mutex(pdMS_TO_TICKS(50)))
+            {
+                const bool done = (s_task == nullptr);
+                unlock_mutex();
+                if (done)
+                {
+                    return true;
+                }
+            }
+            vTaskDelay(pdMS_TO_TICKS(20));
+        }
+
+        ESP_LOGW(TAG, "Worker task did not stop within timeout.");
+        return false;
+    }
+
+    static void clear_deferred_state()
+    {
+        if (!lock_mutex())
+        {
+            return;
+        }
+
+        unlock_mutex();
+    }
+} // namespace
+
+namespace http_srv
+{
+    void start()
+    {
+        if (!ensure_mutex())
+        {
+            return;
+        }
+
+        if (!lock_mutex())
+        {
+            return;
+        }
+
+        if (s_state == State::RUNNING ||
+            s_state == State::STARTING ||
+            s_state == State::STOPPING)
+        {
+            unlock_mutex();
+            return;
+        }
+
+        s_state = State::STARTING;
+        s_task_exit = false;
+        xEventGroupClearBits(s_evt, READY_BIT);
+
+        unlock_mutex();
+
+        static constexpr int kMaxAttempts = 5;
+        static constexpr TickType_t kInitialBackoff = pdMS_TO_TICKS(50);
+        static constexpr TickType_t kWorkerReadyTimeout = pdMS_TO_TICKS(500);
+
+        TickType_t backoff = kInitialBackoff;
+
+        for (int attempt = 0; attempt < kMaxAttempts; ++attempt)
+        {
+            const esp_err_t srv_ret = start_server();
+            if (srv_ret != ESP_OK)
+            {
+                vTaskDelay(backoff);
+                backoff = backoff + backoff;
+                continue;
+            }
+
+            const bool task_ok = start_worker_task();
+            if (!task_ok)
+            {
+                stop_server();
+                vTaskDelay(backoff);
+                backoff = backoff + backoff;
+                continue;
+            }
+
+            const EventBits_t bits =
+                xEventGroupWaitBits(s_evt,
+                                    READY_BIT,
+                                    pdFALSE,
+                                    pdTRUE,
+                                    kWorkerReadyTimeout);
+
+            if ((bits & READY_BIT) != 0)
+            {
+                return;
+            }
+
+            (void)stop_worker_task();
+            stop_server();
+
+            vTaskDelay(backoff);
+            backoff = backoff + backoff;
+        }
+
+        if (lock_mutex())
+        {
+            s_state = State::STOPPED;
+            xEventGroupClearBits(s_evt, READY_BIT);
+            unlock_mutex();
+        }
+    }
+
+    void stop()
+    {
+        if (!ensure_mutex())
+        {
+            return;
+        }
+
+        TaskHandle_t worker = nullptr;
+
+        if (!lock_mutex())
+        {
+            return;
+        }
+
+        if (s_state == State::STOPPED)
+        {
+            unlock_mutex();
+            return;
+        }
+
+        s_state = State::STOPPING;
+        xEventGroupClearBits(s_evt, READY_BIT);
+
+        s_task_exit = true;
+        worker = s_task;
+
+        unlock_mutex();
+
+        if (worker != nullptr)
+        {
+            notify_worker();
+        }
+
+        (void)stop_worker_task();
+        clear_deferred_state();
+        stop_server();
+
+#if CONFIG_HTTP_SERVER_PM_BOOST
+        pm_stop();
+#endif
+
+        if (lock_mutex(portMAX_DELAY))
+        {
+            s_state = State::STOPPED;
+            xEventGroupClearBits(s_evt, READY_BIT);
+            unlock_mutex();
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Failed to finalize stop state.");
+        }
+    }
+
+    bool is_running()
+    {
+        if (!ensure_mutex())
+        {
+            return false;
+        }
+
+        if (!lock_mutex())
+        {
+            return false;
+        }
+
+        const bool running = (s_state == State::RUNNING);
+        unlock_mutex();
+        return running;
+    }
+
+    esp_err_t wait_until_running(TickType_t timeout_ticks)
+    {
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (s_state == State::RUNNING)
+        {
+            unlock_mutex();
+            return ESP_OK;
+        }
+
+        if (s_state == State::STOPPED || s_state == State::STOPPING)
+        {
+            unlock_mutex();
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        unlock_mutex();
+
+        const EventBits_t bits =
+            xEventGroupWaitBits(s_evt,
+                                READY_BIT,
+                                pdFALSE,
+                                pdTRUE,
+                                timeout_ticks);
+
+        return (bits & READY_BIT) ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t register_uri(const char *uri,
+                           httpd_method_t method,
+                           esp_err_t (*handler)(httpd_req_t *))
+    {
+        if (uri == nullptr || handler == nullptr)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (s_state != State::RUNNING || s_server == nullptr)
+        {
+            unlock_mutex();
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        httpd_uri_t h{};
+        h.uri = uri;
+        h.method = method;
+        h.handler = handler;
+        h.user_ctx = nullptr;
+
+        const esp_err_t rc = httpd_register_uri_handler(s_server, &h);
+        unlock_mutex();
+        return rc;
+    }
+
+    esp_err_t register_producer(const char *uri,
+                                httpd_method_t method,
+                                ProducerOpenFn open)
+    {
+        if (uri == nullptr || open == nullptr)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (s_state != State::RUNNING || s_server == nullptr)
+        {
+            unlock_mutex();
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        httpd_uri_t h{};
+        h.uri = uri;
+        h.method = method;
+        h.handler = handle_producer;
+        h.user_ctx = reinterpret_cast<void *>(open);
+
+        const esp_err_t rc = httpd_register_uri_handler(s_server, &h);
+        unlock_mutex();
+        return rc;
+    }
+
+#if defined(__cpp_consteval)
+    esp_err_t set_route_dispatcher(RouteDispatchFn fn)
+    {
+        // Routed requests arrive through httpd's not-found path, which logs
+        // a warning for each one under this tag.
+        static const char *const kHttpdUriTag = "httpd_uri";
+        static esp_log_level_t s_saved_level = ESP_LOG_WARN;
+
+        if (!ensure_mutex() || !lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        const RouteDispatchFn old = s_route_dispatch.exchange(fn, std::memory_order_acq_rel);
+        if (old == nullptr && fn != nullptr)
+        {
+            s_saved_level = esp_log_level_get(kHttpdUriTag);
+            esp_log_level_set(kHttpdUriTag, std::min(s_saved_level, ESP_LOG_ERROR));
+        }
+        else if (old != nullptr && fn == nullptr)
+        {
+            esp_log_level_set(kHttpdUriTag, s_saved_level);
+        }
+
+        unlock_mutex();
+        return ESP_OK;
+    }
+#endif
+
+#if defined(__cpp_impl_coroutine)
+    esp_err_t register_coro_uri(const char *uri, httpd_method_t method, co::Handler handler)
+    {
+        if (uri == nullptr || handler == nullptr)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (s_state != State::RUNNING || s_server == nullptr)
+        {
+            unlock_mutex();
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        httpd_uri_t h{};
+        h.uri = uri;
+        h.method = method;
+        h.handler = handle_coro;
+        h.user_ctx = reinterpret_cast<void *>(handler);
+
+        const esp_err_t rc = httpd_register_uri_handler(s_server, &h);
+        unlock_mutex();
+        return rc;
+    }
+
+    namespace co::detail
+    {
+        void park(Request &req, Wait wait, uint32_t delay_ms, std::coroutine_handle<> h) noexcept
+        {
+            auto *run = static_cast<CoroRun *>(Access::run_of(req));
+            CoroState next = CoroState::READY;
+
+            switch (wait)
+            {
+            case Wait::READ:
+                next = CoroState::WAIT_READ;
+                break;
+            case Wait::WRITE:
+                next = CoroState::WAIT_WRITE;
+                break;
+            case Wait::TIMER:
+                next = CoroState::WAIT_TIMER;
+                break;
+            case Wait::YIELD:
+                break;
+            }
+
+            if (lock_mutex())
+            {
+                run->resume = h;
+                run->state = next;
+                unlock_mutex();
+            }
+
+            if (next == CoroState::WAIT_TIMER)
+            {
+                // Without a free timer, resume on the next turn instead.
+                run->timer = timer_schedule(delay_ms, 0U, coro_timer_fired, run);
+                if (run->timer == 0U)
+                {
+                    coro_timer_fired(run);
+                }
+            }
+        }
+
+        int try_recv(Request &req, char *buf, size_t cap) noexcept
+        {
+            const int fd = static_cast<CoroRun *>(Access::run_of(req))->sockfd;
+            s_nb_recv_fd.store(fd, std::memory_order_relaxed);
+            const int n = httpd_req_recv(req.native(), buf, cap);
+            s_nb_recv_fd.store(-1, std::memory_order_relaxed);
+            return n;
+        }
+
+        esp_err_t send_chunk(Request &req, const char *buf, ssize_t len) noexcept
+        {
+            auto *run = static_cast<CoroRun *>(Access::run_of(req));
+            begin_nb_send(run->sockfd, run->backlog);
+            const esp_err_t rc = httpd_resp_send_chunk(req.native(), buf, len);
+            end_nb_send();
+            return rc;
+        }
+
+        void *alloc_frame(size_t size) noexcept
+        {
+            if (size > kCoroFrameBytes)
+            {
+                ESP_LOGW(TAG, "Coroutine frame of %u bytes exceeds the %u-byte pool frame.",
+                         static_cast<unsigned>(size), static_cast<unsigned>(kCoroFrameBytes));
+                return nullptr;
+            }
+
+            if (!lock_mutex())
+            {
+                return nullptr;
+            }
+
+            void *frame = nullptr;
+            for (size_t i = 0U; i < kCoroMax; ++i)
+            {
+                if (!s_coro_frame_used[i])
+                {
+                    s_coro_frame_used[i] = true;
+                    frame = s_coro_frames[i].bytes;
+                    break;
+                }
+            }
+
+            unlock_mutex();
+            return frame;
+        }
+
+        void free_frame(void *frame) noexcept
+        {
+            if (frame == nullptr || !lock_mutex())
+            {
+                return;
+            }
+
+            for (size_t i = 0U; i < kCoroMax; ++i)
+            {
+                if (frame == s_coro_frames[i].bytes)
+                {
+                    s_coro_frame_used[i] = false;
+                    break;
+                }
+            }
+
+            unlock_mutex();
+        }
+    } // namespace co::detail
+#endif
+
+    esp_err_t register_protected_uri(const char *uri,
+                                     httpd_method_t method,
+                                     esp_err_t (*handler)(httpd_req_t *))
+    {
+        if (uri == nullptr || handler == nullptr)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (s_state != State::RUNNING || s_server == nullptr)
+        {
+            unlock_mutex();
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        httpd_uri_t h{};
+        h.uri = uri;
+        h.method = method;
+        h.handler = handle_protected;
+        h.user_ctx = reinterpret_cast<void *>(handler);
+
+        const esp_err_t rc = httpd_register_uri_handler(s_server, &h);
+        unlock_mutex();
+        return rc;
+    }
+
+    esp_err_t set_auth_verifier(const AuthVerifier &verifier)
+    {
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        s_auth_verifier = verifier;
+        for (auto &sess : s_auth_sessions)
+        {
+            sess.in_use = false;
+        }
+        unlock_mutex();
+        return ESP_OK;
+    }
+
+    void clear_auth_sessions()
+    {
+        if (!ensure_mutex() || !lock_mutex())
+        {
+            return;
+        }
+
+        for (auto &sess : s_auth_sessions)
+        {
+            sess.in_use = false;
+        }
+        unlock_mutex();
+    }
+
+    esp_err_t unregister_uri(const char *uri, httpd_method_t method)
+    {
+        if (uri == nullptr)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (s_state != State::RUNNING || s_server == nullptr)
+        {
+            unlock_mutex();
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        const esp_err_t rc = httpd_unregister_uri_handler(s_server, uri, method);
+        unlock_mutex();
+        return rc;
+    }
+
+    esp_err_t add_redirect(const char *from,
+                           const char *location,
+                           int status_code,
+                           bool prefix)
+    {
+        if (!is_redirect_code(status_code))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        return add_redirect_rule(from, location, status_code, prefix);
+    }
+
+    esp_err_t add_rewrite(const char *from, const char *target, bool prefix)
+    {
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        return add_redirect_rule(from, target, 0, prefix);
+    }
+
+    esp_err_t remove_redirect(const char *from, bool prefix)
+    {
+        if (from == nullptr)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        const auto edit = [&](RedirectTable &t) -> esp_err_t
+        {
+            auto &rules = prefix ? t.prefix : t.exact;
+            const std::string_view key(from);
+
+            auto it = std::find_if(rules.begin(), rules.end(),
+                                   [&](const RedirectRule &r)
+                                   { return r.from == key; });
+            if (it == rules.end())
+            {
+                return ESP_ERR_NOT_FOUND;
+            }
+
+            rules.erase(it);
+            return ESP_OK;
+        };
+
+        return update_redirects(edit);
+    }
+
+    esp_err_t enable_captive_portal(const char *portal_url)
+    {
+        if (portal_url == nullptr || portal_url[0] == '\0')
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        for (const char *probe : kCaptiveProbes)
+        {
+            const esp_err_t rc = add_redirect_rule(probe, portal_url, 302, false);
+            if (rc != ESP_OK)
+            {
+                return rc;
+            }
+        }
+
+        return ESP_OK;
+    }
+
+    void close_all_sessions()
+    {
+        if (!ensure_mutex())
+        {
+            return;
+        }
+
+        close_all_sessions_internal();
+    }
+
+    Stats get_stats()
+    {
+        Stats st{};
+        st.transfers_started = s_counters.transfers_started.load(std::memory_order_relaxed);
+        st.transfers_completed = s_counters.transfers_completed.load(std::memory_order_relaxed);
+        st.transfers_aborted = s_counters.transfers_aborted.load(std::memory_order_relaxed);
+        st.transfers_inline = s_counters.transfers_inline.load(std::memory_order_relaxed);
+        st.transfers_active = s_counters.transfers_active.load(std::memory_order_relaxed);
+        st.index_hits = s_counters.index_hits.load(std::memory_order_relaxed);
+        st.index_misses = s_counters.index_misses.load(std::memory_order_relaxed);
+        st.cache_hits = s_counters.cache_hits.load(std::memory_order_relaxed);
+        st.cache_misses = s_counters.cache_misses.load(std::memory_order_relaxed);
+        st.cache_bytes = s_counters.cache_bytes.load(std::memory_order_relaxed);
+        st.prewarmed = s_counters.prewarmed.load(std::memory_order_relaxed);
+        st.open_file_hits = s_counters.open_file_hits.load(std::memory_order_relaxed);
+        st.open_file_misses = s_counters.open_file_misses.load(std::memory_order_relaxed);
+        st.auth_verifications = s_counters.auth_verifications.load(std::memory_order_relaxed);
+        st.auth_session_hits = s_counters.auth_session_hits.load(std::memory_order_relaxed);
+        st.auth_failures = s_counters.auth_failures.load(std::memory_order_relaxed);
+        st.sessions_reaped = s_counters.sessions_reaped.load(std::memory_order_relaxed);
+        st.sessions_open = s_counters.sessions_open.load(std::memory_order_relaxed);
+        st.uploads_completed = s_counters.uploads_completed.load(std::memory_order_relaxed);
+        st.uploads_expired = s_counters.uploads_expired.load(std::memory_order_relaxed);
+        st.settings_commits = s_counters.settings_commits.load(std::memory_order_relaxed);
+        st.settings_keys_written = s_counters.settings_keys_written.load(std::memory_order_relaxed);
+        st.pm_boosts = s_counters.pm_boosts.load(std::memory_order_relaxed);
+        st.pm_held = s_pm_held.load(std::memory_order_relaxed);
+        st.mem_degraded = s_mem_degraded.load(std::memory_order_relaxed);
+        st.mem_degraded_entries = s_counters.mem_degraded_entries.load(std::memory_order_relaxed);
+        st.mem_degraded_exits = s_counters.mem_degraded_exits.load(std::memory_order_relaxed);
+        return st;
+    }
+
+    void invalidate_cache()
+    {
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
+        if (!ensure_mutex())
+        {
+            return;
+        }
+
+        invalidate_fs_caches();
+        load_error_pages();
+#endif
+    }
+
+    TimerId schedule_timer(uint32_t delay_ms,
+                           uint32_t period_ms,
+                           TimerFn fn,
+                           void *arg)
+    {
+        if (fn == nullptr || !ensure_mutex())
+        {
+            return 0U;
+        }
+
+        return timer_schedule(delay_ms, period_ms, fn, arg);
+    }
+
+    esp_err_t cancel_timer(TimerId id)
+    {
+        if (id == 0U)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        return timer_cancel(id);
+    }
+
+    esp_err_t serve_blob(const char *uri,
+                         const void *data,
+                         size_t len,
+                         const char *mime,
+                         const char *encoding)
+    {
+        if (uri == nullptr || (data == nullptr && len > 0U))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        std::unique_ptr<Blob> blob(new (std::nothrow) Blob{});
+        if (blob == nullptr)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        blob->uri = uri;
+        init_blob(*blob, data, len, mime, encoding);
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        for (const auto &b : s_blobs)
+        {
+            if (b->uri == blob->uri)
+            {
+                unlock_mutex();
+                return ESP_ERR_INVALID_STATE;
+            }
+        }
+
+        Blob *raw = blob.get();
+        s_blobs.push_back(std::move(blob));
+        const bool running = (s_state == State::RUNNING);
+        unlock_mutex();
+
+        return running ? register_uri_internal(raw->uri.c_str(), HTTP_GET, handle_blob, raw) : ESP_OK;
+    }
+
+    esp_err_t create_stream(const StreamConfig &cfg, Stream **out)
+    {
+        const size_t field_size = sample_type_size(cfg.type);
+        if (out == nullptr || cfg.uri == nullptr || field_size == 0U ||
+            cfg.fields == 0U || cfg.fields > kStreamMaxFields ||
+            cfg.capacity < 64U || cfg.capacity > (1U << 24))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        uint32_t capacity = 64U;
+        while (capacity < cfg.capacity)
+        {
+            capacity <<= 1;
+        }
+
+        const size_t sample_size = field_size * cfg.fields;
+        const size_t bytes = static_cast<size_t>(capacity) * sample_size;
+
+        void *ring = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (ring == nullptr)
+        {
+            ring = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+        }
+
+        auto *s = (ring != nullptr) ? new (std::nothrow) Stream{} : nullptr;
+        if (s == nullptr)
+        {
+            heap_caps_free(ring);
+            return ESP_ERR_NO_MEM;
+        }
+
+        s->uri = cfg.uri;
+        s->type = cfg.type;
+        s->fields = cfg.fields;
+        s->sample_size = static_cast<uint16_t>(sample_size);
+        s->capacity = capacity;
+        s->guard = capacity / 8U;
+        s->ring = static_cast<uint8_t *>(ring);
+
+        if (!lock_mutex())
+        {
+            heap_caps_free(ring);
+            delete s;
+            return ESP_FAIL;
+        }
+
+        if (s_stream_count == kMaxStreams)
+        {
+            unlock_mutex();
+            heap_caps_free(ring);
+            delete s;
+            return ESP_ERR_NO_MEM;
+        }
+
+        s_streams[s_stream_count++] = s;
+        const bool running = (s_state == State::RUNNING);
+        unlock_mutex();
+
+        *out = s;
+        ESP_LOGI(TAG, "Stream %s: %u samples of %u bytes.",
+                 cfg.uri, static_cast<unsigned>(capacity), static_cast<unsigned>(sample_size));
+
+        return running ? register_uri_internal(cfg.uri, HTTP_GET, handle_stream, s) : ESP_OK;
+    }
+
+    void stream_push(Stream *stream, const void *samples, size_t count)
+    {
+        if (stream == nullptr || samples == nullptr)
+        {
+            return;
+        }
+
+        const auto *src = static_cast<const uint8_t *>(samples);
+        const size_t ss = stream->sample_size;
+        uint32_t head = stream->head.load(std::memory_order_relaxed);
+
+        // Publish in guard-sized batches so slots being written are never
+        // inside the window readers are served from.
+        while (count > 0U)
+        {
+            const uint32_t n = static_cast<uint32_t>(std::min<size_t>(count, stream->guard));
+            const uint32_t idx = head & (stream->capacity - 1U);
+            const uint32_t first = std::min(n, stream->capacity - idx);
+
+            std::memcpy(stream->ring + static_cast<size_t>(idx) * ss, src, first * ss);
+            std::memcpy(stream->ring, src + first * ss, (n - first) * ss);
+
+            head += n;
+            src += static_cast<size_t>(n) * ss;
+            count -= n;
+            stream->head.store(head, std::memory_order_release);
+        }
+    }
+
+    Tuning get_tuning()
+    {
+        return stored_tuning();
+    }
+
+    esp_err_t tune(const Tuning &t)
+    {
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        return apply_tuning(t);
+    }
+
+    esp_err_t set_error_page(int code,
+                             const char *body,
+                             size_t len,
+                             const char *content_type)
+    {
+        if (kErrorCodes[error_slot(code)] != code ||
+            (body != nullptr && content_type == nullptr))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        init_error_pages_locked();
+        s_error_pages[error_slot(code)] =
+            (body != nullptr)
+                ? ErrorPage{body, len, content_type, nullptr, true}
+                : canned_error_page(code);
+        unlock_mutex();
+        return ESP_OK;
+    }
+
+    esp_err_t settings_set_u32(const char *key, uint32_t value)
+    {
+        return ensure_mutex() ? put_setting(key, SettingType::U32, &value, sizeof(value)) : ESP_FAIL;
+    }
+
+    esp_err_t settings_set_i32(const char *key, int32_t value)
+    {
+        return ensure_mutex() ? put_setting(key, SettingType::I32, &value, sizeof(value)) : ESP_FAIL;
+    }
+
+    esp_err_t settings_set_str(const char *key, const char *value)
+    {
+        if (value == nullptr)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        return ensure_mutex() ? put_setting(key, SettingType::STR, value, std::strlen(value) + 1U)
+                              : ESP_FAIL;
+    }
+
+    esp_err_t settings_set_blob(const char *key, const void *data, size_t len)
+    {
+        return ensure_mutex() ? put_setting(key, SettingType::BLOB, data, len) : ESP_FAIL;
+    }
+
+    esp_err_t settings_get_u32(const char *key, uint32_t *out)
+    {
+        size_t len = sizeof(*out);
+        return ensure_mutex() ? get_setting(key, SettingType::U32, out, &len) : ESP_FAIL;
+    }
+
+    esp_err_t settings_get_i32(const char *key, int32_t *out)
+    {
+        size_t len = sizeof(*out);
+        return ensure_mutex() ? get_setting(key, SettingType::I32, out, &len) : ESP_FAIL;
+    }
+
+    esp_err_t settings_get_str(const char *key, char *buf, size_t len)
+    {
+        return ensure_mutex() ? get_setting(key, SettingType::STR, buf, &len) : ESP_FAIL;
+    }
+
+    esp_err_t settings_get_blob(const char *key, void *buf, size_t *len)
+    {
+        return ensure_mutex() ? get_setting(key, SettingType::BLOB, buf, len) : ESP_FAIL;
+    }
+
+    esp_err_t settings_flush()
+    {
+        return ensure_mutex() ? flush_settings() : ESP_FAIL;
+    }
+
+    esp_err_t set_cache_rules(const CacheRule *rules, size_t count)
+    {
+        if (rules == nullptr)
+        {
+            rules = kDefaultCacheRules;
+            count = sizeof(kDefaultCacheRules) / sizeof(kDefaultCacheRules[0]);
+        }
+
+        std::vector<CacheRuleEntry> next;
+        next.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (rules[i].pattern == nullptr || rules[i].pattern[0] == '\0')
+            {
+                return ESP_ERR_INVALID_ARG;
+            }
+
+            // Browsers never revalidate these within the long max-age, so
+            // only paths the application names explicitly may use them.
+            if (rules[i].policy >= CachePolicy::LONG && rules[i].pattern[0] != '/')
+            {
+                return ESP_ERR_INVALID_ARG;
+            }
+            next.push_back(CacheRuleEntry{rules[i].pattern, rules[i].policy});
+        }
+
+        if (!ensure_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        if (!lock_mutex())
+        {
+            return ESP_FAIL;
+        }
+
+        s_cache_rules.swap(next);
+        unlock_mutex();
+
+#if CONFIG_HTTP_SERVER_ENABLE_LITTLEFS
+        // Indexed paths carry the policy resolved under the old rules.
+        invalidate_fs_caches();
+#endif
+        return ESP_OK;
+    }
+
+    namespace json
+    {
+        Parser::Parser(Callback cb, void *ctx) noexcept : cb_(cb), ctx_(ctx) {}
+
+        bool Parser::fail(esp_err_t err) noexcept
+        {
+            error_ = err;
+            return false;
+        }
+
+        bool Parser::emit(Event event) noexcept
+        {
+            const Token tok{event,
+                            std::string_view(path_, path_len_),
+                            std::string_view(value_, value_len_)};
+            return cb_ == nullptr || cb_(ctx_, tok) || fail(ESP_ERR_INVALID_ARG);
+        }
+
+        bool Parser::push(bool array) noexcept
+        {
+            if (depth_ >= kMaxDepth)
+            {
+                return fail(ESP_ERR_INVALID_SIZE);
+            }
+            value_len_ = 0;
+            if (!emit(array ? Event::ARRAY_BEGIN : Event::OBJECT_BEGIN))
+            {
+                return false;
+            }
+            stack_[depth_++] = Frame{array, path_len_, 0U};
+            state_ = array ? State::ARRAY_FIRST : State::OBJECT_FIRST;
+            return true;
+        }
+
+        bool Parser::pop(bool array) noexcept
+        {
+            if (stack_[depth_ - 1U].array != array)
+            {
+                return fail(ESP_ERR_INVALID_ARG);
+            }
+            path_len_ = stack_[--depth_].path_len;
+            value_len_ = 0;
+            return emit(array ? Event::ARRAY_END : Event::OBJECT_END) && value_done();
+        }
+
+        bool Parser::begin_element() noexcept
+        {
+            Frame &f = stack_[depth_ - 1U];
+            const int n = std::snprintf(path_ + f.path_len, kMaxPath - f.path_len,
+                                        "[%lu]", static_cast<unsigned long>(f.index));
+            if (n < 0 || static_cast<size_t>(n) >= kMaxPath - f.path_len)
+            {
+                return fail(ESP_ERR_INVALID_SIZE);
+            }
+            path_len_ = static_cast<uint8_t>(f.path_len + n);
+            ++f.index;
+            return true;
+        }
+
+        bool Parser::value_done() noexcept
+        {
+            state_ = (depth_ == 0U) ? State::DONE : State::AFTER_VALUE;
+            return true;
+        }
+
+        bool Parser::append_value(char c) noexcept
+        {
+            if (value_len_ >= kMaxValue)
+            {
+                return fail(ESP_ERR_INVALID_SIZE);
+            }
+            value_[value_len_++] = c;
+            return true;
+        }
+
+        bool Parser::append_utf8(uint32_t cp) noexcept
+        {
+            if (cp < 0x80U)
+            {
+                return append_value(static_cast<char>(cp));
+            }
+            if (cp < 0x800U)
+            {
+                return append_value(static_cast<char>(0xC0U | (cp >> 6))) &&
+                       append_value(static_cast<char>(0x80U | (cp & 0x3FU)));
+            }
+            if (cp < 0x10000U)
+            {
+                return append_value(static_cast<char>(0xE0U | (cp >> 12))) &&
+                       append_value(static_cast<char>(0x80U | ((cp >> 6) & 0x3FU))) &&
+                       append_value(static_cast<char>(0x80U | (cp & 0x3FU)));
+            }
+            return append_value(static_cast<char>(0xF0U | (cp >> 18))) &&
+                   append_value(static_cast<char>(0x80U | ((cp >> 12) & 0x3FU))) &&
+                   append_value(static_cast<char>(0x80U | ((cp >> 6) & 0x3FU))) &&
+                   append_value(static_cast<char>(0x80U | (cp & 0x3FU)));
+        }
+
+        bool Parser::end_string() noexcept
+        {
+            if (high_surrogate_ != 0U)
+            {
+                return fail(ESP_ERR_INVALID_ARG);
+            }
+
+            if (!in_key_)
+            {
+                return emit(Event::STRING) && value_done();
+            }
+
+            // The key replaces the previous member name in the path.
+            const Frame &f = stack_[depth_ - 1U];
+            const size_t dot = (f.path_len > 0U) ? 1U : 0U;
+            if (f.path_len + dot + value_len_ >= kMaxPath)
+            {
+                return fail(ESP_ERR_INVALID_SIZE);
+            }
+            path_len_ = f.path_len;
+            if (dot != 0U)
+            {
+                path_[path_len_++] = '.';
+            }
+            std::memcpy(path_ + path_len_, value_, value_len_);
+            path_len_ = static_cast<uint8_t>(path_len_ + value_len_);
+            state_ = State::COLON;
+            return true;
+        }
+
+        bool Parser::end_number() noexcept
+        {
+            // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+            size_t i = 0U;
+            auto digits = [&]()
+            {
+                const size_t start = i;
+                while (i < value_len_ && value_[i] >= '0' && value_[i] <= '9')
+                {
+                    ++i;
+                }
+                return i - start;
+            };
+
+            if (i < value_len_ && value_[i] == '-')
+            {
+                ++i;
+            }
+            const size_t int_start = i;
+            const size_t int_digits = digits();
+            if (int_digits == 0U || (int_digits > 1U && value_[int_start] == '0'))
+            {
+                return fail(ESP_ERR_INVALID_ARG);
+            }
+            if (i < value_len_ && value_[i] == '.')
+            {
+                ++i;
+                if (digits() == 0U)
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+            }
+            if (i < value_len_ && (value_[i] == 'e' || value_[i] == 'E'))
+            {
+                ++i;
+                if (i < value_len_ && (value_[i] == '+' || value_[i] == '-'))
+                {
+                    ++i;
+                }
+                if (digits() == 0U)
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+            }
+            if (i != value_len_)
+            {
+                return fail(ESP_ERR_INVALID_ARG);
+            }
+
+            return emit(Event::NUMBER) && value_done();
+        }
+
+        /**
+         * Advance by one byte. consumed is cleared when c must be seen again
+         * in the new state (it terminated a number, or opens an element).
+         */
+        bool Parser::step(char c, bool &consumed) noexcept
+        {
+            const bool ws = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+            consumed = true;
+
+            switch (state_)
+            {
+            case State::VALUE:
+                if (ws)
+                {
+                    return true;
+                }
+                value_len_ = 0;
+                if (c == '{' || c == '[')
+                {
+                    return push(c == '[');
+                }
+                if (c == '"')
+                {
+                    in_key_ = false;
+                    state_ = State::STRING;
+                    return true;
+                }
+                if (c == '-' || (c >= '0' && c <= '9'))
+                {
+                    state_ = State::NUMBER;
+                    return append_value(c);
+                }
+                literal_ = (c == 't') ? "true" : (c == 'f') ? "false" : (c == 'n') ? "null" : nullptr;
+                if (literal_ == nullptr)
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                literal_pos_ = 1;
+                state_ = State::LITERAL;
+                return append_value(c);
+
+            case State::OBJECT_FIRST:
+            case State::OBJECT_KEY:
+                if (ws)
+                {
+                    return true;
+                }
+                if (c == '}' && state_ == State::OBJECT_FIRST)
+                {
+                    return pop(false);
+                }
+                if (c != '"')
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                in_key_ = true;
+                value_len_ = 0;
+                state_ = State::STRING;
+                return true;
+
+            case State::COLON:
+                if (ws)
+                {
+                    return true;
+                }
+                if (c != ':')
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                state_ = State::VALUE;
+                return true;
+
+            case State::ARRAY_FIRST:
+                if (ws)
+                {
+                    return true;
+                }
+                if (c == ']')
+                {
+                    return pop(true);
+                }
+                consumed = false;
+                state_ = State::VALUE;
+                return begin_element();
+
+            case State::AFTER_VALUE:
+                if (ws)
+                {
+                    return true;
+                }
+                if (c == '}' || c == ']')
+                {
+                    return pop(c == ']');
+                }
+                if (c != ',')
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                if (stack_[depth_ - 1U].array)
+                {
+                    state_ = State::VALUE;
+                    return begin_element();
+                }
+                state_ = State::OBJECT_KEY;
+                return true;
+
+            case State::STRING:
+                if (c == '"')
+                {
+                    return end_string();
+                }
+                if (c == '\\')
+                {
+                    state_ = State::ESCAPE;
+                    return true;
+                }
+                if (static_cast<unsigned char>(c) < 0x20U || high_surrogate_ != 0U)
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                return append_value(c);
+
+            case State::ESCAPE:
+            {
+                state_ = State::STRING;
+                if (c == 'u')
+                {
+                    code_unit_ = 0U;
+                    hex_digits_ = 0;
+                    state_ = State::UNICODE;
+                    return true;
+                }
+                if (high_surrogate_ != 0U)
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                static constexpr char kFrom[] = "\"\\/bfnrt";
+                static constexpr char kTo[] = "\"\\/\b\f\n\r\t";
+                const char *p = std::strchr(kFrom, c);
+                if (c == '\0' || p == nullptr)
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                return append_value(kTo[p - kFrom]);
+            }
+
+            case State::UNICODE:
+            {
+                const int d = (c >= '0' && c <= '9')   ? c - '0'
+                              : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                              : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                                                       : -1;
+                if (d < 0)
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                code_unit_ = (code_unit_ << 4) | static_cast<uint32_t>(d);
+                if (++hex_digits_ < 4U)
+                {
+                    return true;
+                }
+
+                state_ = State::STRING;
+                const bool high = code_unit_ >= 0xD800U && code_unit_ <= 0xDBFFU;
+                const bool low = code_unit_ >= 0xDC00U && code_unit_ <= 0xDFFFU;
+                if (high_surrogate_ != 0U)
+                {
+                    if (!low)
+                    {
+                        return fail(ESP_ERR_INVALID_ARG);
+                    }
+                    const uint32_t cp =
+                        0x10000U + ((high_surrogate_ - 0xD800U) << 10) + (code_unit_ - 0xDC00U);
+                    high_surrogate_ = 0U;
+                    return append_utf8(cp);
+                }
+                if (high)
+                {
+                    high_surrogate_ = code_unit_;
+                    return true;
+                }
+                if (low)
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                return append_utf8(code_unit_);
+            }
+
+            case State::NUMBER:
+                if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' ||
+                    c == 'E')
+                {
+                    return append_value(c);
+                }
+                consumed = false;
+                return end_number();
+
+            case State::LITERAL:
+                if (c != literal_[literal_pos_])
+                {
+                    return fail(ESP_ERR_INVALID_ARG);
+                }
+                if (!append_value(c))
+                {
+                    return false;
+                }
+                if (literal_[++literal_pos_] != '\0')
+                {
+                    return true;
+                }
+                return emit(literal_[0] == 'n' ? Event::NUL : Event::BOOL) && value_done();
+
+            case State::DONE:
+                return ws || fail(ESP_ERR_INVALID_ARG);
+            }
+
+            return fail(ESP_ERR_INVALID_ARG);
+        }
+
+        esp_err_t Parser::feed(const char *data, size_t len) noexcept
+        {
+            for (size_t i = 0; i < len && error_ == ESP_OK; ++i)
+            {
+                bool consumed = false;
+                while (!consumed && step(data[i], consumed))
+                {
+                }
+                if (error_ == ESP_OK)
+                {
+                    ++offset_;
+                }
+            }
+            return error_;
+        }
+
+        esp_err_t Parser::finish() noexcept
+        {
+            if (error_ == ESP_OK && state_ == State::NUMBER && depth_ == 0U)
+            {
+                (void)end_number();
+            }
+            if (error_ == ESP_OK && state_ != State::DONE)
+            {
+                error_ = ESP_ERR_INVALID_ARG;
+            }
+            return error_;
+        }
+
+        namespace
+        {
+            struct BindCtx
+            {
+                const Binding *bindings;
+                size_t count;
+                bool allow_unknown;
+            };
+
+            bool store_binding(const Binding &b, const Token &tok)
+            {
+                if (b.type == BindType::IGNORE)
+                {
+                    return true;
+                }
+
+                if (b.type == BindType::STRING)
+                {
+                    if (tok.event != Event::STRING || tok.text.size() >= b.size ||
+                        tok.text.find('\0') != std::string_view::npos)
+                    {
+                        return false;
+                    }
+                    char *dst = static_cast<char *>(b.target);
+                    std::memcpy(dst, tok.text.data(), tok.text.size());
+                    dst[tok.text.size()] = '\0';
+                    return true;
+                }
+
+                if (b.type == BindType::BOOL)
+                {
+                    if (tok.event != Event::BOOL)
+                    {
+                        return false;
+                    }
+                    *static_cast<bool *>(b.target) = tok.text == "true";
+                    return true;
+                }
+
+                if (tok.event != Event::NUMBER)
+                {
+                    return false;
+                }
+
+                // The token is at most Parser::kMaxValue bytes.
+                char num[Parser::kMaxValue + 1U];
+                std::memcpy(num, tok.text.data(), tok.text.size());
+                num[tok.text.size()] = '\0';
+
+                if (b.type == BindType::FLOAT)
+                {
+                    *static_cast<float *>(b.target) = std::strtof(num, nullptr);
+                    return true;
+                }
+
+                char *end = nullptr;
+                errno = 0;
+                const long long v = std::strtoll(num, &end, 10);
+                if (errno != 0 || *end != '\0')
+                {
+                    return false; // Fractions and exponents are not integers.
+                }
+
+                switch (b.type)
+                {
+                case BindType::U8:
+                    if (v < 0 || v > UINT8_MAX)
+                        return false;
+                    *static_cast<uint8_t *>(b.target) = static_cast<uint8_t>(v);
+                    return true;
+                case BindType::U16:
+                    if (v < 0 || v > UINT16_MAX)
+                        return false;
+                    *static_cast<uint16_t *>(b.target) = static_cast<uint16_t>(v);
+                    return true;
+                case BindType::U32:
+                    if (v < 0 || v > UINT32_MAX)
+                        return false;
+                    *static_cast<uint32_t *>(b.target) = static_cast<uint32_t>(v);
+                    return true;
+                case BindType::I32:
+                    if (v < INT32_MIN || v > INT32_MAX)
+                        return false;
+                    *static_cast<int32_t *>(b.target) = static_cast<int32_t>(v);
+                    return true;
+                default:
+                    return false;
+                }
+            }
+
+            bool on_bind_token(void *ctx, const Token &tok)
+            {
+                const auto *bc = static_cast<const BindCtx *>(ctx);
+                if (tok.event == Event::OBJECT_BEGIN || tok.event == Event::OBJECT_END ||
+                    tok.event == Event::ARRAY_BEGIN || tok.event == Event::ARRAY_END)
+                {
+                    return true;
+                }
+
+                for (size_t i = 0; i < bc->count; ++i)
+                {
+                    if (tok.path == bc->bindings[i].path)
+                    {
+                        return store_binding(bc->bindings[i], tok);
+                    }
+                }
+                return bc->allow_unknown;
+            }
+        } // namespace
+
+        esp_err_t parse_into(const char *data,
+                             size_t len,
+                             const Binding *bindings,
+                             size_t count,
+                             bool allow_unknown)
+        {
+            if ((data == nullptr && len != 0U) || (bindings == nullptr && count != 0U))
+            {
+                return ESP_ERR_INVALID_ARG;
+            }
+
+            BindCtx ctx{bindings, count, allow_unknown};
+            Parser p(on_bind_token, &ctx);
+            const esp_err_t rc = p.feed(data, len);
+            return (rc != ESP_OK) ? rc : p.finish();
+        }
+
+        esp_err_t recv_into(httpd_req_t *req,
+                            const Binding *bindings,
+                            size_t count,
+                            bool allow_unknown)
+        {
+            if (req == nullptr || (bindings == nullptr && count != 0U))
+            {
+                return ESP_ERR_INVALID_ARG;
+            }
+
+            BindCtx ctx{bindings, count, allow_unknown};
+            Parser p(on_bind_token, &ctx);
+
+            char buf[128];
+            size_t left = req->content_len;
+            while (left > 0U)
+            {
+                const int n = httpd_req_recv(req, buf, std::min(left, sizeof(buf)));
+                if (n <= 0)
+                {
+                    return (n == HTTPD_SOCK_ERR_TIMEOUT) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+                }
+                left -= static_cast<size_t>(n);
+
+                const esp_err_t rc = p.feed(buf, static_cast<size_t>(n));
+                if (rc != ESP_OK)
+                {
+                    return rc;
+                }
+            }
+
+            return p.finish();
+        }
+    } // namespace json
 } // namespace http_srv
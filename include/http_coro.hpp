@@ -0,0 +1,332 @@
+#pragma once
+
+/**
+ * @file http_coro.hpp
+ * @brief C++20 coroutine handlers for the embedded HTTP server module.
+ *
+ * A coroutine handler is written as sequential code that co_awaits body
+ * data, chunk sends, timers and yields. It never runs on the httpd task: the
+ * request is detached when it arrives and the coroutine runs on the module's
+ * worker task, which resumes it once the awaited condition holds. Any number
+ * of slow handlers can be suspended at once without a FreeRTOS task each.
+ *
+ * Suspended state lives in the coroutine frame, which is taken from a fixed
+ * pool of CONFIG_HTTP_SERVER_CORO_MAX_HANDLERS frames of
+ * CONFIG_HTTP_SERVER_CORO_FRAME_BYTES each, one per active request, never
+ * from the general heap. When no frame is free, or the handler's frame is
+ * larger than a pool frame, the client gets 503.
+ *
+ * Example:
+ * @code
+ * http_srv::co::Task echo(http_srv::co::Request &r)
+ * {
+ *     char buf[256];
+ *     httpd_resp_set_type(r.native(), "text/plain");
+ *     while (true)
+ *     {
+ *         const int n = co_await r.recv(buf, sizeof(buf));
+ *         if (n <= 0)
+ *             break;
+ *         if (co_await r.send_chunk(buf, n) != ESP_OK)
+ *             co_return ESP_FAIL;
+ *         co_await r.sleep(10);
+ *     }
+ *     co_return co_await r.send_chunk(nullptr, 0);
+ * }
+ *
+ * http_srv::register_coro_uri("/echo", HTTP_POST, echo);
+ * @endcode
+ */
+
+#include "http_server.hpp"
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+
+namespace http_srv::co
+{
+    class Request;
+
+    namespace detail
+    {
+        /** Condition a suspended handler waits for. */
+        enum class Wait : uint8_t
+        {
+            READ,  ///< Client socket readable.
+            WRITE, ///< Client socket writable.
+            TIMER, ///< Delay elapsed.
+            YIELD  ///< Next worker turn.
+        };
+
+        /** Resume h on the worker task once the condition holds. */
+        void park(Request &req, Wait wait, uint32_t delay_ms, std::coroutine_handle<> h) noexcept;
+
+        /**
+         * httpd_req_recv() that does not wait for the socket: returns
+         * HTTPD_SOCK_ERR_TIMEOUT when no body bytes are available yet.
+         */
+        int try_recv(Request &req, char *buf, size_t cap) noexcept;
+
+        /**
+         * httpd_resp_send_chunk() that does not wait for the socket: what it
+         * cannot take yet is kept and sent before the handler's next write.
+         */
+        esp_err_t send_chunk(Request &req, const char *buf, ssize_t len) noexcept;
+
+        /** Take a frame from the pool; nullptr if none fits. */
+        void *alloc_frame(size_t size) noexcept;
+
+        /** Return a frame to the pool. */
+        void free_frame(void *frame) noexcept;
+
+        struct Access;
+    } // namespace detail
+
+    /**
+     * @brief Return type of coroutine handlers. The handler co_returns an
+     *        esp_err_t once its response is complete; anything but ESP_OK
+     *        closes the connection.
+     */
+    class Task
+    {
+    public:
+        struct promise_type
+        {
+            static void *operator new(size_t size) noexcept
+            {
+                return detail::alloc_frame(size);
+            }
+
+            static void operator delete(void *frame) noexcept
+            {
+                detail::free_frame(frame);
+            }
+
+            static Task get_return_object_on_allocation_failure() noexcept
+            {
+                return Task{};
+            }
+
+            Task get_return_object() noexcept
+            {
+                return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_value(esp_err_t rc) noexcept { result = rc; }
+            void unhandled_exception() noexcept { result = ESP_FAIL; }
+
+            esp_err_t result = ESP_OK;
+        };
+
+        using Handle = std::coroutine_handle<promise_type>;
+
+        Task() noexcept = default;
+        explicit Task(Handle h) noexcept : h_(h) {}
+        Task(Task &&other) noexcept : h_(other.h_) { other.h_ = nullptr; }
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+        Task &operator=(Task &&) = delete;
+
+        ~Task()
+        {
+            if (h_)
+            {
+                h_.destroy();
+            }
+        }
+
+        explicit operator bool() const noexcept { return static_cast<bool>(h_); }
+
+        /** Give up ownership of the coroutine. */
+        Handle release() noexcept
+        {
+            Handle h = h_;
+            h_ = nullptr;
+            return h;
+        }
+
+    private:
+        Handle h_{};
+    };
+
+    /**
+     * @brief Request handed to a coroutine handler.
+     *
+     * native() is the detached (async) request; headers can be set on it
+     * with the usual httpd_resp_* calls. The awaitables below must only be
+     * used from the handler that received this Request.
+     */
+    class Request
+    {
+    public:
+        Request(const Request &) = delete;
+        Request &operator=(const Request &) = delete;
+
+        httpd_req_t *native() const noexcept { return req_; }
+
+        /**
+         * @brief Receive up to cap body bytes once they are available.
+         *
+         * Resumes with the httpd_req_recv() result: the byte count, 0 at the
+         * end of the body, or a negative HTTPD_SOCK_ERR_* value.
+         */
+        auto recv(char *buf, size_t cap) noexcept
+        {
+            struct Awaiter
+            {
+                Request &r;
+                char *buf;
+                size_t cap;
+                int result;
+
+                // Once the whole body is in, the client only waits for the
+                // response, so the socket would never become readable. Bytes
+                // httpd buffered with the headers, or that are already on
+                // the socket, are taken without waiting either.
+                bool await_ready() noexcept
+                {
+                    if (r.received_ >= r.req_->content_len)
+                    {
+                        result = 0;
+                        return true;
+                    }
+                    result = detail::try_recv(r, buf, cap);
+                    return result != HTTPD_SOCK_ERR_TIMEOUT;
+                }
+
+                void await_suspend(std::coroutine_handle<> h) noexcept
+                {
+                    detail::park(r, detail::Wait::READ, 0U, h);
+                }
+
+                int await_resume() noexcept
+                {
+                    if (result == HTTPD_SOCK_ERR_TIMEOUT)
+                    {
+                        result = httpd_req_recv(r.req_, buf, cap);
+                    }
+                    if (result > 0)
+                    {
+                        r.received_ += static_cast<size_t>(result);
+                    }
+                    return result;
+                }
+            };
+            return Awaiter{*this, buf, cap, 0};
+        }
+
+        /**
+         * @brief Send one chunk once the socket can take data. len 0 ends the
+         *        response. Resumes with the httpd_resp_send_chunk() result.
+         *
+         * The chunk is handed over without waiting: bytes the socket does not
+         * take at once are copied and sent as it drains, so buf may be reused
+         * on resume. The next send_chunk() resumes only after they have gone,
+         * and the response is completed only once everything has been sent.
+         */
+        auto send_chunk(const char *buf, ssize_t len) noexcept
+        {
+            struct Awaiter
+            {
+                Request &r;
+                const char *buf;
+                ssize_t len;
+
+                bool await_ready() const noexcept { return false; }
+
+                void await_suspend(std::coroutine_handle<> h) noexcept
+                {
+                    detail::park(r, detail::Wait::WRITE, 0U, h);
+                }
+
+                esp_err_t await_resume() noexcept
+                {
+                    return detail::send_chunk(r, buf, len);
+                }
+            };
+            return Awaiter{*this, buf, len};
+        }
+
+        /**
+         * @brief Suspend for at least ms milliseconds (timer wheel
+         *        resolution).
+         */
+        auto sleep(uint32_t ms) noexcept
+        {
+            struct Awaiter
+            {
+                Request &r;
+                uint32_t ms;
+
+                bool await_ready() const noexcept { return false; }
+
+                void await_suspend(std::coroutine_handle<> h) noexcept
+                {
+                    detail::park(r, detail::Wait::TIMER, ms, h);
+                }
+
+                void await_resume() const noexcept {}
+            };
+            return Awaiter{*this, ms};
+        }
+
+        /**
+         * @brief Let other work on the worker task run, then continue.
+         */
+        auto yield() noexcept
+        {
+            struct Awaiter
+            {
+                Request &r;
+
+                bool await_ready() const noexcept { return false; }
+
+                void await_suspend(std::coroutine_handle<> h) noexcept
+                {
+                    detail::park(r, detail::Wait::YIELD, 0U, h);
+                }
+
+                void await_resume() const noexcept {}
+            };
+            return Awaiter{*this};
+        }
+
+    private:
+        friend struct detail::Access;
+
+        Request() noexcept = default;
+
+        httpd_req_t *req_ = nullptr;
+        void *run_ = nullptr;
+        size_t received_ = 0; // Body bytes returned by recv() so far.
+    };
+
+    /** @brief Coroutine handler signature. */
+    using Handler = Task (*)(Request &req);
+} // namespace http_srv::co
+
+namespace http_srv
+{
+    /**
+     * @brief Register a coroutine handler.
+     *
+     * The handler runs on the worker task; see http_coro.hpp. Like
+     * register_uri(), routes are dropped by stop(), and suspended handlers
+     * are destroyed and their connections closed.
+     *
+     * @param uri URI pattern.
+     * @param method HTTP method.
+     * @param handler Coroutine handler.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG if uri or handler is null.
+     * @return ESP_ERR_INVALID_STATE if the server is not running.
+     * @return Other esp_err_t values from httpd_register_uri_handler().
+     */
+    esp_err_t register_coro_uri(const char *uri, httpd_method_t method, co::Handler handler);
+} // namespace http_srv
+
+#endif // __cpp_impl_coroutine
@@ -0,0 +1,235 @@
+#pragma once
+
+/**
+ * @file http_json.hpp
+ * @brief Streaming JSON request bodies for the embedded HTTP server module.
+ *
+ * json::Parser is a SAX-style tokenizer with fixed memory: it is fed the
+ * body as it arrives from httpd_req_recv(), in chunks of any size, and
+ * reports every scalar with its path ("wifi.ssid", "peers[2].port"). No tree
+ * is built and nothing is allocated, so a body of any size is parsed in a few
+ * hundred bytes.
+ *
+ * The binding helpers sit on top of it and write fields straight into a C++
+ * struct:
+ * @code
+ * struct Config
+ * {
+ *     char ssid[33];
+ *     uint16_t port;
+ *     bool dhcp;
+ * } cfg = current_config();
+ *
+ * const http_srv::json::Binding fields[] = {
+ *     http_srv::json::bind("wifi.ssid", cfg.ssid),
+ *     http_srv::json::bind("net.port", cfg.port),
+ *     http_srv::json::bind("net.dhcp", cfg.dhcp),
+ * };
+ *
+ * if (http_srv::json::recv_into(req, fields, 3) != ESP_OK)
+ *     return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, nullptr);
+ * @endcode
+ *
+ * Fields are written as they are parsed, so after an error the struct may be
+ * partly updated; bind a copy and commit it on success.
+ */
+
+#include "http_server.hpp"
+
+#include <string_view>
+
+namespace http_srv::json
+{
+    /** @brief Kind of a parser token. */
+    enum class Event : uint8_t
+    {
+        OBJECT_BEGIN,
+        OBJECT_END,
+        ARRAY_BEGIN,
+        ARRAY_END,
+        STRING,
+        NUMBER,
+        BOOL,
+        NUL
+    };
+
+    /**
+     * @brief One parser token. The views point into the parser and are only
+     *        valid during the callback.
+     */
+    struct Token
+    {
+        Event event;
+        /** Path of the value: keys joined by '.', array indices as "[n]". Empty for the root. */
+        std::string_view path;
+        /** Unescaped string, number literal, or "true"/"false"/"null". */
+        std::string_view text;
+    };
+
+    /**
+     * @brief Token callback. Return false to stop parsing; feed() then
+     *        returns ESP_ERR_INVALID_ARG.
+     */
+    using Callback = bool (*)(void *ctx, const Token &tok);
+
+    /**
+     * @brief Incremental JSON tokenizer with fixed memory.
+     *
+     * Documents may nest kMaxDepth containers deep, paths may be kMaxPath
+     * bytes long and strings and numbers kMaxValue bytes long (after
+     * unescaping); longer input fails with ESP_ERR_INVALID_SIZE.
+     */
+    class Parser
+    {
+    public:
+        static constexpr size_t kMaxDepth = 8;
+        static constexpr size_t kMaxPath = 96;
+        static constexpr size_t kMaxValue = 128;
+
+        Parser(Callback cb, void *ctx) noexcept;
+
+        /**
+         * @brief Parse the next len bytes of the document.
+         *
+         * @return ESP_OK if the input so far is valid.
+         * @return ESP_ERR_INVALID_ARG on a syntax error or a rejected token.
+         * @return ESP_ERR_INVALID_SIZE if a limit above is exceeded.
+         */
+        esp_err_t feed(const char *data, size_t len) noexcept;
+
+        /**
+         * @brief Check that the input fed so far is one complete document.
+         *
+         * @return ESP_OK, or the error from feed(), or ESP_ERR_INVALID_ARG if
+         *         the document is incomplete.
+         */
+        esp_err_t finish() noexcept;
+
+        /** @brief Bytes consumed so far; on error, the offset of the bad byte. */
+        size_t offset() const noexcept { return offset_; }
+
+    private:
+        enum class State : uint8_t
+        {
+            VALUE,
+            OBJECT_FIRST,
+            OBJECT_KEY,
+            COLON,
+            ARRAY_FIRST,
+            AFTER_VALUE,
+            STRING,
+            ESCAPE,
+            UNICODE,
+            NUMBER,
+            LITERAL,
+            DONE
+        };
+
+        struct Frame
+        {
+            bool array;
+            uint8_t path_len; // Length of the container's own path.
+            uint32_t index;   // Next element index for arrays.
+        };
+
+        bool step(char c, bool &consumed) noexcept;
+        bool fail(esp_err_t err) noexcept;
+        bool emit(Event event) noexcept;
+        bool push(bool array) noexcept;
+        bool pop(bool array) noexcept;
+        bool begin_element() noexcept;
+        bool end_string() noexcept;
+        bool end_number() noexcept;
+        bool append_value(char c) noexcept;
+        bool append_utf8(uint32_t cp) noexcept;
+        bool value_done() noexcept;
+
+        Callback cb_;
+        void *ctx_;
+        State state_ = State::VALUE;
+        esp_err_t error_ = ESP_OK;
+        bool in_key_ = false;
+        uint8_t depth_ = 0;
+        uint8_t path_len_ = 0;
+        uint8_t value_len_ = 0;
+        uint8_t hex_digits_ = 0;
+        uint8_t literal_pos_ = 0;
+        const char *literal_ = nullptr;
+        uint32_t code_unit_ = 0;
+        uint32_t high_surrogate_ = 0;
+        size_t offset_ = 0;
+        Frame stack_[kMaxDepth]{};
+        char path_[kMaxPath]{};
+        char value_[kMaxValue]{};
+    };
+
+    /** @brief Destination type of a Binding. */
+    enum class BindType : uint8_t
+    {
+        IGNORE,
+        BOOL,
+        U8,
+        U16,
+        U32,
+        I32,
+        FLOAT,
+        STRING
+    };
+
+    /** @brief Path-to-field binding; build with bind() or ignore(). */
+    struct Binding
+    {
+        const char *path;
+        BindType type;
+        void *target;
+        size_t size; // Buffer size for STRING, including the terminator.
+    };
+
+    inline Binding bind(const char *path, bool &v) { return {path, BindType::BOOL, &v, sizeof(v)}; }
+    inline Binding bind(const char *path, uint8_t &v) { return {path, BindType::U8, &v, sizeof(v)}; }
+    inline Binding bind(const char *path, uint16_t &v) { return {path, BindType::U16, &v, sizeof(v)}; }
+    inline Binding bind(const char *path, uint32_t &v) { return {path, BindType::U32, &v, sizeof(v)}; }
+    inline Binding bind(const char *path, int32_t &v) { return {path, BindType::I32, &v, sizeof(v)}; }
+    inline Binding bind(const char *path, float &v) { return {path, BindType::FLOAT, &v, sizeof(v)}; }
+
+    template <size_t N>
+    inline Binding bind(const char *path, char (&s)[N])
+    {
+        return {path, BindType::STRING, s, N};
+    }
+
+    /** @brief Accept and discard the scalar at path. */
+    inline Binding ignore(const char *path) { return {path, BindType::IGNORE, nullptr, 0U}; }
+
+    /**
+     * @brief Parse a complete body held in memory into bindings.
+     *
+     * Every scalar must match a binding's path exactly and fit its type and
+     * range; a longer string or an unknown path is an error unless
+     * allow_unknown is set, in which case unknown paths are skipped.
+     * Bindings absent from the body are left untouched.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG on a syntax, type, range or unknown-path
+     *         error.
+     * @return ESP_ERR_INVALID_SIZE if a parser limit is exceeded.
+     */
+    esp_err_t parse_into(const char *data,
+                         size_t len,
+                         const Binding *bindings,
+                         size_t count,
+                         bool allow_unknown = false);
+
+    /**
+     * @brief Receive the request body and parse it into bindings as it
+     *        arrives, using a small stack buffer.
+     *
+     * @return The parse_into() results, and:
+     * @return ESP_ERR_TIMEOUT if the client stopped sending.
+     * @return ESP_FAIL if the connection failed.
+     */
+    esp_err_t recv_into(httpd_req_t *req,
+                        const Binding *bindings,
+                        size_t count,
+                        bool allow_unknown = false);
+} // namespace http_srv::json
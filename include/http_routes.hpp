@@ -0,0 +1,357 @@
+#pragma once
+
+/**
+ * @file http_routes.hpp
+ * @brief Compile-time route table for the embedded HTTP server module.
+ *
+ * A route table is built and checked entirely at compile time: malformed
+ * patterns, duplicate method/path pairs and null handlers are compile
+ * errors. Exact paths are looked up through a perfect hash computed by the
+ * compiler, so dispatch costs one hash and one string compare however many
+ * routes there are. Patterns ending in a slash and a star match by prefix,
+ * longest first.
+ *
+ * Installed tables take no httpd URI handler slots and do not count against
+ * CONFIG_HTTP_SERVER_MAX_URI_HANDLERS: they are consulted by the module's
+ * catch-all (not-found) handler before redirects and static files. A path
+ * that matches with another method gets 405.
+ *
+ * Because routed requests reach the table through httpd's not-found path,
+ * httpd first compares the URI against every registered URI handler, so
+ * keep register_uri() routes few when the table carries the hot paths.
+ * httpd also logs a "not found" warning for each such request; installing
+ * a table raises the "httpd_uri" log tag to ESP_LOG_ERROR to silence it.
+ *
+ * Example:
+ * @code
+ * static esp_err_t get_x(httpd_req_t *req);
+ * static esp_err_t post_x(httpd_req_t *req);
+ * static esp_err_t get_file(httpd_req_t *req);
+ *
+ * static constexpr auto kRoutes = http_srv::routes(
+ *     http_srv::get("/api/x", get_x),
+ *     http_srv::post("/api/x", post_x),
+ *     http_srv::get("/api/files/" "*", get_file));
+ *
+ * http_srv::install_routes<kRoutes>();
+ * @endcode
+ */
+
+#include "http_server.hpp"
+
+#if defined(__cpp_consteval)
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+
+namespace http_srv
+{
+    /** @brief Route handler signature; the same as an httpd URI handler. */
+    using RouteHandler = esp_err_t (*)(httpd_req_t *req);
+
+    /** @brief One entry of a route table. */
+    struct Route
+    {
+        httpd_method_t method;
+        std::string_view pattern;
+        RouteHandler handler;
+    };
+
+    constexpr Route route(httpd_method_t method, std::string_view pattern, RouteHandler handler)
+    {
+        return Route{method, pattern, handler};
+    }
+
+    constexpr Route get(std::string_view pattern, RouteHandler handler)
+    {
+        return Route{HTTP_GET, pattern, handler};
+    }
+
+    constexpr Route post(std::string_view pattern, RouteHandler handler)
+    {
+        return Route{HTTP_POST, pattern, handler};
+    }
+
+    constexpr Route put(std::string_view pattern, RouteHandler handler)
+    {
+        return Route{HTTP_PUT, pattern, handler};
+    }
+
+    constexpr Route del(std::string_view pattern, RouteHandler handler)
+    {
+        return Route{HTTP_DELETE, pattern, handler};
+    }
+
+    /** @brief How a route dispatcher matched a request path. */
+    enum class RouteMatch : uint8_t
+    {
+        NONE,         ///< No route has this path.
+        WRONG_METHOD, ///< A route has this path, but not for this method.
+        MATCHED,      ///< A handler ran; the return value is its result.
+    };
+
+    /**
+     * @brief Dispatcher called by the catch-all handler with the request
+     *        path (no query).
+     *
+     * Sets match to say whether a handler ran. The return value is the
+     * handler's result for RouteMatch::MATCHED and ESP_OK otherwise, so a
+     * handler may return any error, ESP_ERR_NOT_SUPPORTED included, without
+     * it being mistaken for a method mismatch.
+     */
+    using RouteDispatchFn = esp_err_t (*)(httpd_req_t *req, std::string_view path, RouteMatch &match);
+
+    /**
+     * @brief Install (or, with nullptr, remove) the route dispatcher.
+     *
+     * Prefer install_routes(). The dispatcher survives stop()/start().
+     * While one is installed the "httpd_uri" log tag is held at
+     * ESP_LOG_ERROR; removing it restores the previous level.
+     *
+     * @return ESP_OK, or ESP_FAIL if the module mutex cannot be created.
+     */
+    esp_err_t set_route_dispatcher(RouteDispatchFn fn);
+
+    namespace detail
+    {
+        // Deliberately never defined or constexpr: reaching one of these
+        // while building a table makes the build fail, and the function
+        // name is the diagnostic.
+        void route_pattern_must_start_with_slash();
+        void route_pattern_has_invalid_character();
+        void route_wildcard_must_be_trailing_slash_star();
+        void route_handler_is_null();
+        void route_is_duplicated();
+        void route_table_has_no_perfect_hash();
+
+        constexpr uint32_t route_hash(std::string_view s, uint32_t seed)
+        {
+            uint32_t h = 2166136261U ^ (seed * 0x9E3779B9U);
+            for (const char c : s)
+            {
+                h ^= static_cast<uint8_t>(c);
+                h *= 16777619U;
+            }
+            h ^= h >> 15;
+            h *= 0x2C1B3C6DU;
+            h ^= h >> 12;
+            return h;
+        }
+
+        // Four slots per route keeps the seed search short for tables of
+        // a few dozen routes.
+        constexpr size_t route_slots(size_t n)
+        {
+            size_t slots = 2;
+            while (slots < n * 4U)
+            {
+                slots <<= 1;
+            }
+            return slots;
+        }
+
+        constexpr bool is_prefix_pattern(std::string_view p)
+        {
+            return p.size() >= 2 && p.substr(p.size() - 2) == "/*";
+        }
+
+        constexpr void validate_route(const Route &r)
+        {
+            if (r.handler == nullptr)
+            {
+                route_handler_is_null();
+            }
+            if (r.pattern.empty() || r.pattern.front() != '/')
+            {
+                route_pattern_must_start_with_slash();
+            }
+            for (size_t i = 0; i < r.pattern.size(); ++i)
+            {
+                const char c = r.pattern[i];
+                if (c <= ' ' || c == '?' || c == '#' || c == '%' || static_cast<unsigned char>(c) >= 0x7F)
+                {
+                    route_pattern_has_invalid_character();
+                }
+                if (c == '*' && (i + 1 != r.pattern.size() || !is_prefix_pattern(r.pattern)))
+                {
+                    route_wildcard_must_be_trailing_slash_star();
+                }
+            }
+        }
+
+        // Exact routes first, then prefix routes longest first, so each
+        // group of methods for one pattern is contiguous.
+        constexpr bool route_less(const Route &a, const Route &b)
+        {
+            const bool pa = is_prefix_pattern(a.pattern);
+            const bool pb = is_prefix_pattern(b.pattern);
+            if (pa != pb)
+            {
+                return pb;
+            }
+            if (pa && a.pattern.size() != b.pattern.size())
+            {
+                return a.pattern.size() > b.pattern.size();
+            }
+            if (a.pattern != b.pattern)
+            {
+                return a.pattern < b.pattern;
+            }
+            return a.method < b.method;
+        }
+    } // namespace detail
+
+    /**
+     * @brief Route table produced by routes(); usable only as a constexpr
+     *        object passed to install_routes().
+     */
+    template <size_t N>
+    class RouteTable
+    {
+    public:
+        static constexpr size_t kSlots = detail::route_slots(N);
+
+        consteval explicit RouteTable(std::array<Route, N> routes) : routes_(routes)
+        {
+            for (const Route &r : routes_)
+            {
+                detail::validate_route(r);
+            }
+            std::sort(routes_.begin(), routes_.end(), detail::route_less);
+
+            for (size_t i = 0; i < N; ++i)
+            {
+                if (i > 0 && routes_[i].pattern == routes_[i - 1].pattern)
+                {
+                    if (routes_[i].method == routes_[i - 1].method)
+                    {
+                        detail::route_is_duplicated();
+                    }
+                    groups_[group_count_ - 1].end = static_cast<uint16_t>(i + 1);
+                    continue;
+                }
+                if (!detail::is_prefix_pattern(routes_[i].pattern))
+                {
+                    ++exact_count_;
+                }
+                groups_[group_count_++] = Group{static_cast<uint16_t>(i), static_cast<uint16_t>(i + 1)};
+            }
+
+            find_seed();
+        }
+
+        /** @brief Look up path and run the matching handler; see RouteDispatchFn. */
+        esp_err_t dispatch(httpd_req_t *req, std::string_view path, RouteMatch &match) const
+        {
+            if (exact_count_ > 0)
+            {
+                const uint16_t g = slots_[detail::route_hash(path, seed_) & (kSlots - 1U)];
+                if (g != kEmpty && routes_[groups_[g].begin].pattern == path)
+                {
+                    return run_group(groups_[g], req, match);
+                }
+            }
+
+            for (size_t g = exact_count_; g < group_count_; ++g)
+            {
+                const std::string_view p = routes_[groups_[g].begin].pattern;
+                if (path.substr(0, p.size() - 1U) == p.substr(0, p.size() - 1U))
+                {
+                    return run_group(groups_[g], req, match);
+                }
+            }
+
+            match = RouteMatch::NONE;
+            return ESP_OK;
+        }
+
+    private:
+        static constexpr uint16_t kEmpty = 0xFFFF;
+        static constexpr uint32_t kMaxSeeds = 1U << 16;
+
+        struct Group
+        {
+            uint16_t begin;
+            uint16_t end;
+        };
+
+        constexpr void find_seed()
+        {
+            for (uint32_t seed = 0; seed < kMaxSeeds; ++seed)
+            {
+                slots_.fill(kEmpty);
+                bool ok = true;
+                for (size_t g = 0; g < exact_count_ && ok; ++g)
+                {
+                    const size_t slot = detail::route_hash(routes_[groups_[g].begin].pattern, seed) & (kSlots - 1U);
+                    ok = slots_[slot] == kEmpty;
+                    slots_[slot] = static_cast<uint16_t>(g);
+                }
+                if (ok)
+                {
+                    seed_ = seed;
+                    return;
+                }
+            }
+            detail::route_table_has_no_perfect_hash();
+        }
+
+        esp_err_t run_group(const Group &g, httpd_req_t *req, RouteMatch &match) const
+        {
+            for (size_t i = g.begin; i < g.end; ++i)
+            {
+                if (routes_[i].method == req->method)
+                {
+                    match = RouteMatch::MATCHED;
+                    return routes_[i].handler(req);
+                }
+            }
+            match = RouteMatch::WRONG_METHOD;
+            return ESP_OK;
+        }
+
+        std::array<Route, N> routes_{};
+        std::array<Group, N> groups_{};
+        std::array<uint16_t, kSlots> slots_{};
+        size_t group_count_ = 0;
+        size_t exact_count_ = 0;
+        uint32_t seed_ = 0;
+    };
+
+    /**
+     * @brief Build a route table at compile time.
+     *
+     * Every pattern must start with '/', contain no whitespace, '?', '#'
+     * or '%', and may only use '*' as its last character, right after a '/'
+     * (which matches the prefix up to and including the slash). Each method/pattern pair must
+     * be unique. Violations fail the build.
+     */
+    template <typename... R>
+    consteval auto routes(R... r)
+    {
+        static_assert(sizeof...(R) > 0, "route table is empty");
+        static_assert(sizeof...(R) < 0xFFFF, "route table is too large");
+        return RouteTable<sizeof...(R)>(std::array<Route, sizeof...(R)>{r...});
+    }
+
+    /**
+     * @brief Install a constexpr route table as the route dispatcher.
+     *
+     * Routes registered with register_uri() and the module's built-in routes
+     * take precedence; the table is consulted for every other request.
+     * Handlers that return ESP_ERR_NOT_FOUND fall through to redirects and
+     * static files, so they must not have sent a response; any other
+     * result, ESP_ERR_NOT_SUPPORTED included, is returned to httpd as is.
+     *
+     * @return ESP_OK, or ESP_FAIL if the module mutex cannot be created.
+     */
+    template <const auto &Table>
+    esp_err_t install_routes()
+    {
+        return set_route_dispatcher([](httpd_req_t *req, std::string_view path, RouteMatch &match) -> esp_err_t
+                                    { return Table.dispatch(req, path, match); });
+    }
+} // namespace http_srv
+
+#endif // __cpp_consteval
@@ -17,11 +17,228 @@ extern "C"
 {
 #include "esp_err.h"
 #include "esp_http_server.h"
+#include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 } // extern "C"
 
+#include <cstddef>
+#include <cstdint>
+
 namespace http_srv
 {
+    /**
+     * @brief Snapshot of module counters returned by get_stats().
+     *
+     * Counters are cumulative since boot and wrap on overflow, except for
+     * fields documented as current values.
+     */
+    struct Stats
+    {
+        /** Large responses handed to the worker task. */
+        uint32_t transfers_started;
+        /** Background transfers that sent their final chunk. */
+        uint32_t transfers_completed;
+        /** Background transfers dropped on send error, client loss or stop(). */
+        uint32_t transfers_aborted;
+        /** Large responses sent inline because no transfer slot was free. */
+        uint32_t transfers_inline;
+        /** Background transfers currently in flight (current value). */
+        uint32_t transfers_active;
+        /** Static lookups answered by the metadata index. */
+        uint32_t index_hits;
+        /** Static lookups that had to probe the filesystem. */
+        uint32_t index_misses;
+        /** Static responses sent from the RAM content cache. */
+        uint32_t cache_hits;
+        /** Static responses not found in the RAM content cache. */
+        uint32_t cache_misses;
+        /** Bytes held by the RAM content cache (current value). */
+        uint32_t cache_bytes;
+        /** Hot assets preloaded at the last start (current value). */
+        uint32_t prewarmed;
+        /** Streamed files served from an already open handle. */
+        uint32_t open_file_hits;
+        /** Streamed files that had to be opened. */
+        uint32_t open_file_misses;
+        /** Calls into the application's credential verifier. */
+        uint32_t auth_verifications;
+        /** Protected requests authorized from the session cache. */
+        uint32_t auth_session_hits;
+        /** Protected requests rejected with 401. */
+        uint32_t auth_failures;
+        /** Keep-alive sessions closed by the idle reaper. */
+        uint32_t sessions_reaped;
+        /** Client sessions currently open (current value). */
+        uint32_t sessions_open;
+        /** Resumable uploads finalized into place. */
+        uint32_t uploads_completed;
+        /** Partial uploads removed after their lifetime expired. */
+        uint32_t uploads_expired;
+        /** NVS commits made by the settings store. */
+        uint32_t settings_commits;
+        /** Settings keys written by those commits. */
+        uint32_t settings_keys_written;
+        /** Idle-to-busy transitions that took the power-management boost. */
+        uint32_t pm_boosts;
+        /** True while the power-management boost is held (current value). */
+        bool pm_held;
+        /** True while memory pressure has the server in degraded mode (current value). */
+        bool mem_degraded;
+        /** Entries into degraded mode. */
+        uint32_t mem_degraded_entries;
+        /** Exits from degraded mode after memory recovered. */
+        uint32_t mem_degraded_exits;
+    };
+
+    /**
+     * @brief Credential verifiers used by protected routes.
+     *
+     * Either callback may be null to disable that scheme. Callbacks run on
+     * the httpd task and may be slow (PBKDF2, bcrypt, HMAC); each distinct
+     * credential is verified once per session lifetime.
+     */
+    struct AuthVerifier
+    {
+        /** Verify a Basic user name and password. */
+        bool (*basic)(const char *user, const char *password, void *ctx);
+        /** Verify a Bearer token. */
+        bool (*bearer)(const char *token, void *ctx);
+        /** Passed to both callbacks. */
+        void *ctx;
+    };
+
+    /**
+     * @brief Performance knobs that can be changed at runtime with tune().
+     *
+     * Initial values come from Kconfig. Handlers read the active set through
+     * one atomic load, so a tune() call is applied as a whole and never seen
+     * half-written.
+     */
+    struct Tuning
+    {
+        /** Snapshot version; increments on every tune(). Ignored by tune(). */
+        uint32_t version;
+        /** RAM budget of the static content cache in bytes. */
+        uint32_t cache_bytes;
+        /** Largest file held in the content cache in bytes. */
+        uint32_t cache_max_entry_bytes;
+        /** Files larger than this are sent by the worker task. */
+        uint32_t transfer_threshold;
+        /** Bytes sent per background transfer turn. Capped by Kconfig. */
+        uint32_t transfer_chunk_size;
+        /** Maximum background transfers in flight. Capped by Kconfig. */
+        uint32_t max_transfers;
+        /** Log level applied to the "http_server" tag. */
+        esp_log_level_t log_level;
+    };
+
+    /** @brief Producer::length value for a body of unknown length. */
+    inline constexpr size_t kUnknownLength = SIZE_MAX;
+
+    /** @brief Producer return value: no data yet, call again later. */
+    inline constexpr size_t kProduceAgain = SIZE_MAX - 1U;
+
+    /** @brief Producer return value: abort the response. */
+    inline constexpr size_t kProduceError = SIZE_MAX;
+
+    /**
+     * @brief Response body source for register_producer() routes.
+     */
+    struct Producer
+    {
+        /**
+         * Fill buf with up to cap bytes and return the count, 0 at the end of
+         * the body, kProduceAgain if nothing is available yet, or
+         * kProduceError to abort. Called on the worker task, only when the
+         * client can take more data.
+         */
+        size_t (*produce)(void *ctx, uint8_t *buf, size_t cap);
+        /**
+         * Called once when the response ends; completed is false if it was
+         * aborted or the client disconnected. May be null.
+         */
+        void (*finish)(void *ctx, bool completed);
+        /** Passed to produce and finish. */
+        void *ctx;
+        /** Content-Type. Must stay valid until finish. */
+        const char *ctype;
+        /** Content-Encoding of the produced bytes, or null. Must stay valid until finish. */
+        const char *encoding;
+        /** Exact body length if known (sent as Content-Length), else kUnknownLength. */
+        size_t length;
+    };
+
+    /**
+     * @brief Per-request setup for a producer route.
+     *
+     * Runs on the httpd task. Fill *out (ctype defaults to
+     * application/octet-stream, length to kUnknownLength) and return ESP_OK,
+     * or return ESP_ERR_NOT_FOUND for a 404 or any other error for a 500.
+     * Must not send a response itself.
+     */
+    using ProducerOpenFn = esp_err_t (*)(httpd_req_t *req, Producer *out);
+
+    /** @brief Element type of the fields of a stream sample. */
+    enum class SampleType : uint8_t
+    {
+        I16,
+        U16,
+        I32,
+        U32,
+        F32
+    };
+
+    /** @brief Sample stream created by create_stream(). Opaque. */
+    struct Stream;
+
+    /**
+     * @brief Parameters for create_stream().
+     */
+    struct StreamConfig
+    {
+        /** URI the stream is served at. Must stay valid for the program lifetime. */
+        const char *uri;
+        /** Type of every field in a sample. */
+        SampleType type;
+        /** Fields per sample, 1 to 16. */
+        uint8_t fields;
+        /** Ring capacity in samples; rounded up to a power of two, at least 64. */
+        uint32_t capacity;
+    };
+
+    /**
+     * @brief Browser caching policy of a response, from least to most
+     *        cacheable.
+     */
+    enum class CachePolicy : uint8_t
+    {
+        NO_STORE,   ///< Never stored (APIs, live data).
+        REVALIDATE, ///< Stored, but revalidated on every use.
+        SHORT,      ///< Fresh for CONFIG_HTTP_SERVER_CACHE_SHORT_MAX_AGE_S, then revalidated.
+        LONG,       ///< Fresh for CONFIG_HTTP_SERVER_CACHE_LONG_MAX_AGE_S.
+        IMMUTABLE   ///< Fresh for the long max-age and never revalidated.
+    };
+
+    /**
+     * @brief One entry of the cache policy table; see set_cache_rules().
+     */
+    struct CacheRule
+    {
+        /**
+         * Path pattern such as "/app.js" or "*.woff2", or MIME pattern such
+         * as "text/html"; see set_cache_rules(). Copied.
+         */
+        const char *pattern;
+        /** Policy of matching responses. */
+        CachePolicy policy;
+    };
+
+    /** @brief Callback run by the worker task when a timer expires. */
+    using TimerFn = void (*)(void *arg);
+
+    /** @brief Handle returned by schedule_timer(). 0 is never a valid id. */
+    using TimerId = uint32_t;
+
     /**
      * @brief Start the HTTP server and worker task.
      *
@@ -101,6 +318,80 @@ namespace http_srv
                            httpd_method_t method,
                            esp_err_t (*handler)(httpd_req_t *));
 
+    /**
+     * @brief Register a route whose response body is pulled from a producer.
+     *
+     * The server owns the buffer, chunk sizing, framing and cancellation:
+     * the response is handed to the worker task, which calls
+     * Producer::produce whenever the client socket can take more data, so a
+     * slow client slows its producer down and concurrent responses are
+     * interleaved fairly. Bodies of known length are sent with
+     * Content-Length, others with chunked encoding. Responses share the
+     * background transfer slots (Tuning::max_transfers, minimum one); when
+     * none is free the client gets 503.
+     *
+     * Like register_uri(), routes are dropped by stop().
+     *
+     * @param uri URI pattern.
+     * @param method HTTP method.
+     * @param open Per-request setup.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG if uri or open is null.
+     * @return ESP_ERR_INVALID_STATE if the server is not running.
+     * @return Other esp_err_t values from httpd_register_uri_handler().
+     */
+    esp_err_t register_producer(const char *uri,
+                                httpd_method_t method,
+                                ProducerOpenFn open);
+
+    /**
+     * @brief Register a URI handler that requires authentication.
+     *
+     * Requests are authorized by a "sid" session cookie, or by Basic or Bearer
+     * credentials accepted by the verifier installed with set_auth_verifier().
+     * After a successful verification the server creates a session, caches it
+     * in a fixed-size table and returns its token as an HttpOnly cookie.
+     * Later requests with the cookie, or with the same Authorization header,
+     * are authorized by a constant-time table lookup without calling the
+     * verifier. Unauthorized requests receive 401 with a Basic challenge.
+     *
+     * The handler is called with req->user_ctx set to null. Unregister with
+     * unregister_uri().
+     *
+     * @param uri URI string to register.
+     * @param method HTTP method for the handler.
+     * @param handler Handler function.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_STATE if the module is not running.
+     * @return ESP_ERR_INVALID_ARG if uri or handler is null.
+     * @return Other esp_err_t values as returned by ESP-IDF httpd registration.
+     */
+    esp_err_t register_protected_uri(const char *uri,
+                                     httpd_method_t method,
+                                     esp_err_t (*handler)(httpd_req_t *));
+
+    /**
+     * @brief Install the credential verifiers for protected routes.
+     *
+     * Replacing the verifiers drops all cached sessions.
+     *
+     * @param verifier Verifier callbacks and context.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_FAIL if the module state could not be locked.
+     */
+    esp_err_t set_auth_verifier(const AuthVerifier &verifier);
+
+    /**
+     * @brief Drop all cached authentication sessions.
+     *
+     * Call this after changing credentials so old ones stop working
+     * immediately. This function is thread-safe.
+     */
+    void clear_auth_sessions();
+
     /**
      * @brief Unregister a URI handler from the running server.
      *
@@ -117,6 +408,81 @@ namespace http_srv
      */
     esp_err_t unregister_uri(const char *uri, httpd_method_t method);
 
+    /**
+     * @brief Add or replace a redirect rule.
+     *
+     * Redirect rules are consulted only for requests whose URI has no
+     * registered handler. Exact rules match the request path (without query
+     * string) exactly. Prefix rules match any path starting with @p from; the
+     * matched prefix is replaced by @p location and the remainder is appended.
+     * When several prefix rules match, the longest one wins.
+     *
+     * Rules may be added before start() and persist across stop()/start().
+     *
+     * @param from Path or path prefix to match. Must start with '/'.
+     * @param location Value sent in the Location header.
+     * @param status_code One of 301, 302, 307 or 308.
+     * @param prefix true to match @p from as a prefix.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG if an argument is invalid.
+     * @return ESP_FAIL if the module state could not be locked.
+     */
+    esp_err_t add_redirect(const char *from,
+                           const char *location,
+                           int status_code,
+                           bool prefix = false);
+
+    /**
+     * @brief Add or replace an internal rewrite rule.
+     *
+     * Matching follows add_redirect(). Instead of answering with a redirect,
+     * the request is served as if it had asked for @p target. The target is
+     * resolved as static content (filesystem, then embedded pages), not
+     * dispatched to registered URI handlers. Like static files, rewrites
+     * apply to GET requests only; other methods get 404.
+     *
+     * @param from Path or path prefix to match. Must start with '/'.
+     * @param target Path to serve instead. Must start with '/'.
+     * @param prefix true to match @p from as a prefix.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG if an argument is invalid.
+     * @return ESP_FAIL if the module state could not be locked.
+     */
+    esp_err_t add_rewrite(const char *from, const char *target, bool prefix = false);
+
+    /**
+     * @brief Remove a redirect or rewrite rule.
+     *
+     * @param from Path or path prefix the rule was added with.
+     * @param prefix true if the rule was added as a prefix rule.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_NOT_FOUND if no such rule exists.
+     * @return ESP_ERR_INVALID_ARG if from is null.
+     * @return ESP_FAIL if the module state could not be locked.
+     */
+    esp_err_t remove_redirect(const char *from, bool prefix = false);
+
+    /**
+     * @brief Answer OS captive-portal probes with a redirect to the portal.
+     *
+     * Adds 302 rules for the connectivity-check paths used by Android, Apple,
+     * Windows and Firefox (generate_204, hotspot-detect.html, connecttest.txt,
+     * ncsi.txt and related paths). Probes are answered directly from the
+     * redirect table without touching the filesystem, which keeps the OS from
+     * giving up on the portal during SoftAP provisioning.
+     *
+     * @param portal_url Absolute URL of the portal page, for example
+     *        "http://192.168.4.1/".
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG if portal_url is null or empty.
+     * @return ESP_FAIL if the module state could not be locked.
+     */
+    esp_err_t enable_captive_portal(const char *portal_url);
+
     /**
      * @brief Close all active HTTP sessions.
      *
@@ -130,4 +496,302 @@ namespace http_srv
      * This function must not be called from an ISR.
      */
     void close_all_sessions();
+
+    /**
+     * @brief Return a snapshot of the module counters.
+     *
+     * This function is thread-safe, lock-free and may be called at any time,
+     * including before start().
+     *
+     * @return Current counter values.
+     */
+    Stats get_stats();
+
+    /**
+     * @brief Drop all cached filesystem metadata and content.
+     *
+     * Call this after changing files on the LittleFS partition outside the
+     * server, so stale paths or bodies are not served. Subsequent requests
+     * repopulate the caches.
+     *
+     * This function is thread-safe. It does nothing when LittleFS support is
+     * disabled.
+     */
+    void invalidate_cache();
+
+    /**
+     * @brief Schedule a one-shot or periodic job on the worker task.
+     *
+     * Jobs live in a hashed timer wheel driven by the module's worker task,
+     * so scheduling and cancelling are O(1) and no FreeRTOS software timer
+     * is created per job. Resolution is CONFIG_HTTP_SERVER_TIMER_TICK_MS.
+     * Callbacks run on the worker task and must be short and non-blocking;
+     * they share the task with background transfers.
+     *
+     * Timers may be scheduled at any time but only fire while the module is
+     * running. This function is thread-safe and may be called from a timer
+     * callback.
+     *
+     * @param delay_ms Delay before the first run.
+     * @param period_ms Interval between runs, or 0 for a one-shot timer.
+     * @param fn Callback.
+     * @param arg Passed to the callback.
+     *
+     * @return Timer id, or 0 if fn is null or the timer pool is exhausted.
+     */
+    TimerId schedule_timer(uint32_t delay_ms,
+                           uint32_t period_ms,
+                           TimerFn fn,
+                           void *arg);
+
+    /**
+     * @brief Cancel a timer.
+     *
+     * If the callback is currently running, it completes but does not run
+     * again. This function is thread-safe.
+     *
+     * @param id Id returned by schedule_timer().
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_NOT_FOUND if the timer already fired (one-shot) or was
+     *         cancelled.
+     * @return ESP_ERR_INVALID_ARG if id is 0.
+     * @return ESP_FAIL if the module state could not be locked.
+     */
+    esp_err_t cancel_timer(TimerId id);
+
+    /**
+     * @brief Serve an application-owned buffer at a URI.
+     *
+     * Meant for data in flash, rodata or RAM that stays put, such as
+     * generated reports or calibration tables. The ETag and header values are
+     * computed once here; each GET is answered with 304 Not Modified when the
+     * client already has the content, otherwise with a single send straight
+     * from the buffer. The buffer is not copied and must stay valid and
+     * unchanged for the program lifetime.
+     *
+     * The route is registered now if the server is running, and again after
+     * every start().
+     *
+     * @param uri Exact URI to serve.
+     * @param data Buffer.
+     * @param len Length of data in bytes.
+     * @param mime Content-Type; application/octet-stream if null.
+     * @param encoding Content-Encoding of data (for example "gzip"), or null.
+     *
+     * @return ESP_OK on success. If only registering the URI fails, that
+     *         error is returned and registration is retried at the next
+     *         start().
+     * @return ESP_ERR_INVALID_ARG if uri is null, or data is null with a
+     *         nonzero len.
+     * @return ESP_ERR_INVALID_STATE if a blob is already served at uri.
+     * @return ESP_ERR_NO_MEM on allocation failure.
+     */
+    esp_err_t serve_blob(const char *uri,
+                         const void *data,
+                         size_t len,
+                         const char *mime,
+                         const char *encoding = nullptr);
+
+    /**
+     * @brief Create a ring-buffered sample stream served over HTTP.
+     *
+     * The ring is allocated in PSRAM when available, otherwise in internal
+     * RAM, and is never freed. The stream is served at cfg.uri now if the
+     * server is running, and again after every start().
+     *
+     * Clients read it with GET <uri>?format=csv|ndjson|bin[&from=<seq>].
+     * Each reader has its own cursor, starting at the newest sample unless
+     * `from` names an older sequence number; the X-Stream-Seq response
+     * header reports the first sequence number sent. A reader that falls
+     * more than about 7/8 of the ring behind skips ahead and receives a gap
+     * marker for the samples it missed. Binary readers are sent slices of
+     * the ring directly, each preceded by a 12-byte frame header (type 0 for
+     * data, 1 for a gap; sample type; sample size; first sequence number;
+     * sample count). A gap frame that repeats the range of the preceding
+     * data frame means that data was overwritten while being sent and must
+     * be discarded.
+     *
+     * Readers are polled by the worker task every
+     * CONFIG_HTTP_SERVER_STREAM_POLL_MS, at most
+     * CONFIG_HTTP_SERVER_STREAM_MAX_READERS at a time across all streams.
+     *
+     * @param cfg Stream parameters.
+     * @param out Receives the stream handle for stream_push().
+     *
+     * @return ESP_OK on success. If only registering the URI fails, that
+     *         error is returned, *out is still set and registration is
+     *         retried at the next start().
+     * @return ESP_ERR_INVALID_ARG for an invalid configuration.
+     * @return ESP_ERR_NO_MEM if the ring cannot be allocated or
+     *         CONFIG_HTTP_SERVER_MAX_STREAMS streams already exist.
+     */
+    esp_err_t create_stream(const StreamConfig &cfg, Stream **out);
+
+    /**
+     * @brief Append samples to a stream.
+     *
+     * Never blocks and never waits for readers; slow readers lose data
+     * instead. Must only be called from one task per stream. Not ISR-safe.
+     *
+     * @param stream Handle from create_stream().
+     * @param samples count samples laid out as in StreamConfig.
+     * @param count Number of samples.
+     */
+    void stream_push(Stream *stream, const void *samples, size_t count);
+
+    /**
+     * @brief Return the active tuning snapshot.
+     *
+     * This function is thread-safe and lock-free.
+     *
+     * @return Copy of the active settings.
+     */
+    Tuning get_tuning();
+
+    /**
+     * @brief Apply a new set of tuning values atomically.
+     *
+     * Typical use is read-modify-write: call get_tuning(), change fields, and
+     * pass the result here. The new set is published as a new snapshot; a
+     * smaller cache budget is enforced immediately by evicting entries.
+     * Neither a restart nor a stop()/start() cycle is needed.
+     *
+     * When CONFIG_HTTP_SERVER_TUNE_ENDPOINT is enabled, the same settings can
+     * be read (GET) and changed (POST, JSON object) over HTTP with a bearer
+     * token.
+     *
+     * @param t New values. t.version is ignored.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG if a value is out of range.
+     * @return ESP_FAIL if the module state could not be locked.
+     */
+    esp_err_t tune(const Tuning &t);
+
+    /**
+     * @brief Store a setting; it is written to NVS shortly afterwards.
+     *
+     * The value goes into a RAM shadow and the call returns without touching
+     * flash. The worker task writes every changed key with a single
+     * nvs_commit() once no set has arrived for
+     * CONFIG_HTTP_SERVER_SETTINGS_DEBOUNCE_MS, and at the latest
+     * CONFIG_HTTP_SERVER_SETTINGS_MAX_DELAY_MS after the first unwritten set,
+     * and again when the server stops. Setting a key to its current value
+     * writes nothing. While the worker is not running, sets are written
+     * through. Values live in the CONFIG_HTTP_SERVER_SETTINGS_NAMESPACE NVS
+     * namespace; nvs_flash_init() must have been called.
+     *
+     * @param key NVS key, at most 15 characters.
+     * @param value Value.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG if the key is invalid.
+     * @return ESP_ERR_NO_MEM if CONFIG_HTTP_SERVER_SETTINGS_MAX_KEYS keys are
+     *         already held.
+     * @return NVS errors when written through.
+     */
+    esp_err_t settings_set_u32(const char *key, uint32_t value);
+
+    /** @brief Signed variant of settings_set_u32(). */
+    esp_err_t settings_set_i32(const char *key, int32_t value);
+
+    /** @brief String variant of settings_set_u32(). value is copied. */
+    esp_err_t settings_set_str(const char *key, const char *value);
+
+    /** @brief Binary variant of settings_set_u32(). data is copied. */
+    esp_err_t settings_set_blob(const char *key, const void *data, size_t len);
+
+    /**
+     * @brief Read a setting, including values not yet written to flash.
+     *
+     * The first read of a key loads it from NVS into the shadow.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_NOT_FOUND if the key has never been set.
+     * @return ESP_ERR_NVS_TYPE_MISMATCH if it was set with another type.
+     */
+    esp_err_t settings_get_u32(const char *key, uint32_t *out);
+
+    /** @brief Signed variant of settings_get_u32(). */
+    esp_err_t settings_get_i32(const char *key, int32_t *out);
+
+    /**
+     * @brief String variant of settings_get_u32().
+     *
+     * @return ESP_ERR_INVALID_SIZE if len cannot hold the string and its
+     *         terminator.
+     */
+    esp_err_t settings_get_str(const char *key, char *buf, size_t len);
+
+    /**
+     * @brief Binary variant of settings_get_u32(). len is the buffer size on
+     *        entry and the value size on return.
+     *
+     * @return ESP_ERR_INVALID_SIZE if the buffer is too small.
+     */
+    esp_err_t settings_get_blob(const char *key, void *buf, size_t *len);
+
+    /**
+     * @brief Write pending settings now, with one commit.
+     *
+     * @return ESP_OK on success, or the NVS error; failed keys stay pending.
+     */
+    esp_err_t settings_flush();
+
+    /**
+     * @brief Replace the cache policy table for static files.
+     *
+     * Rules are tried in order and the first match decides the Cache-Control
+     * header of a file served from LittleFS. A pattern starting with '/' is
+     * an exact request path, or a path prefix when it ends with '*'; one
+     * starting with "*." matches a path suffix; anything else matches the
+     * MIME type, by prefix when it ends with '*'. Files that match no rule
+     * are revalidated on every use.
+     *
+     * The default table makes fonts, images and HTML short-lived and
+     * everything else revalidated; revalidation is a 304 against the file's
+     * ETag. LONG and IMMUTABLE are only accepted for path rules (starting
+     * with '/'), meant for fingerprinted names such as "/assets/..." whose
+     * content never changes in place. The policy is resolved once per path
+     * and kept in the metadata index, and every header value is a constant
+     * string, so rules cost nothing per request. Dynamic responses (APIs,
+     * tails, streams, redirects) are always sent with no-store.
+     *
+     * @param rules Rules, or null to restore the defaults.
+     * @param count Number of rules.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG if a pattern is null or empty, or a LONG or
+     *         IMMUTABLE rule has an extension or MIME pattern.
+     * @return ESP_FAIL if the module state could not be locked.
+     */
+    esp_err_t set_cache_rules(const CacheRule *rules, size_t count);
+
+    /**
+     * @brief Replace the body sent for an HTTP error status.
+     *
+     * Error responses for 400, 401, 403, 404, 405, 408, 409, 411, 413, 414,
+     * 415, 416, 429, 431, 500, 501, 503 and 505 are served from a per-code
+     * table in RAM. By default each entry is a short plain-text body; when
+     * LittleFS is enabled, /errors/<code>.html replaces it at start. A page
+     * set here takes precedence over both.
+     *
+     * The body is not copied. It must stay valid until it is replaced, for
+     * example a string literal or an embedded asset in flash.
+     *
+     * @param code HTTP status code.
+     * @param body Page body, or null to restore the default page.
+     * @param len Body length in bytes.
+     * @param content_type Content type of the body. Required if body is set.
+     *
+     * @return ESP_OK on success.
+     * @return ESP_ERR_INVALID_ARG if code is not in the table or
+     *         content_type is missing.
+     * @return ESP_FAIL if the module state could not be locked.
+     */
+    esp_err_t set_error_page(int code,
+                             const char *body,
+                             size_t len,
+                             const char *content_type);
 } // namespace http_srv
@@ -0,0 +1,507 @@
+/**
+ * @file loadgen.cpp
+ * @brief Host-side load generator that measures small-request latency while
+ *        bulk downloads are running.
+ *
+ * loadgen runs in two phases against one server (the device, or netsim in
+ * front of it). It first sends --requests small GETs on their own for a
+ * baseline, then starts --bulk-clients connections that download --bulk in
+ * a loop and sends the same small GETs again. Each phase reports the latency
+ * percentiles of the small requests, from connect to the last body byte,
+ * and the second phase also reports the bulk throughput:
+ *
+ * @code
+ * c++ -O2 -std=c++17 -pthread -o loadgen tools/loadgen/loadgen.cpp
+ * ./loadgen --target 192.168.4.1:80 --bulk /big.bin --bulk-clients 2 \
+ *           --small /index.html --requests 200 --interval 50
+ * @endcode
+ *
+ * --bulk-rate caps how fast each bulk client reads, in kbit/s, so a bulk
+ * download can stand in for a slow client that keeps the server's send
+ * window full. Every request uses its own connection, so small-request
+ * latency includes accepting the connection, as it does for a browser that
+ * opens a new one.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+struct Options
+{
+    std::string target_host;
+    std::string target_port;
+    std::string bulk_path = "/big.bin";
+    std::string small_path = "/";
+    uint32_t bulk_clients = 1;
+    uint32_t bulk_rate_kbps = 0; // 0: read as fast as possible.
+    uint32_t requests = 100;
+    uint32_t interval_ms = 20;
+    uint32_t timeout_ms = 10000;
+    uint32_t warmup_ms = 1000;
+};
+
+static Options g_opt;
+static std::atomic<bool> g_stop{false};
+static std::atomic<uint64_t> g_bulk_bytes{0};
+static std::atomic<uint32_t> g_bulk_done{0};
+static std::atomic<uint32_t> g_bulk_errors{0};
+
+static int64_t now_us()
+{
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int connect_target()
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *res = nullptr;
+    if (getaddrinfo(g_opt.target_host.c_str(), g_opt.target_port.c_str(), &hints, &res) != 0)
+    {
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo *ai = res; ai != nullptr && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+
+    if (fd >= 0)
+    {
+        const int one = 1;
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+/**
+ * Reads from one response connection, waiting at most until the deadline
+ * and, with a rate cap, no faster than the cap allows.
+ */
+struct Reader
+{
+    Reader(int fd_, int64_t deadline_, uint32_t rate_kbps_, std::atomic<uint64_t> *progress_)
+        : fd(fd_), deadline(deadline_), rate_kbps(rate_kbps_), progress(progress_)
+    {
+    }
+
+    int fd;
+    int64_t deadline;
+    uint32_t rate_kbps;
+    std::atomic<uint64_t> *progress; // Counts bytes as they arrive; may be null.
+    int64_t started = now_us();
+    uint64_t total = 0;
+    std::string buf;
+    size_t pos = 0;
+
+    /** Append more bytes to buf; false on error, timeout or EOF. */
+    bool fill()
+    {
+        // Bulk downloads in progress are cut off when the run ends.
+        if (g_stop.load())
+        {
+            return false;
+        }
+
+        if (rate_kbps > 0U)
+        {
+            const int64_t due = started + static_cast<int64_t>(total * 8000U / rate_kbps);
+            const int64_t wait = due - now_us();
+            if (wait > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(wait));
+            }
+        }
+
+        const int64_t left = deadline - now_us();
+        pollfd p{fd, POLLIN, 0};
+        if (left <= 0 || poll(&p, 1, static_cast<int>((left + 999) / 1000)) <= 0)
+        {
+            return false;
+        }
+
+        // Small reads under a rate cap keep the pacing smooth.
+        char tmp[4096];
+        const size_t want = (rate_kbps > 0U) ? 1024U : sizeof(tmp);
+        const ssize_t n = recv(fd, tmp, want, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        total += static_cast<uint64_t>(n);
+        if (progress != nullptr)
+        {
+            progress->fetch_add(static_cast<uint64_t>(n));
+        }
+        buf.append(tmp, static_cast<size_t>(n));
+        return true;
+    }
+
+    /** Read one CRLF-terminated line, without the CRLF. */
+    bool line(std::string &out)
+    {
+        size_t eol;
+        while ((eol = buf.find("\r\n", pos)) == std::string::npos)
+        {
+            if (!fill())
+            {
+                return false;
+            }
+        }
+        out.assign(buf, pos, eol - pos);
+        pos = eol + 2U;
+        return true;
+    }
+
+    /** Consume n body bytes; drops what has been read to bound memory. */
+    bool skip(uint64_t n)
+    {
+        while (n > 0U)
+        {
+            if (pos == buf.size() && !fill())
+            {
+                return false;
+            }
+            const size_t take = static_cast<size_t>(std::min<uint64_t>(n, buf.size() - pos));
+            pos += take;
+            n -= take;
+            buf.erase(0, pos);
+            pos = 0;
+        }
+        return true;
+    }
+};
+
+static bool iequals_prefix(const std::string &s, const char *prefix)
+{
+    const size_t n = std::strlen(prefix);
+    return s.size() >= n && strncasecmp(s.c_str(), prefix, n) == 0;
+}
+
+/**
+ * Send one GET on a new connection and read the whole response. Returns the
+ * status code, or 0 on a connection error or timeout. body_bytes receives
+ * the body length; progress, if set, counts bytes as they arrive.
+ */
+static int fetch(const std::string &path,
+                 uint32_t rate_kbps,
+                 uint64_t &body_bytes,
+                 std::atomic<uint64_t> *progress = nullptr)
+{
+    body_bytes = 0;
+
+    const int fd = connect_target();
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    const std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + g_opt.target_host +
+                                "\r\nConnection: close\r\n\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+    {
+        close(fd);
+        return 0;
+    }
+
+    Reader r(fd, now_us() + static_cast<int64_t>(g_opt.timeout_ms) * 1000, rate_kbps, progress);
+
+    std::string l;
+    int status = 0;
+    if (!r.line(l) || std::sscanf(l.c_str(), "HTTP/%*d.%*d %d", &status) != 1)
+    {
+        close(fd);
+        return 0;
+    }
+
+    int64_t length = -1;
+    bool chunked = false;
+    while (r.line(l) && !l.empty())
+    {
+        if (iequals_prefix(l, "content-length:"))
+        {
+            length = std::strtoll(l.c_str() + 15, nullptr, 10);
+        }
+        else if (iequals_prefix(l, "transfer-encoding:") && l.find("chunked") != std::string::npos)
+        {
+            chunked = true;
+        }
+    }
+    if (!l.empty())
+    {
+        close(fd);
+        return 0;
+    }
+
+    bool ok = true;
+    if (chunked)
+    {
+        while (ok)
+        {
+            ok = r.line(l);
+            const uint64_t n = ok ? std::strtoull(l.c_str(), nullptr, 16) : 0U;
+            if (!ok || n == 0U)
+            {
+                // The final chunk is followed by an empty trailer line.
+                ok = ok && r.line(l);
+                break;
+            }
+            ok = r.skip(n) && r.skip(2);
+            body_bytes += n;
+        }
+    }
+    else if (length >= 0)
+    {
+        ok = r.skip(static_cast<uint64_t>(length));
+        body_bytes = static_cast<uint64_t>(length);
+    }
+    else
+    {
+        // No length: the body ends when the server closes.
+        const uint64_t before = r.total - (r.buf.size() - r.pos);
+        while (r.fill())
+        {
+        }
+        body_bytes = r.total - before;
+    }
+
+    close(fd);
+    return ok ? status : 0;
+}
+
+static void bulk_client()
+{
+    while (!g_stop.load())
+    {
+        uint64_t bytes = 0;
+        const int status = fetch(g_opt.bulk_path, g_opt.bulk_rate_kbps, bytes, &g_bulk_bytes);
+        if (status == 200)
+        {
+            g_bulk_done.fetch_add(1U);
+        }
+        else if (!g_stop.load())
+        {
+            g_bulk_errors.fetch_add(1U);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    const size_t i = static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1U) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1U)];
+}
+
+/**
+ * Send the small requests one after another and print their latencies.
+ */
+static void run_phase(const char *name)
+{
+    std::vector<double> ms;
+    uint32_t errors = 0;
+
+    for (uint32_t i = 0; i < g_opt.requests; ++i)
+    {
+        uint64_t bytes = 0;
+        const int64_t t0 = now_us();
+        const int status = fetch(g_opt.small_path, 0U, bytes);
+        const int64_t t1 = now_us();
+
+        if (status >= 200 && status < 400)
+        {
+            ms.push_back(static_cast<double>(t1 - t0) / 1000.0);
+        }
+        else
+        {
+            ++errors;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(g_opt.interval_ms));
+    }
+
+    std::sort(ms.begin(), ms.end());
+    std::printf("%-8s %5zu ok %4u failed   p50 %8.2f ms   p90 %8.2f ms   p99 %8.2f ms   max %8.2f ms\n",
+                name, ms.size(), errors,
+                percentile(ms, 50.0), percentile(ms, 90.0), percentile(ms, 99.0),
+                ms.empty() ? 0.0 : ms.back());
+}
+
+static bool parse_u32(const char *s, uint32_t &out)
+{
+    char *end = nullptr;
+    errno = 0;
+    const unsigned long v = std::strtoul(s, &end, 10);
+    if (errno != 0 || end == s || *end != '\0' || v > UINT32_MAX)
+    {
+        return false;
+    }
+    out = static_cast<uint32_t>(v);
+    return true;
+}
+
+static void usage()
+{
+    std::fprintf(stderr,
+                 "usage: loadgen --target HOST:PORT [--bulk PATH] [--bulk-clients N]\n"
+                 "               [--bulk-rate KBIT_S] [--small PATH] [--requests N]\n"
+                 "               [--interval MS] [--timeout MS] [--warmup MS]\n");
+}
+
+static bool parse_args(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        const std::string key(argv[i]);
+        const char *val = argv[i + 1];
+        bool ok = true;
+
+        if (key == "--target")
+        {
+            const std::string t(val);
+            const size_t colon = t.rfind(':');
+            ok = colon != std::string::npos && colon > 0U && colon + 1U < t.size();
+            if (ok)
+            {
+                g_opt.target_host = t.substr(0, colon);
+                g_opt.target_port = t.substr(colon + 1U);
+            }
+        }
+        else if (key == "--bulk")
+        {
+            g_opt.bulk_path = val;
+            ok = val[0] == '/';
+        }
+        else if (key == "--small")
+        {
+            g_opt.small_path = val;
+            ok = val[0] == '/';
+        }
+        else if (key == "--bulk-clients")
+        {
+            ok = parse_u32(val, g_opt.bulk_clients);
+        }
+        else if (key == "--bulk-rate")
+        {
+            ok = parse_u32(val, g_opt.bulk_rate_kbps);
+        }
+        else if (key == "--requests")
+        {
+            ok = parse_u32(val, g_opt.requests) && g_opt.requests > 0U;
+        }
+        else if (key == "--interval")
+        {
+            ok = parse_u32(val, g_opt.interval_ms);
+        }
+        else if (key == "--timeout")
+        {
+            ok = parse_u32(val, g_opt.timeout_ms) && g_opt.timeout_ms > 0U;
+        }
+        else if (key == "--warmup")
+        {
+            ok = parse_u32(val, g_opt.warmup_ms);
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            std::fprintf(stderr, "loadgen: bad value for %s: %s\n", key.c_str(), val);
+            return false;
+        }
+    }
+
+    return !g_opt.target_host.empty();
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (!parse_args(argc, argv))
+    {
+        usage();
+        return 2;
+    }
+
+    std::fprintf(stderr, "loadgen: %s:%s, small %s, bulk %s x%u\n",
+                 g_opt.target_host.c_str(), g_opt.target_port.c_str(),
+                 g_opt.small_path.c_str(), g_opt.bulk_path.c_str(), g_opt.bulk_clients);
+
+    run_phase("idle");
+
+    if (g_opt.bulk_clients == 0U)
+    {
+        return 0;
+    }
+
+    std::vector<std::thread> bulk;
+    for (uint32_t i = 0; i < g_opt.bulk_clients; ++i)
+    {
+        bulk.emplace_back(bulk_client);
+    }
+
+    // Let the bulk downloads fill their send windows first.
+    std::this_thread::sleep_for(std::chrono::milliseconds(g_opt.warmup_ms));
+
+    const int64_t t0 = now_us();
+    const uint64_t b0 = g_bulk_bytes.load();
+    run_phase("bulk");
+    const double secs = static_cast<double>(now_us() - t0) / 1e6;
+    const uint64_t b1 = g_bulk_bytes.load();
+
+    g_stop.store(true);
+    for (auto &t : bulk)
+    {
+        t.join();
+    }
+
+    std::printf("bulk     %u downloads, %u failed, %.1f kB/s during the bulk phase\n",
+                g_bulk_done.load(), g_bulk_errors.load(),
+                static_cast<double>(b1 - b0) / 1024.0 / secs);
+    return 0;
+}
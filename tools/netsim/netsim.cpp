@@ -0,0 +1,589 @@
+/**
+ * @file netsim.cpp
+ * @brief Deterministic link impairment proxy for testing the HTTP server from
+ *        a host.
+ *
+ * netsim listens on a local port and relays every connection to the server
+ * (the device, or any other host). Each direction of each connection passes
+ * through a simulated link with latency, jitter, a bandwidth cap, segment
+ * loss, reordering and a small receive window. Point the load generator at
+ * netsim instead of the server:
+ *
+ * @code
+ * c++ -O2 -std=c++17 -o netsim tools/netsim/netsim.cpp
+ * ./netsim --listen 8080 --target 192.168.4.1:80 --seed 7 \
+ *          --latency 40 --jitter 10 --rate 2000 --loss 1 --reorder 5 \
+ *          --window 4096
+ * curl -o /dev/null http://127.0.0.1:8080/big.bin
+ * @endcode
+ *
+ * The stream is cut into --mss byte segments by offset. Whether a segment is
+ * lost or reordered, and its jitter, is a hash of the seed, the connection
+ * number, the direction and the segment index. The same seed therefore
+ * impairs the same bytes of the same connection on every run, however the
+ * bytes happen to be split across reads.
+ *
+ * netsim sits above TCP, so the impairments are modeled by their effect on
+ * the byte stream the application sees:
+ * - latency and jitter delay each segment;
+ * - the rate cap serializes segments on the link;
+ * - a lost segment arrives one retransmission timeout late;
+ * - a reordered segment arrives --reorder-delay late.
+ * Delivery stays in order, so later segments queue behind a late one, as
+ * they would in a receiver's reassembly buffer. --window caps the bytes in
+ * flight per direction and shrinks the socket buffers, so a sender sees
+ * backpressure as it would from a client with a small receive window.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+struct Options
+{
+    uint16_t listen_port = 0;
+    std::string target_host;
+    std::string target_port;
+    uint64_t seed = 1;
+    uint32_t latency_ms = 0;
+    uint32_t jitter_ms = 0;
+    uint32_t rate_kbps = 0; // 0: unlimited.
+    double loss_pct = 0.0;
+    double reorder_pct = 0.0;
+    uint32_t reorder_delay_ms = 0; // 0: one latency.
+    uint32_t rto_ms = 200;
+    uint32_t window = 0; // 0: unlimited.
+    uint32_t mss = 1460;
+};
+
+static Options g_opt;
+
+static int64_t now_us()
+{
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Uniform value in [0, 1) for draw number `which` of one segment.
+ */
+static double segment_draw(uint64_t stream_key, uint64_t segment, uint32_t which)
+{
+    const uint64_t h = splitmix64(stream_key ^ splitmix64(segment * 4U + which));
+    return static_cast<double>(h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+struct Piece
+{
+    int64_t deliver_at;
+    std::string data;
+    size_t pos;
+};
+
+/**
+ * One direction of a connection: bytes read from `from` wait in `queue`
+ * until their delivery time and are then written to `to`.
+ */
+struct Pipe
+{
+    int from = -1;
+    int to = -1;
+    uint64_t key = 0; // Hash key of this stream.
+    uint64_t offset = 0;
+    int64_t link_free_at = 0;
+    int64_t last_delivery = 0;
+    size_t queued = 0;
+    bool eof = false;
+    bool shut = false;
+    std::deque<Piece> queue;
+
+    uint64_t bytes = 0;
+    uint32_t lost = 0;
+    uint32_t reordered = 0;
+};
+
+struct Conn
+{
+    uint32_t id;
+    int client;
+    int server;
+    Pipe up;   // Client to server.
+    Pipe down; // Server to client.
+};
+
+static bool set_nonblocking(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void tune_socket(int fd)
+{
+    const int one = 1;
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (g_opt.window > 0U)
+    {
+        const int size = static_cast<int>(g_opt.window);
+        (void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        (void)setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+}
+
+/**
+ * Queue n bytes read from the pipe's source, one piece per segment (or
+ * segment fragment), with their simulated delivery times.
+ */
+static void enqueue(Pipe &p, const char *buf, size_t n, int64_t now)
+{
+    const int64_t latency = static_cast<int64_t>(g_opt.latency_ms) * 1000;
+    const int64_t reorder_delay =
+        (g_opt.reorder_delay_ms > 0U) ? static_cast<int64_t>(g_opt.reorder_delay_ms) * 1000 : latency;
+
+    while (n > 0U)
+    {
+        const uint64_t segment = p.offset / g_opt.mss;
+        const size_t room = static_cast<size_t>(g_opt.mss - p.offset % g_opt.mss);
+        const size_t len = std::min(n, room);
+
+        // Draws depend only on the segment index, so both fragments of a
+        // segment split across reads get the same fate.
+        const bool first_fragment = (p.offset % g_opt.mss) == 0U;
+        const bool lost = segment_draw(p.key, segment, 0) * 100.0 < g_opt.loss_pct;
+        const bool late = segment_draw(p.key, segment, 1) * 100.0 < g_opt.reorder_pct;
+        const double jitter = (segment_draw(p.key, segment, 2) * 2.0 - 1.0) * g_opt.jitter_ms * 1000.0;
+
+        int64_t t = std::max(now, p.link_free_at);
+        if (g_opt.rate_kbps > 0U)
+        {
+            t += static_cast<int64_t>(len) * 8000 / g_opt.rate_kbps;
+        }
+        p.link_free_at = t;
+
+        t += latency + static_cast<int64_t>(jitter);
+        if (lost)
+        {
+            t += static_cast<int64_t>(g_opt.rto_ms) * 1000;
+        }
+        if (late)
+        {
+            t += reorder_delay;
+        }
+
+        if (first_fragment)
+        {
+            p.lost += lost ? 1U : 0U;
+            p.reordered += late ? 1U : 0U;
+        }
+
+        // In-order delivery: nothing overtakes a late segment.
+        p.last_delivery = std::max(p.last_delivery, t);
+        p.queue.push_back(Piece{p.last_delivery, std::string(buf, len), 0U});
+        p.queued += len;
+        p.offset += len;
+        buf += len;
+        n -= len;
+    }
+}
+
+static bool can_read(const Pipe &p)
+{
+    return !p.eof && (g_opt.window == 0U || p.queued < g_opt.window);
+}
+
+/**
+ * Read what the window allows. Returns false on a socket error.
+ */
+static bool pump_in(Pipe &p, int64_t now)
+{
+    char buf[16384];
+    size_t want = sizeof(buf);
+    if (g_opt.window > 0U)
+    {
+        want = std::min(want, static_cast<size_t>(g_opt.window - p.queued));
+    }
+
+    const ssize_t n = read(p.from, buf, want);
+    if (n > 0)
+    {
+        enqueue(p, buf, static_cast<size_t>(n), now);
+        return true;
+    }
+    if (n == 0)
+    {
+        p.eof = true;
+        return true;
+    }
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+/**
+ * Write every piece that is due. Returns false on a socket error.
+ */
+static bool pump_out(Pipe &p, int64_t now)
+{
+    while (!p.queue.empty() && p.queue.front().deliver_at <= now)
+    {
+        Piece &piece = p.queue.front();
+        const ssize_t n = write(p.to, piece.data.data() + piece.pos, piece.data.size() - piece.pos);
+        if (n < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+
+        piece.pos += static_cast<size_t>(n);
+        p.queued -= static_cast<size_t>(n);
+        p.bytes += static_cast<uint64_t>(n);
+        if (piece.pos < piece.data.size())
+        {
+            return true;
+        }
+        p.queue.pop_front();
+    }
+
+    if (p.eof && p.queue.empty() && !p.shut)
+    {
+        (void)shutdown(p.to, SHUT_WR);
+        p.shut = true;
+    }
+    return true;
+}
+
+static int open_listener(uint16_t port)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    const int one = 1;
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(fd, 16) != 0 || !set_nonblocking(fd))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connect_target()
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *res = nullptr;
+    if (getaddrinfo(g_opt.target_host.c_str(), g_opt.target_port.c_str(), &hints, &res) != 0)
+    {
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo *ai = res; ai != nullptr && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        tune_socket(fd);
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+
+    if (fd >= 0 && !set_nonblocking(fd))
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void close_conn(Conn &c)
+{
+    std::fprintf(stderr,
+                 "netsim: conn %u closed: up %llu bytes (%u lost, %u reordered), "
+                 "down %llu bytes (%u lost, %u reordered)\n",
+                 c.id,
+                 static_cast<unsigned long long>(c.up.bytes), c.up.lost, c.up.reordered,
+                 static_cast<unsigned long long>(c.down.bytes), c.down.lost, c.down.reordered);
+    close(c.client);
+    close(c.server);
+}
+
+static bool parse_u32(const char *s, uint32_t &out)
+{
+    char *end = nullptr;
+    errno = 0;
+    const unsigned long v = std::strtoul(s, &end, 10);
+    if (errno != 0 || end == s || *end != '\0' || v > UINT32_MAX)
+    {
+        return false;
+    }
+    out = static_cast<uint32_t>(v);
+    return true;
+}
+
+static bool parse_pct(const char *s, double &out)
+{
+    char *end = nullptr;
+    out = std::strtod(s, &end);
+    return end != s && *end == '\0' && out >= 0.0 && out <= 100.0;
+}
+
+static void usage()
+{
+    std::fprintf(stderr,
+                 "usage: netsim --listen PORT --target HOST:PORT [--seed N]\n"
+                 "              [--latency MS] [--jitter MS] [--rate KBIT_S]\n"
+                 "              [--loss PCT] [--reorder PCT] [--reorder-delay MS]\n"
+                 "              [--rto MS] [--window BYTES] [--mss BYTES]\n");
+}
+
+static bool parse_args(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        const std::string key(argv[i]);
+        const char *val = argv[i + 1];
+        uint32_t u = 0;
+        bool ok = true;
+
+        if (key == "--listen")
+        {
+            ok = parse_u32(val, u) && u > 0U && u <= 65535U;
+            g_opt.listen_port = static_cast<uint16_t>(u);
+        }
+        else if (key == "--target")
+        {
+            const std::string t(val);
+            const size_t colon = t.rfind(':');
+            ok = colon != std::string::npos && colon > 0U && colon + 1U < t.size();
+            if (ok)
+            {
+                g_opt.target_host = t.substr(0, colon);
+                g_opt.target_port = t.substr(colon + 1U);
+            }
+        }
+        else if (key == "--seed")
+        {
+            char *end = nullptr;
+            g_opt.seed = std::strtoull(val, &end, 0);
+            ok = end != val && *end == '\0';
+        }
+        else if (key == "--latency")
+        {
+            ok = parse_u32(val, g_opt.latency_ms);
+        }
+        else if (key == "--jitter")
+        {
+            ok = parse_u32(val, g_opt.jitter_ms);
+        }
+        else if (key == "--rate")
+        {
+            ok = parse_u32(val, g_opt.rate_kbps);
+        }
+        else if (key == "--loss")
+        {
+            ok = parse_pct(val, g_opt.loss_pct);
+        }
+        else if (key == "--reorder")
+        {
+            ok = parse_pct(val, g_opt.reorder_pct);
+        }
+        else if (key == "--reorder-delay")
+        {
+            ok = parse_u32(val, g_opt.reorder_delay_ms);
+        }
+        else if (key == "--rto")
+        {
+            ok = parse_u32(val, g_opt.rto_ms);
+        }
+        else if (key == "--window")
+        {
+            ok = parse_u32(val, g_opt.window);
+        }
+        else if (key == "--mss")
+        {
+            ok = parse_u32(val, g_opt.mss) && g_opt.mss > 0U;
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            std::fprintf(stderr, "netsim: bad value for %s: %s\n", key.c_str(), val);
+            return false;
+        }
+    }
+
+    return g_opt.listen_port != 0U && !g_opt.target_host.empty();
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (!parse_args(argc, argv))
+    {
+        usage();
+        return 2;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const int listener = open_listener(g_opt.listen_port);
+    if (listener < 0)
+    {
+        std::perror("netsim: listen");
+        return 1;
+    }
+
+    std::fprintf(stderr, "netsim: 127.0.0.1:%u -> %s:%s, seed %llu\n",
+                 g_opt.listen_port, g_opt.target_host.c_str(), g_opt.target_port.c_str(),
+                 static_cast<unsigned long long>(g_opt.seed));
+
+    std::vector<std::unique_ptr<Conn>> conns;
+    uint32_t next_id = 0;
+
+    while (true)
+    {
+        const int64_t now = now_us();
+
+        std::vector<pollfd> fds;
+        fds.push_back(pollfd{listener, POLLIN, 0});
+
+        int64_t next_due = -1;
+        for (const auto &c : conns)
+        {
+            for (const Pipe *p : {&c->up, &c->down})
+            {
+                short ev_from = can_read(*p) ? POLLIN : 0;
+                short ev_to = 0;
+                if (!p->queue.empty())
+                {
+                    const int64_t due = p->queue.front().deliver_at;
+                    if (due <= now)
+                    {
+                        ev_to = POLLOUT;
+                    }
+                    else if (next_due < 0 || due < next_due)
+                    {
+                        next_due = due;
+                    }
+                }
+                fds.push_back(pollfd{p->from, ev_from, 0});
+                fds.push_back(pollfd{p->to, ev_to, 0});
+            }
+        }
+
+        const int timeout_ms =
+            (next_due < 0) ? -1 : static_cast<int>(std::max<int64_t>(0, (next_due - now + 999) / 1000));
+
+        if (poll(fds.data(), fds.size(), timeout_ms) < 0 && errno != EINTR)
+        {
+            std::perror("netsim: poll");
+            return 1;
+        }
+
+        if ((fds[0].revents & POLLIN) != 0)
+        {
+            const int client = accept(listener, nullptr, nullptr);
+            if (client >= 0)
+            {
+                tune_socket(client);
+                const int server = connect_target();
+                if (server < 0 || !set_nonblocking(client))
+                {
+                    std::fprintf(stderr, "netsim: cannot reach %s:%s\n",
+                                 g_opt.target_host.c_str(), g_opt.target_port.c_str());
+                    close(client);
+                    if (server >= 0)
+                    {
+                        close(server);
+                    }
+                }
+                else
+                {
+                    auto c = std::make_unique<Conn>();
+                    c->id = next_id++;
+                    c->client = client;
+                    c->server = server;
+                    c->up.from = client;
+                    c->up.to = server;
+                    c->up.key = splitmix64(g_opt.seed ^ splitmix64(static_cast<uint64_t>(c->id) * 2U));
+                    c->down.from = server;
+                    c->down.to = client;
+                    c->down.key = splitmix64(g_opt.seed ^ splitmix64(static_cast<uint64_t>(c->id) * 2U + 1U));
+                    conns.push_back(std::move(c));
+                }
+            }
+        }
+
+        const int64_t t = now_us();
+        for (size_t i = 0; i < conns.size();)
+        {
+            Conn &c = *conns[i];
+            bool ok = true;
+            for (Pipe *p : {&c.up, &c.down})
+            {
+                ok = ok && (!can_read(*p) || pump_in(*p, t)) && pump_out(*p, t);
+            }
+
+            const bool done = c.up.shut && c.down.shut;
+            if (!ok || done)
+            {
+                close_conn(c);
+                conns.erase(conns.begin() + static_cast<std::ptrdiff_t>(i));
+                continue;
+            }
+            ++i;
+        }
+    }
+}